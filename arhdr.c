@@ -0,0 +1,174 @@
+/**
+ * @file arhdr.c
+ * @author Dan Albert
+ * @date Created 10/16/2026
+ * @date Last updated 10/16/2026
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Implements encoding and decoding of the fixed width ar member header.
+ * 
+ */
+#define _GNU_SOURCE 1
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include "arhdr.h"
+
+/**
+ * @brief Reads an unsigned number from a space padded header field.
+ * 
+ * Preconditions: field holds width characters, base is at most 10
+ * 
+ * Postconditions:
+ *
+ * @param field Field to read
+ * @param width Width of the field
+ * @param base Base of the number
+ * @return The number, zero if the field holds none
+ */
+uint64_t arhdr_get(const char *field, size_t width, unsigned int base);
+
+/**
+ * @brief Writes an unsigned number right aligned into a header field.
+ * 
+ * Preconditions: field has room for width characters, base is at most 10
+ * 
+ * Postconditions: field holds the number padded with spaces, or its lowest
+ * digits if it doesn't fit
+ *
+ * @param field Field to write
+ * @param width Width of the field
+ * @param value Number to write
+ * @param base Base to write the number in
+ * @return true on success, false if the number doesn't fit
+ */
+bool arhdr_put(char *field, size_t width, uint64_t value, unsigned int base);
+
+bool arhdr_decode(const struct ar_hdr *hdr, struct arhdr_fields *fields) {
+	char *name;
+	size_t len;
+
+	assert(hdr != NULL);
+	assert(fields != NULL);
+
+	name = fields->name;
+	memcpy(name, hdr->ar_name, SARFNAME);
+	name[SARFNAME] = '\0';
+
+	// Drop the padding and trailing slash in one backwards scan, leaving
+	// the slashes of special member names alone
+	len = SARFNAME;
+	while ((len > 0) && ((name[len - 1] == ' ') ||
+			((name[len - 1] == '/') && (name[0] != '/')))) {
+		len--;
+	}
+
+	name[len] = '\0';
+
+	fields->date = arhdr_get(hdr->ar_date, SARFDATE, 10);
+	fields->uid = arhdr_get(hdr->ar_uid, SARFUID, 10);
+	fields->gid = arhdr_get(hdr->ar_gid, SARFGID, 10);
+	fields->mode = arhdr_get(hdr->ar_mode, SARFMODE, 8);
+	fields->size = arhdr_get(hdr->ar_size, SARFSIZE, 10);
+
+	return memcmp(hdr->ar_fmag, ARFMAG, SARFMAG) == 0;
+}
+
+bool arhdr_encode(struct ar_hdr *hdr, const struct arhdr_fields *fields) {
+	size_t len;
+	bool ok;
+
+	assert(hdr != NULL);
+	assert(fields != NULL);
+
+	len = strnlen(fields->name, SARFNAME);
+	memcpy(hdr->ar_name, fields->name, len);
+	memset(hdr->ar_name + len, ' ', SARFNAME - len);
+
+	// Only the size matters to reading the archive back. Times before the
+	// epoch are written as zero and times past the field as its largest
+	// value. IDs that don't fit are written as zero, as GNU ar does.
+	if (arhdr_put(hdr->ar_date, SARFDATE,
+			(fields->date < 0) ? 0 : (uint64_t)fields->date, 10) == false) {
+		memset(hdr->ar_date, '9', SARFDATE);
+	}
+
+	if (arhdr_put(hdr->ar_uid, SARFUID, fields->uid, 10) == false) {
+		arhdr_put(hdr->ar_uid, SARFUID, 0, 10);
+	}
+
+	if (arhdr_put(hdr->ar_gid, SARFGID, fields->gid, 10) == false) {
+		arhdr_put(hdr->ar_gid, SARFGID, 0, 10);
+	}
+
+	arhdr_put(hdr->ar_mode, SARFMODE, fields->mode, 8);
+	ok = arhdr_put(hdr->ar_size, SARFSIZE, (uint64_t)fields->size, 10);
+	memcpy(hdr->ar_fmag, ARFMAG, SARFMAG);
+
+	return ok;
+}
+
+uint64_t arhdr_get(const char *field, size_t width, unsigned int base) {
+	uint64_t value = 0;
+	size_t i = 0;
+
+	assert(field != NULL);
+	assert(base <= 10);
+
+	while ((i < width) && (field[i] == ' ')) {
+		i++;
+	}
+
+	// Anything below '0' wraps around, so one compare catches every
+	// character that isn't a digit of the base
+	for (; i < width; i++) {
+		unsigned int digit = (unsigned char)field[i] - (unsigned int)'0';
+
+		if (digit >= base) {
+			break;
+		}
+
+		value = value * base + digit;
+	}
+
+	return value;
+}
+
+bool arhdr_put(char *field, size_t width, uint64_t value, unsigned int base) {
+	size_t i = width;
+
+	assert(field != NULL);
+	assert(width > 0);
+	assert(base <= 10);
+
+	// Fill in digits from the right
+	do {
+		field[--i] = (char)('0' + value % base);
+		value /= base;
+	} while ((value != 0) && (i > 0));
+
+	memset(field, ' ', i);
+
+	return value == 0;
+}
+
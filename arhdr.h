@@ -0,0 +1,106 @@
+/**
+ * @file arhdr.h
+ * @author Dan Albert
+ * @date Created 10/16/2026
+ * @date Last updated 10/16/2026
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Defines encoding and decoding of the fixed width ar member header.
+ * 
+ */
+#ifndef ARHDR_H
+#define ARHDR_H
+
+#include <sys/types.h>
+#include <ar.h>
+#include <stdbool.h>
+
+/// Size of ar file header name string
+#define SARFNAME 16
+
+/// Size of ar file header date string
+#define SARFDATE 12
+
+/// Size of ar file header UID string
+#define SARFUID 6
+
+/// Size of ar file header GID string
+#define SARFGID 6
+
+/// Size of ar file header mode string
+#define SARFMODE 8
+
+/// Size of ar file header size string
+#define SARFSIZE 10
+
+/// Size of ar file header magic number
+#define SARFMAG 2
+
+/**
+ * @brief Fields of an ar member header.
+ */
+struct arhdr_fields {
+	char name[SARFNAME + 1];	///< Null terminated member name
+	time_t date;				///< Modification time
+	uid_t uid;					///< Owner's user ID
+	gid_t gid;					///< Owning group's group ID
+	mode_t mode;				///< File mode
+	off_t size;					///< Size of the member's data
+};
+
+/**
+ * @brief Decodes every field of an ar header in one pass.
+ *
+ * Names lose their padding and the slash GNU ar ends them with, except for
+ * special members such as "/" and "//" whose names start with a slash.
+ * Numbers are read up to the first character that isn't a digit, so blank
+ * fields read as zero.
+ * 
+ * Preconditions: hdr is not NULL, fields is not NULL
+ * 
+ * Postconditions: fields holds the header's values
+ *
+ * @param hdr Header to decode
+ * @param fields Location to store the values
+ * @return true if the header ends in ARFMAG, false otherwise
+ */
+bool arhdr_decode(const struct ar_hdr *hdr, struct arhdr_fields *fields);
+
+/**
+ * @brief Encodes every field of an ar header.
+ *
+ * Names longer than the field are cut short. Numbers are right aligned and
+ * padded with spaces. A date that doesn't fit is clamped, and a user or group
+ * ID that doesn't fit is written as zero.
+ * 
+ * Preconditions: hdr is not NULL, fields is not NULL
+ * 
+ * Postconditions: hdr holds the values, or as many as fit
+ *
+ * @param hdr Header to fill
+ * @param fields Values to encode
+ * @return true on success, false if the size doesn't fit its field
+ */
+bool arhdr_encode(struct ar_hdr *hdr, const struct arhdr_fields *fields);
+
+#endif // ARHDR_H
+
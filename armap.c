@@ -0,0 +1,597 @@
+/**
+ * @file armap.c
+ * @author Dan Albert
+ * @date Created 10/16/2026
+ * @date Last updated 10/16/2026
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Implements the archive symbol table and reading symbols from ELF members.
+ * 
+ */
+#define _GNU_SOURCE 1
+
+#include <assert.h>
+#include <elf.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "armap.h"
+#include "stats.h"
+
+#define ARMAP_INIT_SIZE 64
+
+/**
+ * @brief Layout of the fields read from an ELF object.
+ *
+ * Offsets and sizes of the header, section header and symbol fields for one
+ * ELF class, so both classes can be read with the same code.
+ */
+struct armap_elf {
+	size_t ehdr_size;		///< Size of the ELF header
+	size_t shoff;			///< Offset of e_shoff in the ELF header
+	size_t shoff_size;		///< Size of e_shoff
+	size_t shentsize;		///< Offset of e_shentsize in the ELF header
+	size_t shnum;			///< Offset of e_shnum in the ELF header
+	size_t shdr_size;		///< Size of a section header
+	size_t sh_type;			///< Offset of sh_type in a section header
+	size_t sh_link;			///< Offset of sh_link in a section header
+	size_t sh_offset;		///< Offset of sh_offset in a section header
+	size_t sh_size;			///< Offset of sh_size in a section header
+	size_t sh_entsize;		///< Offset of sh_entsize in a section header
+	size_t word_size;		///< Size of sh_offset, sh_size and sh_entsize
+	size_t sym_size;		///< Size of a symbol
+	size_t st_name;			///< Offset of st_name in a symbol
+	size_t st_info;			///< Offset of st_info in a symbol
+	size_t st_shndx;		///< Offset of st_shndx in a symbol
+};
+
+/// Field layout of 32 bit ELF objects
+static const struct armap_elf armap_elf32 = {
+	sizeof(Elf32_Ehdr),
+	offsetof(Elf32_Ehdr, e_shoff), sizeof(Elf32_Off),
+	offsetof(Elf32_Ehdr, e_shentsize),
+	offsetof(Elf32_Ehdr, e_shnum),
+	sizeof(Elf32_Shdr),
+	offsetof(Elf32_Shdr, sh_type),
+	offsetof(Elf32_Shdr, sh_link),
+	offsetof(Elf32_Shdr, sh_offset),
+	offsetof(Elf32_Shdr, sh_size),
+	offsetof(Elf32_Shdr, sh_entsize),
+	sizeof(Elf32_Word),
+	sizeof(Elf32_Sym),
+	offsetof(Elf32_Sym, st_name),
+	offsetof(Elf32_Sym, st_info),
+	offsetof(Elf32_Sym, st_shndx)
+};
+
+/// Field layout of 64 bit ELF objects
+static const struct armap_elf armap_elf64 = {
+	sizeof(Elf64_Ehdr),
+	offsetof(Elf64_Ehdr, e_shoff), sizeof(Elf64_Off),
+	offsetof(Elf64_Ehdr, e_shentsize),
+	offsetof(Elf64_Ehdr, e_shnum),
+	sizeof(Elf64_Shdr),
+	offsetof(Elf64_Shdr, sh_type),
+	offsetof(Elf64_Shdr, sh_link),
+	offsetof(Elf64_Shdr, sh_offset),
+	offsetof(Elf64_Shdr, sh_size),
+	offsetof(Elf64_Shdr, sh_entsize),
+	sizeof(Elf64_Xword),
+	sizeof(Elf64_Sym),
+	offsetof(Elf64_Sym, st_name),
+	offsetof(Elf64_Sym, st_info),
+	offsetof(Elf64_Sym, st_shndx)
+};
+
+/**
+ * @brief Reads an unsigned integer of a given byte order.
+ * 
+ * Preconditions: data holds at least size bytes, size is at most 8
+ * 
+ * Postconditions:
+ *
+ * @param data Bytes to read
+ * @param size Number of bytes in the integer
+ * @param msb true if the most significant byte comes first
+ * @return The integer
+ */
+uint64_t armap_get(const uint8_t *data, size_t size, bool msb);
+
+/**
+ * @brief Writes an unsigned big endian integer.
+ * 
+ * Preconditions: data has room for size bytes, size is at most 8
+ * 
+ * Postconditions: data holds value
+ *
+ * @param data Buffer to write to
+ * @param size Number of bytes in the integer
+ * @param value Integer to write
+ */
+void armap_put(uint8_t *data, size_t size, uint64_t value);
+
+/**
+ * @brief Reads a range of a file into a newly allocated buffer.
+ * 
+ * Preconditions: fd is a valid file descriptor
+ * 
+ * Postconditions: The caller owns the returned buffer
+ *
+ * @param fd File descriptor to read from
+ * @param offset Offset of the range
+ * @param size Size of the range
+ * @return The buffer, or NULL on error
+ */
+uint8_t *armap_load(int fd, off_t offset, size_t size);
+
+/**
+ * @brief Makes room for another symbol.
+ * 
+ * Preconditions: map has been initialized
+ * 
+ * Postconditions: map can hold another symbol with a name of len bytes
+ *
+ * @param map Symbol table to grow
+ * @param len Length of the name, including the null terminator
+ * @return true on success, false if memory runs out
+ */
+bool armap_reserve(struct armap *map, size_t len);
+
+void armap_init(struct armap *map) {
+	assert(map != NULL);
+
+	memset(map, 0, sizeof(struct armap));
+}
+
+void armap_free(struct armap *map) {
+	assert(map != NULL);
+
+	free(map->offsets);
+	free(map->names);
+	armap_init(map);
+}
+
+bool armap_add(struct armap *map, const char *name, uint64_t offset) {
+	size_t len;
+
+	assert(map != NULL);
+	assert(name != NULL);
+
+	len = strlen(name) + 1;
+	if (armap_reserve(map, len) == false) {
+		return false;
+	}
+
+	memcpy(map->names + map->names_len, name, len);
+	map->names_len += len;
+	map->offsets[map->count++] = offset;
+
+	return true;
+}
+
+bool armap_merge(struct armap *map, struct armap *other) {
+	const char *name;
+	size_t i;
+
+	assert(map != NULL);
+	assert(other != NULL);
+
+	name = other->names;
+	for (i = 0; i < other->count; i++) {
+		if (armap_add(map, name, other->offsets[i]) == false) {
+			return false;
+		}
+
+		name += strlen(name) + 1;
+	}
+
+	return true;
+}
+
+bool armap_relocate(struct armap *map, const uint64_t *old_offsets,
+		const uint64_t *new_offsets, size_t count) {
+	const char *name;
+	size_t names_len;
+	size_t kept;
+	size_t i;
+
+	assert(map != NULL);
+	assert((old_offsets != NULL) || (count == 0));
+	assert((new_offsets != NULL) || (count == 0));
+
+	// Names only ever move toward the front, so compact in place
+	name = map->names;
+	names_len = 0;
+	kept = 0;
+	for (i = 0; i < map->count; i++) {
+		size_t len = strlen(name) + 1;
+		size_t lo = 0;
+		size_t hi = count;
+
+		while (lo < hi) {
+			size_t mid = lo + (hi - lo) / 2;
+
+			if (old_offsets[mid] < map->offsets[i]) {
+				lo = mid + 1;
+			} else {
+				hi = mid;
+			}
+		}
+
+		// Tables written by other tools may point anywhere
+		if ((lo == count) || (old_offsets[lo] != map->offsets[i])) {
+			armap_free(map);
+			return false;
+		}
+
+		if (new_offsets[lo] != ARMAP_DROPPED) {
+			memmove(map->names + names_len, name, len);
+			names_len += len;
+			map->offsets[kept++] = new_offsets[lo];
+		}
+
+		name += len;
+	}
+
+	map->count = kept;
+	map->names_len = names_len;
+
+	return true;
+}
+
+void armap_shift(struct armap *map, uint64_t delta) {
+	size_t i;
+
+	assert(map != NULL);
+
+	for (i = 0; i < map->count; i++) {
+		map->offsets[i] += delta;
+	}
+}
+
+size_t armap_size(struct armap *map, bool wide) {
+	size_t word = wide ? 8 : 4;
+
+	assert(map != NULL);
+
+	return word * (map->count + 1) + map->names_len;
+}
+
+void armap_encode(struct armap *map, uint8_t *data, size_t size, bool wide) {
+	size_t word = wide ? 8 : 4;
+	size_t i;
+
+	assert(map != NULL);
+	assert(data != NULL);
+	assert(size >= armap_size(map, wide));
+
+	armap_put(data, word, map->count);
+	data += word;
+	for (i = 0; i < map->count; i++) {
+		armap_put(data, word, map->offsets[i]);
+		data += word;
+	}
+
+	memcpy(data, map->names, map->names_len);
+	memset(data + map->names_len, '\0',
+			size - armap_size(map, wide));
+}
+
+bool armap_decode(struct armap *map, const uint8_t *data, size_t size,
+		bool wide) {
+	size_t word = wide ? 8 : 4;
+	const char *name;
+	const char *end;
+	uint64_t count;
+	size_t i;
+
+	assert(map != NULL);
+	assert(map->count == 0);
+	assert(data != NULL);
+
+	if (size < word) {
+		return false;
+	}
+
+	count = armap_get(data, word, true);
+	if (count > (size - word) / word) {
+		return false;
+	}
+
+	name = (const char *)data + word * (count + 1);
+	end = (const char *)data + size;
+	for (i = 0; i < count; i++) {
+		const char *nul = memchr(name, '\0', end - name);
+
+		if (nul == NULL) {
+			return false;
+		}
+
+		if (armap_add(map, name,
+				armap_get(data + word * (i + 1), word, true)) == false) {
+			return false;
+		}
+
+		name = nul + 1;
+	}
+
+	return true;
+}
+
+bool armap_read_elf(struct armap *map, int fd, off_t from, off_t size,
+		uint64_t member) {
+	uint8_t ehdr[sizeof(Elf64_Ehdr)];
+	const struct armap_elf *elf;
+	uint8_t *shdrs = NULL;
+	uint8_t *syms = NULL;
+	char *strs = NULL;
+	uint64_t shoff;
+	uint64_t shnum;
+	uint64_t entsize;
+	uint64_t symoff;
+	uint64_t symsize;
+	uint64_t symentsize;
+	uint64_t stroff;
+	uint64_t strsize;
+	uint64_t link;
+	uint64_t i;
+	ssize_t n;
+	bool msb;
+	bool ok = true;
+
+	assert(map != NULL);
+
+	if (size < EI_NIDENT) {
+		return true;
+	}
+
+	n = pread(fd, ehdr, (size < (off_t)sizeof(ehdr)) ? (size_t)size :
+			sizeof(ehdr), from);
+	STATS_IO(STATS_READ, (n > 0) ? n : 0, 0);
+	if (n < 0) {
+		perror(NULL);
+		return false;
+	}
+
+	if (((size_t)n < EI_NIDENT) || (memcmp(ehdr, ELFMAG, SELFMAG) != 0)) {
+		return true;
+	}
+
+	if (ehdr[EI_CLASS] == ELFCLASS32) {
+		elf = &armap_elf32;
+	} else if (ehdr[EI_CLASS] == ELFCLASS64) {
+		elf = &armap_elf64;
+	} else {
+		return true;
+	}
+
+	if ((size_t)n < elf->ehdr_size) {
+		return true;
+	}
+
+	msb = (ehdr[EI_DATA] == ELFDATA2MSB);
+	shoff = armap_get(ehdr + elf->shoff, elf->shoff_size, msb);
+	entsize = armap_get(ehdr + elf->shentsize, sizeof(Elf32_Half), msb);
+	shnum = armap_get(ehdr + elf->shnum, sizeof(Elf32_Half), msb);
+	if ((shoff == 0) || (entsize < elf->shdr_size) ||
+			(shoff > (uint64_t)size)) {
+		return true;
+	}
+
+	// Too many sections for e_shnum, the real count is in the first one
+	if (shnum == 0) {
+		uint8_t *first = armap_load(fd, from + shoff, elf->shdr_size);
+
+		if (first == NULL) {
+			return false;
+		}
+
+		shnum = armap_get(first + elf->sh_size, elf->word_size, msb);
+		free(first);
+	}
+
+	if ((shnum == 0) || (shnum > ((uint64_t)size - shoff) / entsize)) {
+		return true;
+	}
+
+	shdrs = armap_load(fd, from + shoff, shnum * entsize);
+	if (shdrs == NULL) {
+		return false;
+	}
+
+	for (i = 0; i < shnum; i++) {
+		if (armap_get(shdrs + i * entsize + elf->sh_type, sizeof(Elf32_Word),
+				msb) == SHT_SYMTAB) {
+			break;
+		}
+	}
+
+	if (i == shnum) {
+		goto out;
+	}
+
+	symoff = armap_get(shdrs + i * entsize + elf->sh_offset, elf->word_size,
+			msb);
+	symsize = armap_get(shdrs + i * entsize + elf->sh_size, elf->word_size,
+			msb);
+	symentsize = armap_get(shdrs + i * entsize + elf->sh_entsize,
+			elf->word_size, msb);
+	link = armap_get(shdrs + i * entsize + elf->sh_link, sizeof(Elf32_Word),
+			msb);
+	if ((link >= shnum) || (symentsize < elf->sym_size) ||
+			(symoff > (uint64_t)size) || (symsize > (uint64_t)size - symoff)) {
+		goto out;
+	}
+
+	stroff = armap_get(shdrs + link * entsize + elf->sh_offset,
+			elf->word_size, msb);
+	strsize = armap_get(shdrs + link * entsize + elf->sh_size,
+			elf->word_size, msb);
+	if ((strsize == 0) || (stroff > (uint64_t)size) ||
+			(strsize > (uint64_t)size - stroff)) {
+		goto out;
+	}
+
+	syms = armap_load(fd, from + symoff, symsize);
+	strs = (char *)armap_load(fd, from + stroff, strsize);
+	if ((syms == NULL) || (strs == NULL)) {
+		ok = false;
+		goto out;
+	}
+
+	// The string table isn't guaranteed to end in a null
+	strs[strsize - 1] = '\0';
+
+	// The first symbol is always the null symbol
+	for (i = 1; i < symsize / symentsize; i++) {
+		const uint8_t *sym = syms + i * symentsize;
+		uint64_t name = armap_get(sym + elf->st_name, sizeof(Elf32_Word), msb);
+		uint64_t shndx = armap_get(sym + elf->st_shndx, sizeof(Elf32_Half),
+				msb);
+		unsigned int bind = ELF32_ST_BIND(sym[elf->st_info]);
+
+		if ((shndx == SHN_UNDEF) || (name == 0) || (name >= strsize)) {
+			continue;
+		}
+
+		if ((bind != STB_GLOBAL) && (bind != STB_WEAK) &&
+				(bind != STB_GNU_UNIQUE)) {
+			continue;
+		}
+
+		if (armap_add(map, strs + name, member) == false) {
+			ok = false;
+			break;
+		}
+	}
+
+out:
+	free(shdrs);
+	free(syms);
+	free(strs);
+
+	return ok;
+}
+
+uint64_t armap_get(const uint8_t *data, size_t size, bool msb) {
+	uint64_t value = 0;
+	size_t i;
+
+	assert(data != NULL);
+	assert(size <= 8);
+
+	for (i = 0; i < size; i++) {
+		value |= (uint64_t)data[msb ? i : size - 1 - i] << (8 * (size - 1 - i));
+	}
+
+	return value;
+}
+
+void armap_put(uint8_t *data, size_t size, uint64_t value) {
+	size_t i;
+
+	assert(data != NULL);
+	assert(size <= 8);
+
+	for (i = 0; i < size; i++) {
+		data[size - 1 - i] = (uint8_t)(value >> (8 * i));
+	}
+}
+
+uint8_t *armap_load(int fd, off_t offset, size_t size) {
+	uint8_t *data;
+	size_t done = 0;
+
+	data = (uint8_t *)malloc((size == 0) ? 1 : size);
+	if (data == NULL) {
+		perror(NULL);
+		return NULL;
+	}
+
+	while (done < size) {
+		ssize_t n = pread(fd, data + done, size - done, offset + done);
+
+		STATS_IO(STATS_READ, (n > 0) ? n : 0, 0);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			perror(NULL);
+			free(data);
+			return NULL;
+		}
+
+		// The object claims more than the archive holds
+		if (n == 0) {
+			memset(data + done, '\0', size - done);
+			break;
+		}
+
+		done += n;
+	}
+
+	return data;
+}
+
+bool armap_reserve(struct armap *map, size_t len) {
+	assert(map != NULL);
+
+	if (map->count == map->capacity) {
+		size_t capacity = (map->capacity == 0) ? ARMAP_INIT_SIZE :
+				map->capacity * 2;
+		uint64_t *offsets = (uint64_t *)realloc(map->offsets,
+				capacity * sizeof(uint64_t));
+
+		if (offsets == NULL) {
+			perror(NULL);
+			return false;
+		}
+
+		map->offsets = offsets;
+		map->capacity = capacity;
+	}
+
+	if (map->names_len + len > map->names_capacity) {
+		size_t capacity = (map->names_capacity == 0) ?
+				ARMAP_INIT_SIZE * 16 : map->names_capacity;
+		char *names;
+
+		while (map->names_len + len > capacity) {
+			capacity *= 2;
+		}
+
+		names = (char *)realloc(map->names, capacity);
+		if (names == NULL) {
+			perror(NULL);
+			return false;
+		}
+
+		map->names = names;
+		map->names_capacity = capacity;
+	}
+
+	return true;
+}
+
@@ -0,0 +1,209 @@
+/**
+ * @file armap.h
+ * @author Dan Albert
+ * @date Created 10/16/2026
+ * @date Last updated 10/16/2026
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Defines the archive symbol table and reading symbols from ELF members.
+ * 
+ */
+#ifndef ARMAP_H
+#define ARMAP_H
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Member name of a symbol table with 32 bit offsets
+#define ARMAP_NAME "/"
+
+/// Member name of a symbol table with 64 bit offsets
+#define ARMAP_NAME64 "/SYM64/"
+
+/// Marks a member that no longer exists in armap_relocate
+#define ARMAP_DROPPED UINT64_MAX
+
+/**
+ * @brief Symbol table of an archive.
+ *
+ * Maps each symbol defined by a member to the offset of that member's header,
+ * in the order the symbols appear in the table.
+ */
+struct armap {
+	uint64_t *offsets;		///< Member header offset of each symbol
+	char *names;			///< Null terminated symbol names, back to back
+	size_t count;			///< Number of symbols
+	size_t capacity;		///< Number of offsets allocated
+	size_t names_len;		///< Number of bytes used in names
+	size_t names_capacity;	///< Number of bytes allocated for names
+};
+
+/**
+ * @brief Initializes an empty symbol table.
+ * 
+ * Preconditions: map is not NULL
+ * 
+ * Postconditions: map holds no symbols
+ *
+ * @param map Symbol table to initialize
+ */
+void armap_init(struct armap *map);
+
+/**
+ * @brief Frees the memory held by a symbol table.
+ * 
+ * Preconditions: map has been initialized
+ * 
+ * Postconditions: map holds no symbols
+ *
+ * @param map Symbol table to free
+ */
+void armap_free(struct armap *map);
+
+/**
+ * @brief Adds a symbol to the end of a symbol table.
+ * 
+ * Preconditions: map has been initialized, name is not NULL
+ * 
+ * Postconditions: The symbol has been added
+ *
+ * @param map Symbol table to add to
+ * @param name Null terminated symbol name
+ * @param offset Offset of the header of the member defining the symbol
+ * @return true on success, false otherwise
+ */
+bool armap_add(struct armap *map, const char *name, uint64_t offset);
+
+/**
+ * @brief Adds every symbol of one table to the end of another.
+ * 
+ * Preconditions: map and other have been initialized
+ * 
+ * Postconditions: The symbols of other have been added to map
+ *
+ * @param map Symbol table to add to
+ * @param other Symbol table to add from
+ * @return true on success, false otherwise
+ */
+bool armap_merge(struct armap *map, struct armap *other);
+
+/**
+ * @brief Updates member offsets after members have moved or been removed.
+ * 
+ * Preconditions: map has been initialized, old_offsets is sorted,
+ * new_offsets holds the new offset of each member or ARMAP_DROPPED
+ * 
+ * Postconditions: Symbols of dropped members have been removed, the rest
+ * refer to the new offsets. If a symbol refers to an offset that isn't in
+ * old_offsets, map has been emptied instead.
+ *
+ * @param map Symbol table to update
+ * @param old_offsets Header offsets of the members before the change
+ * @param new_offsets Header offsets of the same members after the change
+ * @param count Number of members
+ * @return true on success, false if a symbol refers to no member
+ */
+bool armap_relocate(struct armap *map, const uint64_t *old_offsets,
+		const uint64_t *new_offsets, size_t count);
+
+/**
+ * @brief Adds a constant to every member offset.
+ * 
+ * Preconditions: map has been initialized
+ * 
+ * Postconditions: Every symbol refers to a member delta bytes further on
+ *
+ * @param map Symbol table to update
+ * @param delta Number of bytes the members moved
+ */
+void armap_shift(struct armap *map, uint64_t delta);
+
+/**
+ * @brief Returns the size of a symbol table as archive member data.
+ * 
+ * Preconditions: map has been initialized
+ * 
+ * Postconditions:
+ *
+ * @param map Symbol table
+ * @param wide true for the 64 bit format, false for the 32 bit format
+ * @return Number of bytes needed to encode map
+ */
+size_t armap_size(struct armap *map, bool wide);
+
+/**
+ * @brief Encodes a symbol table as archive member data.
+ * 
+ * Preconditions: map has been initialized, data is a buffer of size bytes,
+ * size is at least armap_size(map, wide)
+ * 
+ * Postconditions: data holds the symbol count, the member offsets and the
+ * names, followed by zeros up to size
+ *
+ * @param map Symbol table
+ * @param data Buffer to encode into
+ * @param size Size of data
+ * @param wide true for the 64 bit format, false for the 32 bit format
+ */
+void armap_encode(struct armap *map, uint8_t *data, size_t size, bool wide);
+
+/**
+ * @brief Decodes archive member data into a symbol table.
+ * 
+ * Preconditions: map has been initialized and is empty, data is not NULL
+ * 
+ * Postconditions: map holds the symbols in data
+ *
+ * @param map Symbol table to decode into
+ * @param data Member data
+ * @param size Size of data
+ * @param wide true for the 64 bit format, false for the 32 bit format
+ * @return true on success, false if data is malformed or memory runs out
+ */
+bool armap_decode(struct armap *map, const uint8_t *data, size_t size,
+		bool wide);
+
+/**
+ * @brief Adds the symbols defined by an ELF object to a symbol table.
+ *
+ * Global, weak and unique symbols that are defined in the object are added.
+ * Data that is not an ELF object adds nothing.
+ * 
+ * Preconditions: map has been initialized, fd is a valid file descriptor, the
+ * size bytes following from exist in fd
+ * 
+ * Postconditions: The object's defined symbols have been added to map
+ *
+ * @param map Symbol table to add to
+ * @param fd File descriptor to read the object from
+ * @param from Offset of the object in fd
+ * @param size Size of the object
+ * @param member Header offset of the member holding the object
+ * @return true on success, false on read errors or if memory runs out
+ */
+bool armap_read_elf(struct armap *map, int fd, off_t from, off_t size,
+		uint64_t member);
+
+#endif // ARMAP_H
+
@@ -0,0 +1,1167 @@
+/**
+ * @file bench.c
+ * @author Dan Albert
+ * @date Created 10/16/2026
+ * @date Last updated 10/16/2026
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ * @section DESCRIPTION
+ *
+ * Generates synthetic sets of files and times myar over them. Each set has a
+ * number of members and a size distribution, and every command is run on it
+ * as a separate process: quick append, append all, both tables, extracting
+ * one, many and all members, and deleting members. Each run reports wall and
+ * CPU time, peak resident set size, and the read and write system calls and
+ * bytes the kernel counted for it.
+ *
+ */
+#define _GNU_SOURCE 1
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <math.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/// Default member counts, separated by commas
+#define DEFAULT_COUNTS "10,1000,100000"
+
+/// Default size distributions, separated by commas
+#define DEFAULT_DISTS "tiny,small,mixed"
+
+/// Default limit on the size of a set's files
+#define DEFAULT_BUDGET (1LL << 30)
+
+/// Largest number of members in a set
+#define MAX_COUNT 1000000
+
+/// Most names passed on a command line, more go through a script
+#define ARGV_NAMES 4096
+
+/// Names on each line of a script
+#define SCRIPT_NAMES 256
+
+/// Most extra arguments passed to every run
+#define MAX_EXTRA 16
+
+/// Size of the buffer files are written from
+#define FILL_SIZE (1024 * 1024)
+
+/// Length of a member name, null included
+#define SNAME 9
+
+/// First argument of the copy of the bench that starts and measures a run
+#define MEASURE_FLAG "--measure"
+
+/**
+ * @brief A distribution of member sizes.
+ *
+ * Sizes are drawn evenly on a log scale, so each power of two between the
+ * bounds is as likely as any other.
+ */
+struct bench_dist {
+	const char *name;			///< Name the distribution is chosen by
+	off_t min;					///< Smallest member size
+	off_t max;					///< Largest member size
+};
+
+/**
+ * @brief Resources one run of myar used.
+ */
+struct bench_usage {
+	double wall;				///< Elapsed time, seconds
+	double user;				///< User CPU time, seconds
+	double sys;					///< System CPU time, seconds
+	long max_rss;				///< Peak resident set size, kilobytes
+	long long syscr;			///< Read system calls
+	long long syscw;			///< Write system calls
+	long long rchar;			///< Bytes read
+	long long wchar;			///< Bytes written
+	bool ok;					///< Whether the run exited with status 0
+};
+
+/**
+ * @brief A generated set of files and what the runs over it share.
+ */
+struct bench_set {
+	const struct bench_dist *dist;	///< Distribution of member sizes
+	size_t count;				///< Number of members
+	off_t bytes;				///< Total size of the members
+	char *dir;					///< Directory of the set
+	char *names;				///< count names, SNAME bytes apart
+	const char *myar;			///< Path of the myar binary
+	char **extra;				///< Extra arguments for every run
+	size_t nextra;				///< Number of extra arguments
+	bool json;					///< Whether to report as JSON lines
+	bool ok;					///< Whether every run succeeded
+};
+
+/// Distributions, from many small objects to a few very large blobs
+static const struct bench_dist dists[] = {
+	{ "tiny", 64, 4096 },
+	{ "small", 4096, 256 * 1024 },
+	{ "mixed", 64, 16 * 1024 * 1024 },
+	{ "large", 16 * 1024 * 1024, 256 * 1024 * 1024 },
+	{ "huge", 1LL << 30, 4LL << 30 },
+};
+
+/// State of the pseudorandom generator
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+/**
+ * @brief Draws the next pseudorandom number.
+ *
+ * Preconditions:
+ *
+ * Postconditions: The generator has advanced
+ *
+ * @return 64 pseudorandom bits
+ */
+uint64_t rng_next(void);
+
+/**
+ * @brief Draws a member size from a distribution.
+ *
+ * Preconditions: dist is not NULL
+ *
+ * Postconditions: The generator has advanced
+ *
+ * @param dist Distribution to draw from
+ * @return Size between the distribution's bounds
+ */
+off_t dist_draw(const struct bench_dist *dist);
+
+/**
+ * @brief Finds a distribution by name.
+ *
+ * Preconditions: name is not NULL
+ *
+ * Postconditions:
+ *
+ * @param name Name of the distribution
+ * @return The distribution, NULL if there is none by that name
+ */
+const struct bench_dist *dist_find(const char *name);
+
+/**
+ * @brief Generates a set's files and times every command over them.
+ *
+ * Sets larger than the budget are skipped without generating anything.
+ *
+ * Preconditions: set has its distribution, count, names, options and parent
+ * directory filled in
+ *
+ * Postconditions: Every run has been reported, set->ok is false if one failed
+ *
+ * @param set Set to run
+ * @param budget Largest total size of files to generate
+ */
+void bench_set(struct bench_set *set, off_t budget);
+
+/**
+ * @brief Writes a file of pseudorandom bytes.
+ *
+ * Preconditions: path is not NULL, buf holds FILL_SIZE bytes
+ *
+ * Postconditions: The file holds size bytes
+ *
+ * @param path Path of the file
+ * @param size Size of the file
+ * @param buf Buffer to fill the file from
+ * @return true on success, false otherwise
+ */
+bool bench_fill(const char *path, off_t size, uint8_t *buf);
+
+/**
+ * @brief Writes a script running one command over chosen members.
+ *
+ * Preconditions: set is not NULL, path and cmd are not NULL, pick holds
+ * npick member indices
+ *
+ * Postconditions: The script names every chosen member
+ *
+ * @param set Set the members belong to
+ * @param path Path of the script
+ * @param cmd Script command to run
+ * @param pick Indices of the members
+ * @param npick Number of members
+ * @return true on success, false otherwise
+ */
+bool bench_script(struct bench_set *set, const char *path, const char *cmd,
+		const size_t *pick, size_t npick);
+
+/**
+ * @brief Runs myar on chosen members of a set and reports the run.
+ *
+ * Members are named on the command line, or in a script run with -M if
+ * there are too many.
+ *
+ * Preconditions: set is not NULL, scenario, dir, flag, archive and cmd are not
+ * NULL, pick holds npick member indices
+ *
+ * Postconditions: The run has been reported
+ *
+ * @param set Set the members belong to
+ * @param scenario Name of the scenario
+ * @param dir Directory to run in
+ * @param flag Command option of myar
+ * @param archive Path of the archive, from dir
+ * @param cmd Script command matching flag
+ * @param pick Indices of the members
+ * @param npick Number of members
+ * @param touched Number of members the run works on
+ */
+void bench_names(struct bench_set *set, const char *scenario, const char *dir,
+		const char *flag, const char *archive, const char *cmd,
+		const size_t *pick, size_t npick, size_t touched);
+
+/**
+ * @brief Runs myar and reports the run.
+ *
+ * Preconditions: set is not NULL, scenario, via and dir are not NULL, args
+ * holds nargs arguments
+ *
+ * Postconditions: The run has been reported
+ *
+ * @param set Set being run
+ * @param scenario Name of the scenario
+ * @param via How members were named
+ * @param dir Directory to run in
+ * @param args Arguments after the extra ones
+ * @param nargs Number of arguments
+ * @param touched Number of members the run works on
+ */
+void bench_run(struct bench_set *set, const char *scenario, const char *via,
+		const char *dir, char **args, size_t nargs, size_t touched);
+
+/**
+ * @brief Runs a program and measures what it used.
+ *
+ * A process keeps the peak resident set size of the one it was started from
+ * through exec(), so the program is started by a fresh copy of this one,
+ * which hasn't grown yet, and the measurements come back through a pipe.
+ *
+ * Preconditions: dir is not NULL, argv is a NULL terminated argument vector,
+ * usage is not NULL
+ *
+ * Postconditions: usage describes the run, or is zeroed if it couldn't be
+ * measured
+ *
+ * @param dir Directory to run in
+ * @param argv Program and arguments
+ * @param usage Location to store the measurements in
+ */
+void bench_exec(const char *dir, char **argv, struct bench_usage *usage);
+
+/**
+ * @brief Runs a program as a child and measures what it used.
+ *
+ * Standard output goes to /dev/null. The read and write counts come from the
+ * child's /proc/pid/io, read before it is reaped.
+ *
+ * Preconditions: dir is not NULL, argv is a NULL terminated argument vector,
+ * usage is not NULL
+ *
+ * Postconditions: usage describes the run
+ *
+ * @param dir Directory to run in
+ * @param argv Program and arguments
+ * @param usage Location to store the measurements in
+ */
+void bench_measure(const char *dir, char **argv, struct bench_usage *usage);
+
+/**
+ * @brief Prints the measurements of one run.
+ *
+ * Preconditions: set, scenario, via and usage are not NULL
+ *
+ * Postconditions: A table row or JSON line has been written
+ *
+ * @param set Set being run
+ * @param scenario Name of the scenario
+ * @param via How members were named
+ * @param usage Measurements of the run
+ * @param touched Number of members the run works on
+ */
+void bench_report(struct bench_set *set, const char *scenario, const char *via,
+		const struct bench_usage *usage, size_t touched);
+
+/**
+ * @brief Copies a file.
+ *
+ * Preconditions: from and to are not NULL
+ *
+ * Postconditions: to holds what from holds
+ *
+ * @param from Path of the file to copy
+ * @param to Path of the copy
+ * @return true on success, false otherwise
+ */
+bool bench_copy(const char *from, const char *to);
+
+/**
+ * @brief Removes one entry of a directory tree, for nftw().
+ *
+ * @param path Path of the entry
+ * @param st Status of the entry
+ * @param type Type of the entry
+ * @param ftw Position in the walk
+ * @return 0 to carry on
+ */
+int bench_unlink(const char *path, const struct stat *st, int type,
+		struct FTW *ftw);
+
+/**
+ * @brief Joins a directory and a name into a new path.
+ *
+ * Preconditions: dir and name are not NULL
+ *
+ * Postconditions:
+ *
+ * @param dir Directory
+ * @param name Name within it
+ * @return The path, which the caller frees, NULL if out of memory
+ */
+char *bench_path(const char *dir, const char *name);
+
+/**
+ * @brief Reads the current time.
+ *
+ * Preconditions:
+ *
+ * Postconditions:
+ *
+ * @return Seconds on a monotonic clock
+ */
+double now(void);
+
+/**
+ * @brief Print usage message and exit.
+ *
+ * Preconditions:
+ *
+ * Postconditions: Program exits
+ */
+void usage(void);
+
+/**
+ * @brief Program entry point.
+ *
+ * @param argc Number of command line arguments
+ * @param argv Array of strings containing command line arguments
+ * @return Exit status, 1 if any run failed
+ */
+int main(int argc, char **argv) {
+	struct bench_set set;
+	const char *counts = DEFAULT_COUNTS;
+	const char *dist_names = DEFAULT_DISTS;
+	const char *parent;
+	char *extra[MAX_EXTRA];
+	char *extra_args = NULL;
+	char *work;
+	char *dlist;
+	char *dsave;
+	char *dname;
+	off_t budget = DEFAULT_BUDGET;
+	size_t nextra = 0;
+	size_t i;
+	bool keep = false;
+	bool json = false;
+	bool ok = true;
+	int c;
+
+	// Started by bench_exec() to run and measure one command
+	if ((argc > 3) && (strcmp(argv[1], MEASURE_FLAG) == 0)) {
+		struct bench_usage measured;
+
+		bench_measure(argv[2], &argv[3], &measured);
+
+		return (write(STDOUT_FILENO, &measured, sizeof(measured)) ==
+				(ssize_t)sizeof(measured)) ? 0 : 1;
+	}
+
+	parent = getenv("TMPDIR");
+	if (parent == NULL) {
+		parent = "/tmp";
+	}
+
+	while ((c = getopt(argc, argv, "a:b:d:jkn:w:")) != -1) {
+		switch (c) {
+		case 'a':
+			extra_args = strdup(optarg);
+			break;
+		case 'b':
+			budget = strtoll(optarg, NULL, 10);
+			if (budget < 1) {
+				usage();
+			}
+
+			break;
+		case 'd':
+			dist_names = optarg;
+			break;
+		case 'j':
+			json = true;
+			break;
+		case 'k':
+			keep = true;
+			break;
+		case 'n':
+			counts = optarg;
+			break;
+		case 'w':
+			parent = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (optind + 1 != argc) {
+		usage();
+	}
+
+	// Options for every run, to compare I/O strategies
+	if (extra_args != NULL) {
+		char *save;
+		char *arg;
+
+		for (arg = strtok_r(extra_args, " ", &save); arg != NULL;
+				arg = strtok_r(NULL, " ", &save)) {
+			if (nextra == MAX_EXTRA) {
+				usage();
+			}
+
+			extra[nextra++] = arg;
+		}
+	}
+
+	memset(&set, 0, sizeof(set));
+	set.myar = realpath(argv[optind], NULL);
+	set.extra = extra;
+	set.nextra = nextra;
+	set.json = json;
+	if (set.myar == NULL) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	work = bench_path(parent, "myar-bench.XXXXXX");
+	if ((work == NULL) || (mkdtemp(work) == NULL)) {
+		perror("Could not create work directory");
+		return 1;
+	}
+
+	set.names = (char *)malloc((size_t)MAX_COUNT * SNAME);
+	if (set.names == NULL) {
+		perror(NULL);
+		return 1;
+	}
+
+	for (i = 0; i < MAX_COUNT; i++) {
+		snprintf(set.names + i * SNAME, SNAME, "m%07zu", i);
+	}
+
+	if (json == false) {
+		printf("%-6s %-6s %9s %8s %8s %9s %9s %9s %9s %9s %9s %10s\n",
+			"cmd", "via", "wall s", "user s", "sys s", "rss KiB", "reads",
+			"writes", "read MB", "write MB", "MB/s", "members/s");
+	}
+
+	// Every distribution at every count
+	dlist = strdup(dist_names);
+	for (dname = strtok_r(dlist, ",", &dsave); dname != NULL;
+			dname = strtok_r(NULL, ",", &dsave)) {
+		const char *cp = counts;
+
+		set.dist = dist_find(dname);
+		if (set.dist == NULL) {
+			fprintf(stderr, "Unknown distribution %s\n", dname);
+			ok = false;
+			continue;
+		}
+
+		while (*cp != '\0') {
+			char *end;
+			long count = strtol(cp, &end, 10);
+			char sub[64];
+
+			if ((end == cp) || (count < 1) || (count > MAX_COUNT)) {
+				fprintf(stderr, "Member counts run from 1 to %d\n", MAX_COUNT);
+				return 1;
+			}
+
+			cp = (*end == ',') ? end + 1 : end;
+
+			snprintf(sub, sizeof(sub), "%s-%ld", set.dist->name, count);
+			set.count = count;
+			set.dir = bench_path(work, sub);
+			set.ok = true;
+			if ((set.dir == NULL) || (mkdir(set.dir, 0777) == -1)) {
+				perror("Could not create set directory");
+				return 1;
+			}
+
+			bench_set(&set, budget);
+			if (set.ok == false) {
+				ok = false;
+			}
+
+			// Sets can be large, only keep them if asked to
+			if (keep == false) {
+				nftw(set.dir, bench_unlink, 16, FTW_DEPTH | FTW_PHYS);
+			}
+
+			free(set.dir);
+		}
+	}
+
+	if (keep) {
+		fprintf(stderr, "Sets kept in %s\n", work);
+	} else {
+		rmdir(work);
+	}
+
+	free(dlist);
+	free(work);
+	free(set.names);
+	free(extra_args);
+	free((char *)set.myar);
+
+	return ok ? 0 : 1;
+}
+
+uint64_t rng_next(void) {
+	// xorshift64*
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+
+	return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+off_t dist_draw(const struct bench_dist *dist) {
+	double span;
+	double unit;
+
+	assert(dist != NULL);
+
+	span = log((double)dist->max / dist->min);
+	unit = (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+
+	return (off_t)(dist->min * exp(unit * span));
+}
+
+const struct bench_dist *dist_find(const char *name) {
+	size_t i;
+
+	assert(name != NULL);
+
+	for (i = 0; i < sizeof(dists) / sizeof(dists[0]); i++) {
+		if (strcmp(dists[i].name, name) == 0) {
+			return &dists[i];
+		}
+	}
+
+	return NULL;
+}
+
+void bench_set(struct bench_set *set, off_t budget) {
+	uint8_t *buf;
+	size_t *pick;
+	size_t *all;
+	off_t *sizes;
+	char *files;
+	char *out;
+	size_t npick;
+	size_t i;
+	double start;
+
+	assert(set != NULL);
+
+	// Draw every size first, so an oversized set costs nothing
+	sizes = (off_t *)malloc(set->count * sizeof(off_t));
+	all = (size_t *)malloc(set->count * sizeof(size_t));
+	buf = (uint8_t *)malloc(FILL_SIZE);
+	if ((sizes == NULL) || (all == NULL) || (buf == NULL)) {
+		perror(NULL);
+		free(sizes);
+		free(all);
+		free(buf);
+		set->ok = false;
+		return;
+	}
+
+	rng_state = 0x9e3779b97f4a7c15ULL ^ set->count;
+	set->bytes = 0;
+	for (i = 0; i < set->count; i++) {
+		sizes[i] = dist_draw(set->dist);
+		set->bytes += sizes[i];
+		all[i] = i;
+	}
+
+	if (set->json == false) {
+		printf("\n%s x %zu, %.1f MB\n", set->dist->name, set->count,
+				set->bytes / 1e6);
+	}
+
+	if (set->bytes > budget) {
+		if (set->json == false) {
+			printf("skipped, larger than the budget of %.1f MB\n", budget / 1e6);
+		}
+
+		free(sizes);
+		free(all);
+		free(buf);
+		return;
+	}
+
+	files = bench_path(set->dir, "files");
+	out = bench_path(set->dir, "out");
+	if ((files == NULL) || (out == NULL) || (mkdir(files, 0777) == -1) ||
+			(mkdir(out, 0777) == -1)) {
+		perror("Could not create set directory");
+		set->ok = false;
+		free(files);
+		free(out);
+		free(sizes);
+		free(all);
+		free(buf);
+		return;
+	}
+
+	for (i = 0; i < FILL_SIZE; i += sizeof(uint64_t)) {
+		uint64_t r = rng_next();
+
+		memcpy(buf + i, &r, sizeof(r));
+	}
+
+	start = now();
+	for (i = 0; i < set->count; i++) {
+		char *path = bench_path(files, set->names + i * SNAME);
+
+		if ((path == NULL) || (bench_fill(path, sizes[i], buf) == false)) {
+			set->ok = false;
+			free(path);
+			break;
+		}
+
+		free(path);
+	}
+
+	if (set->json == false) {
+		printf("generated in %.2f s\n", now() - start);
+	}
+
+	// Every few members, for extracting and deleting many
+	npick = set->count / 100;
+	if (npick < 10) {
+		npick = (set->count < 10) ? set->count : 10;
+	}
+
+	pick = (size_t *)malloc(npick * sizeof(size_t));
+	if ((set->ok == false) || (pick == NULL)) {
+		set->ok = false;
+		free(pick);
+		free(files);
+		free(out);
+		free(sizes);
+		free(all);
+		free(buf);
+		return;
+	}
+
+	for (i = 0; i < npick; i++) {
+		pick[i] = i * set->count / npick;
+	}
+
+	bench_names(set, "q", files, "-q", "../q.a", "ADDMOD", all, set->count,
+			set->count);
+
+	{
+		char *args[] = { "-A", "../A.a" };
+
+		bench_run(set, "A", "dir", files, args, 2, set->count);
+	}
+
+	{
+		char *args[] = { "-t", "q.a" };
+
+		bench_run(set, "t", "-", set->dir, args, 2, set->count);
+		args[0] = "-v";
+		bench_run(set, "v", "-", set->dir, args, 2, set->count);
+	}
+
+	i = set->count / 2;
+	bench_names(set, "x1", out, "-x", "../q.a", "EXTRACT", &i, 1, 1);
+	bench_names(set, "xmany", out, "-x", "../q.a", "EXTRACT", pick, npick,
+			npick);
+	bench_names(set, "xall", out, "-x", "../q.a", "EXTRACT", all, set->count,
+			set->count);
+
+	// Deleting changes the archive, so it works on a copy
+	{
+		char *from = bench_path(set->dir, "q.a");
+		char *to = bench_path(set->dir, "d.a");
+
+		if ((from == NULL) || (to == NULL) || (bench_copy(from, to) == false)) {
+			set->ok = false;
+		} else {
+			bench_names(set, "d", set->dir, "-d", "d.a", "DELETE", pick, npick,
+					npick);
+		}
+
+		free(from);
+		free(to);
+	}
+
+	free(pick);
+	free(files);
+	free(out);
+	free(sizes);
+	free(all);
+	free(buf);
+}
+
+bool bench_fill(const char *path, off_t size, uint8_t *buf) {
+	off_t done;
+	int fd;
+
+	assert(path != NULL);
+	assert(buf != NULL);
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd == -1) {
+		perror(path);
+		return false;
+	}
+
+	// Start each file somewhere else in the buffer, so no two are alike
+	done = 0;
+	while (done < size) {
+		size_t skip = rng_next() % (FILL_SIZE / 2);
+		size_t len = FILL_SIZE - skip;
+		ssize_t n;
+
+		if ((off_t)len > size - done) {
+			len = size - done;
+		}
+
+		n = write(fd, buf + skip, len);
+		if (n <= 0) {
+			perror(path);
+			close(fd);
+			return false;
+		}
+
+		done += n;
+	}
+
+	return close(fd) == 0;
+}
+
+bool bench_script(struct bench_set *set, const char *path, const char *cmd,
+		const size_t *pick, size_t npick) {
+	FILE *f;
+	size_t i;
+
+	assert(set != NULL);
+	assert(path != NULL);
+	assert(cmd != NULL);
+	assert(pick != NULL);
+
+	f = fopen(path, "w");
+	if (f == NULL) {
+		perror(path);
+		return false;
+	}
+
+	for (i = 0; i < npick; i++) {
+		fprintf(f, "%s%s%s", ((i % SCRIPT_NAMES) == 0) ? cmd : "",
+				" ", set->names + pick[i] * SNAME);
+		if (((i + 1) % SCRIPT_NAMES == 0) || (i + 1 == npick)) {
+			fputc('\n', f);
+		}
+	}
+
+	fprintf(f, "END\n");
+
+	return fclose(f) == 0;
+}
+
+void bench_names(struct bench_set *set, const char *scenario, const char *dir,
+		const char *flag, const char *archive, const char *cmd,
+		const size_t *pick, size_t npick, size_t touched) {
+	char **args;
+	size_t i;
+
+	assert(set != NULL);
+	assert(scenario != NULL);
+	assert(dir != NULL);
+	assert(flag != NULL);
+	assert(archive != NULL);
+	assert(cmd != NULL);
+	assert(pick != NULL);
+
+	// Too many names for one command line go through a script
+	if (npick > ARGV_NAMES) {
+		char *script = bench_path(set->dir, "script");
+		char *args[] = { "-M", (char *)archive, script };
+
+		if ((script == NULL) || (bench_script(set, script, cmd, pick, npick) ==
+				false)) {
+			set->ok = false;
+		} else {
+			bench_run(set, scenario, "script", dir, args, 3, touched);
+		}
+
+		free(script);
+		return;
+	}
+
+	args = (char **)malloc((npick + 2) * sizeof(char *));
+	if (args == NULL) {
+		perror(NULL);
+		set->ok = false;
+		return;
+	}
+
+	args[0] = (char *)flag;
+	args[1] = (char *)archive;
+	for (i = 0; i < npick; i++) {
+		args[i + 2] = set->names + pick[i] * SNAME;
+	}
+
+	bench_run(set, scenario, "argv", dir, args, npick + 2, touched);
+
+	free(args);
+}
+
+void bench_run(struct bench_set *set, const char *scenario, const char *via,
+		const char *dir, char **args, size_t nargs, size_t touched) {
+	struct bench_usage usage;
+	char **argv;
+	size_t i;
+
+	assert(set != NULL);
+	assert(scenario != NULL);
+	assert(via != NULL);
+	assert(dir != NULL);
+	assert(args != NULL);
+
+	argv = (char **)malloc((set->nextra + nargs + 2) * sizeof(char *));
+	if (argv == NULL) {
+		perror(NULL);
+		set->ok = false;
+		return;
+	}
+
+	argv[0] = (char *)set->myar;
+	for (i = 0; i < set->nextra; i++) {
+		argv[1 + i] = set->extra[i];
+	}
+
+	for (i = 0; i < nargs; i++) {
+		argv[1 + set->nextra + i] = args[i];
+	}
+
+	argv[1 + set->nextra + nargs] = NULL;
+
+	bench_exec(dir, argv, &usage);
+	bench_report(set, scenario, via, &usage, touched);
+	if (usage.ok == false) {
+		set->ok = false;
+	}
+
+	free(argv);
+}
+
+void bench_exec(const char *dir, char **argv, struct bench_usage *usage) {
+	posix_spawn_file_actions_t actions;
+	char **args;
+	size_t nargs;
+	size_t done;
+	pid_t pid;
+	int fds[2];
+	int err;
+
+	assert(dir != NULL);
+	assert(argv != NULL);
+	assert(usage != NULL);
+
+	memset(usage, 0, sizeof(*usage));
+
+	for (nargs = 0; argv[nargs] != NULL; nargs++);
+
+	args = (char **)malloc((nargs + 4) * sizeof(char *));
+	if ((args == NULL) || (pipe(fds) == -1)) {
+		perror(NULL);
+		free(args);
+		return;
+	}
+
+	args[0] = "bench";
+	args[1] = MEASURE_FLAG;
+	args[2] = (char *)dir;
+	memcpy(args + 3, argv, (nargs + 1) * sizeof(char *));
+
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+	posix_spawn_file_actions_addclose(&actions, fds[0]);
+	posix_spawn_file_actions_addclose(&actions, fds[1]);
+
+	err = posix_spawn(&pid, "/proc/self/exe", &actions, NULL, args, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	close(fds[1]);
+	free(args);
+	if (err != 0) {
+		fprintf(stderr, "Could not run %s: %s\n", argv[0], strerror(err));
+		close(fds[0]);
+		return;
+	}
+
+	done = 0;
+	while (done < sizeof(*usage)) {
+		ssize_t n = read(fds[0], (char *)usage + done, sizeof(*usage) - done);
+
+		if (n <= 0) {
+			memset(usage, 0, sizeof(*usage));
+			break;
+		}
+
+		done += n;
+	}
+
+	close(fds[0]);
+	waitpid(pid, NULL, 0);
+}
+
+void bench_measure(const char *dir, char **argv, struct bench_usage *usage) {
+	struct rusage ru;
+	siginfo_t info;
+	double start;
+	char path[64];
+	char line[128];
+	FILE *io;
+	pid_t pid;
+	int status;
+
+	assert(dir != NULL);
+	assert(argv != NULL);
+	assert(usage != NULL);
+
+	memset(usage, 0, sizeof(*usage));
+
+	start = now();
+	pid = fork();
+	if (pid == -1) {
+		perror("fork");
+		return;
+	}
+
+	if (pid == 0) {
+		int null_fd = open("/dev/null", O_WRONLY);
+
+		if ((chdir(dir) == -1) || (null_fd == -1) ||
+				(dup2(null_fd, STDOUT_FILENO) == -1)) {
+			perror(dir);
+			_exit(127);
+		}
+
+		execv(argv[0], argv);
+		perror(argv[0]);
+		_exit(127);
+	}
+
+	// The child's counters are only there until it is reaped
+	if (waitid(P_PID, pid, &info, WEXITED | WNOWAIT) == -1) {
+		perror("waitid");
+	}
+
+	usage->wall = now() - start;
+
+	snprintf(path, sizeof(path), "/proc/%d/io", (int)pid);
+	io = fopen(path, "r");
+	if (io != NULL) {
+		while (fgets(line, sizeof(line), io) != NULL) {
+			sscanf(line, "syscr: %lld", &usage->syscr);
+			sscanf(line, "syscw: %lld", &usage->syscw);
+			sscanf(line, "rchar: %lld", &usage->rchar);
+			sscanf(line, "wchar: %lld", &usage->wchar);
+		}
+
+		fclose(io);
+	}
+
+	if (wait4(pid, &status, 0, &ru) == -1) {
+		perror("wait4");
+		return;
+	}
+
+	usage->user = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+	usage->sys = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+	usage->max_rss = ru.ru_maxrss;
+	usage->ok = WIFEXITED(status) && (WEXITSTATUS(status) == 0);
+}
+
+void bench_report(struct bench_set *set, const char *scenario, const char *via,
+		const struct bench_usage *usage, size_t touched) {
+	double wall;
+	double mbps;
+
+	assert(set != NULL);
+	assert(scenario != NULL);
+	assert(via != NULL);
+	assert(usage != NULL);
+
+	wall = (usage->wall > 0) ? usage->wall : 1e-9;
+	mbps = (usage->rchar + usage->wchar) / wall / 1e6;
+
+	if (set->json) {
+		printf("{\"dist\":\"%s\",\"members\":%zu,\"bytes\":%lld,"
+			"\"cmd\":\"%s\",\"via\":\"%s\",\"ok\":%s,\"wall_s\":%.6f,"
+			"\"user_s\":%.6f,\"sys_s\":%.6f,\"max_rss_kib\":%ld,"
+			"\"syscr\":%lld,\"syscw\":%lld,\"rchar\":%lld,\"wchar\":%lld,"
+			"\"mb_per_s\":%.3f,\"members_per_s\":%.1f}\n",
+			set->dist->name, set->count, (long long)set->bytes, scenario, via,
+			usage->ok ? "true" : "false", usage->wall, usage->user, usage->sys,
+			usage->max_rss, usage->syscr, usage->syscw, usage->rchar,
+			usage->wchar, mbps, touched / wall);
+	} else {
+		printf("%-6s %-6s %9.3f %8.3f %8.3f %9ld %9lld %9lld %9.1f %9.1f %9.1f "
+			"%10.0f%s\n",
+			scenario, via, usage->wall, usage->user, usage->sys,
+			usage->max_rss, usage->syscr, usage->syscw, usage->rchar / 1e6,
+			usage->wchar / 1e6, mbps, touched / wall,
+			usage->ok ? "" : " FAILED");
+	}
+
+	fflush(stdout);
+}
+
+bool bench_copy(const char *from, const char *to) {
+	struct stat st;
+	off_t done;
+	int in_fd;
+	int out_fd;
+
+	assert(from != NULL);
+	assert(to != NULL);
+
+	in_fd = open(from, O_RDONLY);
+	if ((in_fd == -1) || (fstat(in_fd, &st) == -1)) {
+		perror(from);
+		if (in_fd != -1) {
+			close(in_fd);
+		}
+
+		return false;
+	}
+
+	out_fd = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (out_fd == -1) {
+		perror(to);
+		close(in_fd);
+		return false;
+	}
+
+	done = 0;
+	while (done < st.st_size) {
+		ssize_t n = copy_file_range(in_fd, NULL, out_fd, NULL,
+				st.st_size - done, 0);
+
+		if (n <= 0) {
+			perror(to);
+			break;
+		}
+
+		done += n;
+	}
+
+	close(in_fd);
+
+	return (close(out_fd) == 0) && (done == st.st_size);
+}
+
+int bench_unlink(const char *path, const struct stat *st, int type,
+		struct FTW *ftw) {
+	(void)st;
+	(void)ftw;
+
+	if (type == FTW_DP) {
+		rmdir(path);
+	} else {
+		unlink(path);
+	}
+
+	return 0;
+}
+
+char *bench_path(const char *dir, const char *name) {
+	char *path;
+
+	assert(dir != NULL);
+	assert(name != NULL);
+
+	path = (char *)malloc(strlen(dir) + strlen(name) + 2);
+	if (path == NULL) {
+		perror(NULL);
+		return NULL;
+	}
+
+	sprintf(path, "%s/%s", dir, name);
+
+	return path;
+}
+
+double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void usage(void) {
+	printf("Usage: bench [-a args] [-b bytes] [-d dists] [-j] [-k] [-n counts] [-w dir] myar\n");
+	printf(" options:\n");
+	printf("  a\t- extra arguments for every run of myar, such as \"-j 8 -R 64\"\n");
+	printf("  b\t- skip sets whose files add up to more bytes than this\n");
+	printf("  d\t- size distributions, separated by commas: tiny (64 B to 4 KiB),\n");
+	printf("   \t  small (4 to 256 KiB), mixed (64 B to 16 MiB), large (16 to 256 MiB)\n");
+	printf("   \t  and huge (1 to 4 GiB)\n");
+	printf("  j\t- report JSON lines instead of a table\n");
+	printf("  k\t- keep the generated sets\n");
+	printf("  n\t- member counts, separated by commas, 1 to 1000000\n");
+	printf("  w\t- directory to generate sets in, $TMPDIR or /tmp by default\n");
+	exit(1);
+}
@@ -0,0 +1,249 @@
+/**
+ * @file hdrbench.c
+ * @author Dan Albert
+ * @date Created 10/16/2026
+ * @date Last updated 10/16/2026
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ * @section DESCRIPTION
+ *
+ * Measures the ar header codec against decoding and encoding each field with
+ * strtol() and snprintf(), as headers were handled before the codec.
+ *
+ */
+#define _GNU_SOURCE 1
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "arhdr.h"
+
+/// Number of distinct headers cycled through, small enough to stay in cache
+#define NHDRS 4096
+
+/// Default number of headers processed by each measurement
+#define DEFAULT_COUNT 10000000L
+
+/**
+ * @brief Decodes a header a field at a time with strtol().
+ *
+ * Preconditions: hdr is not NULL, fields is not NULL
+ *
+ * Postconditions: fields holds the header's values
+ *
+ * @param hdr Header to decode
+ * @param fields Location to store the values
+ */
+void field_decode(const struct ar_hdr *hdr, struct arhdr_fields *fields);
+
+/**
+ * @brief Encodes a header a field at a time with snprintf().
+ *
+ * Preconditions: hdr is not NULL, fields is not NULL
+ *
+ * Postconditions: hdr holds the values
+ *
+ * @param hdr Header to fill
+ * @param fields Values to encode
+ */
+void field_encode(struct ar_hdr *hdr, const struct arhdr_fields *fields);
+
+/**
+ * @brief Reads a monotonic clock.
+ *
+ * Preconditions:
+ *
+ * Postconditions:
+ *
+ * @return Current time in seconds
+ */
+double now(void);
+
+/**
+ * @brief Prints one measurement.
+ *
+ * Preconditions: name is not NULL
+ *
+ * Postconditions: A line has been written to standard output
+ *
+ * @param name Name of the measurement
+ * @param count Number of headers processed
+ * @param seconds Time taken
+ */
+void report(const char *name, long count, double seconds);
+
+/**
+ * @brief Program entry point.
+ *
+ * @param argc Number of command line arguments
+ * @param argv Array of strings containing command line arguments
+ * @return Exit status
+ */
+int main(int argc, char **argv) {
+	static struct ar_hdr hdrs[NHDRS];
+	static struct arhdr_fields values[NHDRS];
+	struct arhdr_fields fields;
+	struct ar_hdr hdr;
+	unsigned long sum;
+	double start;
+	long count;
+	long i;
+	int c;
+
+	count = DEFAULT_COUNT;
+	while ((c = getopt(argc, argv, "n:")) != -1) {
+		switch (c) {
+		case 'n':
+			count = atol(optarg);
+			if (count < 1) {
+				fprintf(stderr, "Usage: hdrbench [-n headers]\n");
+				return 1;
+			}
+
+			break;
+		default:
+			fprintf(stderr, "Usage: hdrbench [-n headers]\n");
+			return 1;
+		}
+	}
+
+	// Headers like those of a real archive, with names and sizes that vary
+	srand(1);
+	for (i = 0; i < NHDRS; i++) {
+		snprintf(values[i].name, sizeof(values[i].name), "member%ld.o", i);
+		values[i].date = 1700000000 + rand() % 100000000;
+		values[i].uid = rand() % 65536;
+		values[i].gid = rand() % 65536;
+		values[i].mode = 0100000 | (rand() % 01000);
+		values[i].size = rand() % ((i % 7 == 0) ? 100000000 : 100000);
+		if (arhdr_encode(&hdrs[i], &values[i]) == false) {
+			fprintf(stderr, "Could not encode header %ld\n", i);
+			return 1;
+		}
+	}
+
+	printf("%-16s %12s %12s\n", "codec", "ns/header", "Mheaders/s");
+
+	sum = 0;
+	start = now();
+	for (i = 0; i < count; i++) {
+		arhdr_decode(&hdrs[i % NHDRS], &fields);
+		sum += fields.size + fields.mode;
+	}
+	report("arhdr_decode", count, now() - start);
+
+	start = now();
+	for (i = 0; i < count; i++) {
+		field_decode(&hdrs[i % NHDRS], &fields);
+		sum += fields.size + fields.mode;
+	}
+	report("strtol decode", count, now() - start);
+
+	start = now();
+	for (i = 0; i < count; i++) {
+		arhdr_encode(&hdr, &values[i % NHDRS]);
+		sum += (unsigned char)hdr.ar_size[0];
+	}
+	report("arhdr_encode", count, now() - start);
+
+	start = now();
+	for (i = 0; i < count; i++) {
+		field_encode(&hdr, &values[i % NHDRS]);
+		sum += (unsigned char)hdr.ar_size[0];
+	}
+	report("snprintf encode", count, now() - start);
+
+	// Keeps the loops from being optimized away
+	if (sum == 0) {
+		printf("\n");
+	}
+
+	return 0;
+}
+
+void field_decode(const struct ar_hdr *hdr, struct arhdr_fields *fields) {
+	char buf[SARFDATE + 1];
+	int i;
+
+	assert(hdr != NULL);
+	assert(fields != NULL);
+
+	memcpy(fields->name, hdr->ar_name, SARFNAME);
+	fields->name[SARFNAME] = '\0';
+	for (i = SARFNAME - 1; (i >= 0) && ((fields->name[i] == ' ') ||
+			(fields->name[i] == '/')); i--) {
+		fields->name[i] = '\0';
+	}
+
+	memcpy(buf, hdr->ar_date, SARFDATE);
+	buf[SARFDATE] = '\0';
+	fields->date = strtol(buf, NULL, 10);
+
+	memcpy(buf, hdr->ar_uid, SARFUID);
+	buf[SARFUID] = '\0';
+	fields->uid = strtol(buf, NULL, 10);
+
+	memcpy(buf, hdr->ar_gid, SARFGID);
+	buf[SARFGID] = '\0';
+	fields->gid = strtol(buf, NULL, 10);
+
+	memcpy(buf, hdr->ar_mode, SARFMODE);
+	buf[SARFMODE] = '\0';
+	fields->mode = strtol(buf, NULL, 8);
+
+	memcpy(buf, hdr->ar_size, SARFSIZE);
+	buf[SARFSIZE] = '\0';
+	fields->size = strtol(buf, NULL, 10);
+}
+
+void field_encode(struct ar_hdr *hdr, const struct arhdr_fields *fields) {
+	char buf[sizeof(struct ar_hdr) + 1];
+
+	assert(hdr != NULL);
+	assert(fields != NULL);
+
+	snprintf(buf, sizeof(buf), "%-16.16s", fields->name);
+	snprintf(buf + SARFNAME, sizeof(buf) - SARFNAME, "%-12lld",
+			(long long)fields->date);
+	snprintf(buf + 28, sizeof(buf) - 28, "%-6u", (unsigned int)fields->uid);
+	snprintf(buf + 34, sizeof(buf) - 34, "%-6u", (unsigned int)fields->gid);
+	snprintf(buf + 40, sizeof(buf) - 40, "%-8o", (unsigned int)fields->mode);
+	snprintf(buf + 48, sizeof(buf) - 48, "%-10lld%s", (long long)fields->size,
+			ARFMAG);
+	memcpy(hdr, buf, sizeof(struct ar_hdr));
+}
+
+double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void report(const char *name, long count, double seconds) {
+	assert(name != NULL);
+
+	printf("%-16s %12.1f %12.1f\n", name, seconds * 1e9 / count,
+			count / seconds / 1e6);
+}
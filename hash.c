@@ -0,0 +1,286 @@
+/**
+ * @file hash.c
+ * @author Dan Albert
+ * @date Created 10/16/2026
+ * @date Last updated 10/16/2026
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Implements a fast 64 bit hash of file contents, computed a piece at a time.
+ * 
+ */
+#define _GNU_SOURCE 1
+
+#include <assert.h>
+#include <string.h>
+#include "hash.h"
+
+/// First XXH64 prime
+#define HASH_PRIME1 0x9e3779b185ebca87ULL
+
+/// Second XXH64 prime
+#define HASH_PRIME2 0xc2b2ae3d27d4eb4fULL
+
+/// Third XXH64 prime
+#define HASH_PRIME3 0x165667b19e3779f9ULL
+
+/// Fourth XXH64 prime
+#define HASH_PRIME4 0x85ebca77c2b2ae63ULL
+
+/// Fifth XXH64 prime
+#define HASH_PRIME5 0x27d4eb2f165667c5ULL
+
+/// FNV-1a 32 bit offset basis
+#define FNV_OFFSET 2166136261u
+
+/// FNV-1a 32 bit prime
+#define FNV_PRIME 16777619u
+
+/**
+ * @brief Rotates a 64 bit value left.
+ * 
+ * Preconditions: bits is between 1 and 63
+ * 
+ * Postconditions:
+ *
+ * @param value Value to rotate
+ * @param bits Number of bits to rotate by
+ * @return The rotated value
+ */
+uint64_t hash_rotl(uint64_t value, unsigned int bits);
+
+/**
+ * @brief Reads a little endian 64 bit value.
+ * 
+ * Preconditions: data holds at least 8 bytes
+ * 
+ * Postconditions:
+ *
+ * @param data Bytes to read
+ * @return The value
+ */
+uint64_t hash_read64(const uint8_t *data);
+
+/**
+ * @brief Reads a little endian 32 bit value.
+ * 
+ * Preconditions: data holds at least 4 bytes
+ * 
+ * Postconditions:
+ *
+ * @param data Bytes to read
+ * @return The value
+ */
+uint64_t hash_read32(const uint8_t *data);
+
+/**
+ * @brief Mixes 8 bytes of input into one lane.
+ * 
+ * Preconditions:
+ * 
+ * Postconditions:
+ *
+ * @param acc Lane's accumulator
+ * @param input Input to mix in
+ * @return The new accumulator
+ */
+uint64_t hash_round(uint64_t acc, uint64_t input);
+
+/**
+ * @brief Consumes whole stripes.
+ * 
+ * Preconditions: state is not NULL, data holds count stripes
+ * 
+ * Postconditions: Every lane has mixed in its share of the stripes
+ *
+ * @param state Hash to add to
+ * @param data Stripes to add
+ * @param count Number of stripes
+ */
+void hash_stripes(struct hash_state *state, const uint8_t *data, size_t count);
+
+void hash_init(struct hash_state *state) {
+	assert(state != NULL);
+
+	state->acc[0] = HASH_PRIME1 + HASH_PRIME2;
+	state->acc[1] = HASH_PRIME2;
+	state->acc[2] = 0;
+	state->acc[3] = -HASH_PRIME1;
+	state->total = 0;
+	state->tail_len = 0;
+}
+
+void hash_update(struct hash_state *state, const void *data, size_t size) {
+	const uint8_t *bytes = (const uint8_t *)data;
+
+	assert(state != NULL);
+	assert((data != NULL) || (size == 0));
+
+	state->total += size;
+
+	// Top up a partial stripe first
+	if (state->tail_len > 0) {
+		size_t take = HASH_STRIPE - state->tail_len;
+
+		if (take > size) {
+			take = size;
+		}
+
+		memcpy(state->tail + state->tail_len, bytes, take);
+		state->tail_len += take;
+		bytes += take;
+		size -= take;
+
+		if (state->tail_len < HASH_STRIPE) {
+			return;
+		}
+
+		hash_stripes(state, state->tail, 1);
+		state->tail_len = 0;
+	}
+
+	// Then hash straight from the caller's buffer
+	hash_stripes(state, bytes, size / HASH_STRIPE);
+	bytes += size - (size % HASH_STRIPE);
+	size %= HASH_STRIPE;
+
+	memcpy(state->tail, bytes, size);
+	state->tail_len = size;
+}
+
+uint64_t hash_final(const struct hash_state *state) {
+	const uint8_t *bytes;
+	uint64_t hash;
+	size_t left;
+	unsigned int i;
+
+	assert(state != NULL);
+
+	if (state->total >= HASH_STRIPE) {
+		hash = hash_rotl(state->acc[0], 1) + hash_rotl(state->acc[1], 7) +
+				hash_rotl(state->acc[2], 12) + hash_rotl(state->acc[3], 18);
+
+		for (i = 0; i < 4; i++) {
+			hash ^= hash_round(0, state->acc[i]);
+			hash = hash * HASH_PRIME1 + HASH_PRIME4;
+		}
+	} else {
+		hash = HASH_PRIME5;
+	}
+
+	hash += state->total;
+
+	// Fold in what is left, largest pieces first
+	bytes = state->tail;
+	left = state->tail_len;
+	while (left >= 8) {
+		hash ^= hash_round(0, hash_read64(bytes));
+		hash = hash_rotl(hash, 27) * HASH_PRIME1 + HASH_PRIME4;
+		bytes += 8;
+		left -= 8;
+	}
+
+	if (left >= 4) {
+		hash ^= hash_read32(bytes) * HASH_PRIME1;
+		hash = hash_rotl(hash, 23) * HASH_PRIME2 + HASH_PRIME3;
+		bytes += 4;
+		left -= 4;
+	}
+
+	while (left > 0) {
+		hash ^= *bytes * HASH_PRIME5;
+		hash = hash_rotl(hash, 11) * HASH_PRIME1;
+		bytes++;
+		left--;
+	}
+
+	// Spread every input bit over the whole result
+	hash ^= hash >> 33;
+	hash *= HASH_PRIME2;
+	hash ^= hash >> 29;
+	hash *= HASH_PRIME3;
+	hash ^= hash >> 32;
+
+	return hash;
+}
+
+uint32_t hash_name(const char *name) {
+	uint32_t hash;
+
+	assert(name != NULL);
+
+	hash = FNV_OFFSET;
+	while (*name != '\0') {
+		hash ^= (uint8_t)*name++;
+		hash *= FNV_PRIME;
+	}
+
+	return hash;
+}
+
+uint64_t hash_rotl(uint64_t value, unsigned int bits) {
+	return (value << bits) | (value >> (64 - bits));
+}
+
+uint64_t hash_read64(const uint8_t *data) {
+	assert(data != NULL);
+
+	return hash_read32(data) | (hash_read32(data + 4) << 32);
+}
+
+uint64_t hash_read32(const uint8_t *data) {
+	assert(data != NULL);
+
+	return (uint64_t)data[0] | ((uint64_t)data[1] << 8) |
+			((uint64_t)data[2] << 16) | ((uint64_t)data[3] << 24);
+}
+
+uint64_t hash_round(uint64_t acc, uint64_t input) {
+	acc += input * HASH_PRIME2;
+	acc = hash_rotl(acc, 31);
+
+	return acc * HASH_PRIME1;
+}
+
+void hash_stripes(struct hash_state *state, const uint8_t *data, size_t count) {
+	uint64_t acc0 = state->acc[0];
+	uint64_t acc1 = state->acc[1];
+	uint64_t acc2 = state->acc[2];
+	uint64_t acc3 = state->acc[3];
+
+	assert(state != NULL);
+	assert((data != NULL) || (count == 0));
+
+	// Keep the lanes in registers, they don't depend on each other
+	while (count > 0) {
+		acc0 = hash_round(acc0, hash_read64(data));
+		acc1 = hash_round(acc1, hash_read64(data + 8));
+		acc2 = hash_round(acc2, hash_read64(data + 16));
+		acc3 = hash_round(acc3, hash_read64(data + 24));
+		data += HASH_STRIPE;
+		count--;
+	}
+
+	state->acc[0] = acc0;
+	state->acc[1] = acc1;
+	state->acc[2] = acc2;
+	state->acc[3] = acc3;
+}
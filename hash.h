@@ -0,0 +1,104 @@
+/**
+ * @file hash.h
+ * @author Dan Albert
+ * @date Created 10/16/2026
+ * @date Last updated 10/16/2026
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Defines a fast 64 bit hash of file contents, computed a piece at a time.
+ * 
+ */
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// Size of the stripe the hash consumes at once
+#define HASH_STRIPE 32
+
+/**
+ * @brief State of a hash in progress.
+ *
+ * The hash is XXH64 with a seed of zero, so results match other tools.
+ */
+struct hash_state {
+	uint64_t acc[4];			///< Accumulator of each lane
+	uint64_t total;				///< Number of bytes hashed so far
+	uint8_t tail[HASH_STRIPE];	///< Bytes that don't yet fill a stripe
+	size_t tail_len;			///< Number of bytes in tail
+};
+
+/**
+ * @brief Starts a new hash.
+ * 
+ * Preconditions: state is not NULL
+ * 
+ * Postconditions: state holds the hash of no data
+ *
+ * @param state State to initialize
+ */
+void hash_init(struct hash_state *state);
+
+/**
+ * @brief Adds data to a hash.
+ * 
+ * Preconditions: state has been initialized, data is not NULL unless size
+ * is 0
+ * 
+ * Postconditions: state includes the data
+ *
+ * @param state Hash to add to
+ * @param data Data to add
+ * @param size Size of the data
+ */
+void hash_update(struct hash_state *state, const void *data, size_t size);
+
+/**
+ * @brief Finishes a hash.
+ * 
+ * Preconditions: state has been initialized
+ * 
+ * Postconditions: state is unchanged, so more data may still be added
+ *
+ * @param state Hash to finish
+ * @return The hash of all the data added
+ */
+uint64_t hash_final(const struct hash_state *state);
+
+/**
+ * @brief Hashes a name for a hash table.
+ *
+ * The hash is 32 bit FNV-1a, cheap for short strings and well spread in its
+ * low bits, so tables can take it modulo a power of two.
+ * 
+ * Preconditions: name is not NULL
+ * 
+ * Postconditions:
+ *
+ * @param name Null terminated name
+ * @return FNV-1a hash of name
+ */
+uint32_t hash_name(const char *name);
+
+#endif // HASH_H
+
@@ -38,9 +38,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 
+#include "hash.h"
 #include "myar.h"
+#include "stats.h"
 
 /// No mode selected
 #define MODE_NONE			0
@@ -63,17 +66,163 @@
 /// Extract members from archive mode
 #define MODE_EXTRACT		6
 
+/// Replace changed members mode
+#define MODE_REPLACE		7
+
+/// Replace members older than their files mode
+#define MODE_UPDATE			8
+
+/// Run a script of commands mode
+#define MODE_SCRIPT			9
+
+/// getopt_long value of the --stats option, past any short option
+#define OPT_STATS			256
+
+/// Size of the stdout buffer for the table modes
+#define STDOUT_BUF_SIZE		(256 * 1024)
+
+/// Characters separating the words of a script line
+#define SCRIPT_SEP			" \t\r\n,"
+
+/// Initial number of slots hashing a script's pending names
+#define SCRIPT_SLOTS		256
+
+/**
+ * @brief Names collected for one kind of change.
+ */
+struct name_list {
+	char **names;				///< Null terminated names
+	size_t count;				///< Number of names
+	size_t capacity;			///< Number of names allocated
+};
+
+/**
+ * @brief Changes a script has asked for that haven't been made yet.
+ */
+struct script {
+	struct name_list removed;	///< Names of members to delete
+	struct name_list replaced;	///< Files to replace members with
+	struct name_list added;		///< Files to append
+	const char **pending;		///< Every name in the lists, hashed with
+								///< linear probing
+	size_t npending;			///< Number of names hashed
+	size_t nslots;				///< Number of slots, zero or a power of two
+};
+
 /**
  * @brief Append all regular files in the current directory to the archive.
  *
- * Preconditions: fd is a valid file descriptor, exclude is not NULL
+ * Preconditions: ar is a handle to a valid archive, exclude is not NULL
  *
  * Postconditions: The archive contains all regular files in the current working directory
  *
- * @param fd File descriptor of an open archive
+ * @param ar Handle of an open archive
  * @param exclude File to exclude from the current directory. Typically the archive itself.
  */
-void append_all(int fd, const char *exclude);
+void append_all(struct archive *ar, const char *exclude);
+
+/**
+ * @brief Runs a script of commands against the archive.
+ *
+ * Commands are those of GNU ar's MRI scripts that work on an open archive:
+ * ADDMOD, REPLACE, DELETE, EXTRACT, LIST, SAVE and END, one to a line with
+ * their arguments separated by spaces or commas. Lines starting with * or ;
+ * are comments. Changes are held back and made together in one rewrite when
+ * the script saves or ends, or sooner when a command names a member with a
+ * change still pending, so every command sees those before it.
+ *
+ * Preconditions: ar is a handle to a valid archive
+ *
+ * Postconditions: Every command has been run
+ *
+ * @param ar Handle of an open archive
+ * @param path Path of the script, NULL to read standard input
+ */
+void run_script(struct archive *ar, const char *path);
+
+/**
+ * @brief Makes every change a script has held back.
+ *
+ * Preconditions: ar is a handle to a valid archive, script is not NULL
+ *
+ * Postconditions: The changes have been made and forgotten
+ *
+ * @param ar Handle of an open archive
+ * @param script Changes held back
+ */
+void script_flush(struct archive *ar, struct script *script);
+
+/**
+ * @brief Tells whether a member name has a change held back.
+ *
+ * Members are stored under the path they were added with, so names and paths
+ * compare alike.
+ *
+ * Preconditions: script is not NULL, name is not NULL
+ *
+ * Postconditions:
+ *
+ * @param script Changes held back
+ * @param name Name of a member or path of a file
+ * @return true if a change held back names the member, false otherwise
+ */
+bool script_touches(struct script *script, const char *name);
+
+/**
+ * @brief Adds a change to one of a script's lists of held back changes.
+ *
+ * Preconditions: script is not NULL, list is one of its lists, name is not
+ * NULL
+ *
+ * Postconditions: The list ends with a copy of name, which script_touches()
+ * finds
+ *
+ * @param script Changes held back
+ * @param list List to add to
+ * @param name Name of a member or path of a file
+ * @return true on success, false if out of memory
+ */
+bool script_add(struct script *script, struct name_list *list,
+		const char *name);
+
+/**
+ * @brief Finds the slot a name hashes to in a table of names.
+ *
+ * Preconditions: slots has nslots entries, a power of two, and at least one
+ * of them is empty, name is not NULL
+ *
+ * Postconditions:
+ *
+ * @param slots Hashed names
+ * @param nslots Number of slots
+ * @param name Name to look for
+ * @return Index of the slot holding name, or of the empty slot it would go in
+ */
+size_t name_slot(const char **slots, size_t nslots, const char *name);
+
+/**
+ * @brief Adds a copy of a name to a list.
+ *
+ * Preconditions: list is not NULL, name is not NULL
+ *
+ * Postconditions: The list ends with a copy of name
+ *
+ * @param list List to add to
+ * @param name Name to add
+ * @return true on success, false if out of memory
+ */
+bool list_add(struct name_list *list, const char *name);
+
+/**
+ * @brief Empties a list, keeping its memory.
+ *
+ * Preconditions: list is not NULL
+ *
+ * Postconditions: The list is empty
+ *
+ * @param list List to empty
+ */
+void list_clear(struct name_list *list);
 
 /**
  * @brief Print usage message and exit.
@@ -94,13 +243,29 @@ void usage(void);
  * @return Exit status
  */
 int main(int argc, char **argv) {
+	static const struct option long_opts[] = {
+		{ "stats", optional_argument, NULL, OPT_STATS },
+		{ NULL, 0, NULL, 0 }
+	};
+	struct stats stats;
 	char *archive_path = NULL;
 	int mode = MODE_NONE;
+	struct archive *ar = NULL;
+	char *end;
+	long jobs = 1;
+	long depth = 0;
+	long level = 0;
+	bool keep_index = false;
+	bool dedup = false;
+	bool symtab = true;
+	bool thin = false;
+	bool want_stats = false;
+	bool stats_json = false;
 	int c;
-	int fd;
 
 	// Process command line arguments and set mode
-	while ((c = getopt(argc, argv, "Adqtvx")) != -1) {
+	while ((c = getopt_long(argc, argv, "AMR:STdij:kqrtuvxz:", long_opts,
+			NULL)) != -1) {
 		switch (c) {
 		case 'A':
 			if (mode != MODE_NONE) {
@@ -109,6 +274,26 @@ int main(int argc, char **argv) {
 			
 			mode = MODE_APPEND_ALL;
 			break;
+		case 'M':
+			if (mode != MODE_NONE) {
+				usage();
+			}
+			
+			mode = MODE_SCRIPT;
+			break;
+		case 'R':
+			depth = strtol(optarg, &end, 10);
+			if ((*end != '\0') || (depth < 1)) {
+				usage();
+			}
+
+			break;
+		case 'S':
+			symtab = false;
+			break;
+		case 'T':
+			thin = true;
+			break;
 		case 'd':
 			if (mode != MODE_NONE) {
 				usage();
@@ -116,6 +301,19 @@ int main(int argc, char **argv) {
 			
 			mode = MODE_DELETE;
 			break;
+		case 'i':
+			keep_index = true;
+			break;
+		case 'j':
+			jobs = strtol(optarg, &end, 10);
+			if ((*end != '\0') || (jobs < 1)) {
+				usage();
+			}
+
+			break;
+		case 'k':
+			dedup = true;
+			break;
 		case 'q':
 			if (mode != MODE_NONE) {
 				usage();
@@ -123,6 +321,13 @@ int main(int argc, char **argv) {
 			
 			mode = MODE_APPEND;
 			break;
+		case 'r':
+			if (mode != MODE_NONE) {
+				usage();
+			}
+			
+			mode = MODE_REPLACE;
+			break;
 		case 't':
 			if (mode != MODE_NONE) {
 				usage();
@@ -130,6 +335,13 @@ int main(int argc, char **argv) {
 			
 			mode = MODE_CONCISE_TABLE;
 			break;
+		case 'u':
+			if (mode != MODE_NONE) {
+				usage();
+			}
+			
+			mode = MODE_UPDATE;
+			break;
 		case 'v':
 			if (mode != MODE_NONE) {
 				usage();
@@ -143,6 +355,24 @@ int main(int argc, char **argv) {
 			}
 			
 			mode = MODE_EXTRACT;
+			break;
+		case 'z':
+			level = strtol(optarg, &end, 10);
+			if ((*end != '\0') || (level < 0) || (level > 9)) {
+				usage();
+			}
+
+			break;
+		case OPT_STATS:
+			want_stats = true;
+			if (optarg == NULL) {
+				stats_json = false;
+			} else if (strcmp(optarg, "json") == 0) {
+				stats_json = true;
+			} else {
+				usage();
+			}
+
 			break;
 		default:
 			break;
@@ -167,46 +397,125 @@ int main(int argc, char **argv) {
 		usage();
 	}
 
-	fd = ar_open(archive_path);
-	if (fd == -1) {
+	// Counted from the open to the close, off unless asked for
+	if (want_stats) {
+		stats_start(&stats);
+	}
+
+	// Read the archive from standard input or write it to standard output,
+	// either of which may be a pipe
+	if (strcmp(archive_path, "-") == 0) {
+		if ((mode == MODE_APPEND) || (mode == MODE_APPEND_ALL)) {
+			ar = ar_create_stream(STDOUT_FILENO);
+		} else if ((mode != MODE_DELETE) && (mode != MODE_REPLACE) &&
+				(mode != MODE_UPDATE) && (mode != MODE_SCRIPT)) {
+			ar = ar_open_stream(STDIN_FILENO);
+		} else {
+			usage();
+		}
+	} else {
+		ar = ar_open(archive_path);
+	}
+
+	if (ar == NULL) {
 		fprintf(stderr, "Could not open archive file\n");
 		return -1;
 	}
 
+	ar_set_jobs(ar, jobs);
+
+	if (thin && (ar_make_thin(ar) == false)) {
+		ar_close(ar);
+		return -1;
+	}
+
+	if (keep_index) {
+		ar_keep_index(ar);
+	}
+
+	if (symtab == false) {
+		ar_skip_symtab(ar);
+	}
+
+	if (dedup) {
+		ar_skip_duplicates(ar);
+	}
+
+	ar_set_compression(ar, level);
+
+	// Fall back to plain system calls if the kernel has no io_uring
+	if ((depth > 0) && (ar_use_uring(ar, depth) == false)) {
+		fprintf(stderr, "io_uring unavailable, using system calls\n");
+	}
+
+	// Tables can run to millions of lines, write them out in large blocks
+	if ((mode == MODE_CONCISE_TABLE) || (mode == MODE_VERBOSE_TABLE)) {
+		setvbuf(stdout, NULL, _IOFBF, STDOUT_BUF_SIZE);
+	}
+
 	// All modes run at least once, loop for all args
 	do {
 		switch (mode) {
 		case MODE_APPEND_ALL:
-			append_all(fd, archive_path);
+			append_all(ar, archive_path);
 			break;
 		case MODE_DELETE:
-			ar_remove(fd, argv[optind++]);
+			// Remove every named member in one rewrite of the archive
+			ar_remove_set(ar, (const char **)&argv[optind], argc - optind);
+			optind = argc;
 			break;
 		case MODE_APPEND:
-			ar_append(fd, argv[optind++]);
+			// Lay out and append every named file at once
+			ar_append_set(ar, (const char **)&argv[optind], argc - optind);
+			optind = argc;
+			break;
+		case MODE_REPLACE:
+		case MODE_UPDATE:
+			// Rewrite every changed member in one pass over the archive
+			ar_replace_set(ar, (const char **)&argv[optind], argc - optind,
+					mode == MODE_UPDATE);
+			optind = argc;
 			break;
 		case MODE_CONCISE_TABLE:
-			ar_print_concise(fd);
+			ar_print_concise(ar);
 			break;
 		case MODE_VERBOSE_TABLE:
-			ar_print_verbose(fd);
+			ar_print_verbose(ar);
 			break;
 		case MODE_EXTRACT:
-			ar_extract(fd, argv[optind++]);
+			// Extract every named member in one pass over the archive
+			ar_extract_set(ar, (const char **)&argv[optind], argc - optind);
+			optind = argc;
+			break;
+		case MODE_SCRIPT:
+			// Commands come from the named file, or standard input
+			run_script(ar, (optind < argc) ? argv[optind] : NULL);
+			optind = argc;
 			break;
 		}
 	} while (optind < argc);
 	
-	ar_close(fd);
+	ar_close(ar);
+
+	// Standard output may hold the archive or a table, so report on stderr
+	if (want_stats) {
+		fflush(stdout);
+		stats_stop();
+		stats_print(&stats, stderr, stats_json);
+	}
 
 	return 0;
 }
 
-void append_all(int fd, const char *exclude) {
+void append_all(struct archive *ar, const char *exclude) {
 	DIR *dp;
 	struct dirent *de;
+	char **names;
+	size_t count;
+	size_t capacity;
+	size_t i;
 	
-	assert(fd >= 0);
+	assert(ar != NULL);
 	assert(exclude != NULL);
 
 	dp = opendir("./");
@@ -216,26 +525,317 @@ void append_all(int fd, const char *exclude) {
 		return;
 	}
 
-	// Append each regular file
+	// Collect each regular file
+	names = NULL;
+	count = 0;
+	capacity = 0;
 	while ((de = readdir(dp)) != NULL) {
 		if ((de->d_type == DT_REG) && (strcmp(de->d_name, exclude) != 0)) {
-			if (ar_append(fd, de->d_name) == false) {
-				fprintf(stderr, "Failed to add %s to archive\n", de->d_name);
+			if (count == capacity) {
+				char **grown;
+
+				capacity = (capacity == 0) ? 64 : capacity * 2;
+				grown = (char **)realloc(names, capacity * sizeof(char *));
+				if (grown == NULL) {
+					perror(NULL);
+					break;
+				}
+
+				names = grown;
 			}
+
+			names[count] = strdup(de->d_name);
+			if (names[count] == NULL) {
+				perror(NULL);
+				break;
+			}
+
+			count++;
 		}
 	}
 
 	closedir(dp);
+
+	// Append them all at once
+	ar_append_set(ar, (const char **)names, count);
+
+	for (i = 0; i < count; i++) {
+		free(names[i]);
+	}
+
+	free(names);
+}
+
+void run_script(struct archive *ar, const char *path) {
+	struct script script;
+	struct name_list names;
+	FILE *in;
+	char *line;
+	size_t len;
+	size_t lineno;
+
+	assert(ar != NULL);
+
+	in = (path == NULL) ? stdin : fopen(path, "r");
+	if (in == NULL) {
+		perror(path);
+		return;
+	}
+
+	memset(&script, 0, sizeof(script));
+	memset(&names, 0, sizeof(names));
+	line = NULL;
+	len = 0;
+	lineno = 0;
+	while (getline(&line, &len, in) != -1) {
+		struct name_list *pending;
+		char *save;
+		char *cmd;
+		char *arg;
+
+		lineno++;
+
+		cmd = strtok_r(line, SCRIPT_SEP, &save);
+		if ((cmd == NULL) || (cmd[0] == '*') || (cmd[0] == ';')) {
+			continue;
+		}
+
+		if (strcasecmp(cmd, "end") == 0) {
+			break;
+		}
+
+		if (strcasecmp(cmd, "save") == 0) {
+			script_flush(ar, &script);
+			continue;
+		}
+
+		if (strcasecmp(cmd, "list") == 0) {
+			script_flush(ar, &script);
+			ar_print_concise(ar);
+			continue;
+		}
+
+		if (strcasecmp(cmd, "extract") == 0) {
+			// Members are extracted as they stand at this point
+			list_clear(&names);
+			while ((arg = strtok_r(NULL, SCRIPT_SEP, &save)) != NULL) {
+				if (script_touches(&script, arg)) {
+					script_flush(ar, &script);
+				}
+
+				list_add(&names, arg);
+			}
+
+			if (names.count > 0) {
+				ar_extract_set(ar, (const char **)names.names, names.count);
+			}
+
+			continue;
+		}
+
+		if (strcasecmp(cmd, "addmod") == 0) {
+			pending = &script.added;
+		} else if (strcasecmp(cmd, "replace") == 0) {
+			pending = &script.replaced;
+		} else if (strcasecmp(cmd, "delete") == 0) {
+			pending = &script.removed;
+		} else {
+			fprintf(stderr, "Unknown command %s on line %zu\n", cmd, lineno);
+			continue;
+		}
+
+		// A second change to a member waits for the first to be made
+		while ((arg = strtok_r(NULL, SCRIPT_SEP, &save)) != NULL) {
+			if (script_touches(&script, arg)) {
+				script_flush(ar, &script);
+			}
+
+			script_add(&script, pending, arg);
+		}
+	}
+
+	script_flush(ar, &script);
+
+	if (in != stdin) {
+		fclose(in);
+	}
+
+	list_clear(&names);
+	free(names.names);
+	free(script.removed.names);
+	free(script.replaced.names);
+	free(script.added.names);
+	free(script.pending);
+	free(line);
+}
+
+void script_flush(struct archive *ar, struct script *script) {
+	assert(ar != NULL);
+	assert(script != NULL);
+
+	if ((script->removed.count == 0) && (script->replaced.count == 0) &&
+			(script->added.count == 0)) {
+		return;
+	}
+
+	ar_apply_set(ar,
+		(const char **)script->removed.names, script->removed.count,
+		(const char **)script->replaced.names, script->replaced.count,
+		(const char **)script->added.names, script->added.count);
+
+	list_clear(&script->removed);
+	list_clear(&script->replaced);
+	list_clear(&script->added);
+
+	if (script->npending > 0) {
+		memset(script->pending, 0, script->nslots * sizeof(const char *));
+		script->npending = 0;
+	}
+}
+
+bool script_touches(struct script *script, const char *name) {
+	assert(script != NULL);
+	assert(name != NULL);
+
+	if (script->npending == 0) {
+		return false;
+	}
+
+	return script->pending[name_slot(script->pending, script->nslots, name)] !=
+			NULL;
+}
+
+bool script_add(struct script *script, struct name_list *list,
+		const char *name) {
+	const char *copy;
+
+	assert(script != NULL);
+	assert(list != NULL);
+	assert(name != NULL);
+
+	// Keep the table at most half full
+	if ((script->npending + 1) * 2 > script->nslots) {
+		const char **grown;
+		size_t nslots;
+		size_t i;
+
+		nslots = (script->nslots == 0) ? SCRIPT_SLOTS : script->nslots * 2;
+		grown = (const char **)calloc(nslots, sizeof(const char *));
+		if (grown == NULL) {
+			perror(NULL);
+			return false;
+		}
+
+		for (i = 0; i < script->nslots; i++) {
+			if (script->pending[i] != NULL) {
+				grown[name_slot(grown, nslots, script->pending[i])] =
+						script->pending[i];
+			}
+		}
+
+		free(script->pending);
+		script->pending = grown;
+		script->nslots = nslots;
+	}
+
+	if (list_add(list, name) == false) {
+		return false;
+	}
+
+	// The table points at the list's copy, which lives until the next flush
+	copy = list->names[list->count - 1];
+	script->pending[name_slot(script->pending, script->nslots, copy)] = copy;
+	script->npending++;
+
+	return true;
+}
+
+size_t name_slot(const char **slots, size_t nslots, const char *name) {
+	size_t i;
+
+	assert(slots != NULL);
+	assert(name != NULL);
+
+	for (i = hash_name(name) & (nslots - 1); slots[i] != NULL; i = (i + 1) & (nslots - 1)) {
+		if (strcmp(slots[i], name) == 0) {
+			break;
+		}
+	}
+
+	return i;
+}
+
+bool list_add(struct name_list *list, const char *name) {
+	char *copy;
+
+	assert(list != NULL);
+	assert(name != NULL);
+
+	if (list->count == list->capacity) {
+		char **grown;
+		size_t capacity;
+
+		capacity = (list->capacity == 0) ? 64 : list->capacity * 2;
+		grown = (char **)realloc(list->names, capacity * sizeof(char *));
+		if (grown == NULL) {
+			perror(NULL);
+			return false;
+		}
+
+		list->names = grown;
+		list->capacity = capacity;
+	}
+
+	copy = strdup(name);
+	if (copy == NULL) {
+		perror(NULL);
+		return false;
+	}
+
+	list->names[list->count++] = copy;
+
+	return true;
+}
+
+void list_clear(struct name_list *list) {
+	size_t i;
+
+	assert(list != NULL);
+
+	for (i = 0; i < list->count; i++) {
+		free(list->names[i]);
+	}
+
+	list->count = 0;
 }
 
 void usage(void) {
-	printf("Usage: myar {Adqtvx} archive-file file...\n");
+	printf("Usage: myar [-i] [-j jobs] [-k] [-R depth] [-S] [-T] [-z level] [--stats[=json]]\n");
+	printf("            {Adqrtuvx} archive-file file...\n");
+	printf("       myar [options] -M archive-file [script]\n");
 	printf(" commands:\n");
 	printf("  A\t- quick append all \"regular\" file(s) in the current directory\n");
+	printf("  M\t- run ADDMOD, REPLACE, DELETE, EXTRACT, LIST, SAVE and END commands\n");
+	printf("   \t  from a script or standard input, changing the archive once\n");
 	printf("  d\t- delete file(s) from the archive\n");
 	printf("  q\t- quick append  file(s) to the archive\n");
+	printf("  r\t- replace file(s) in the archive that changed, appending new ones\n");
 	printf("  t\t- print a concise table of contents in the archive\n");
+	printf("  u\t- replace file(s) in the archive only with newer ones\n");
 	printf("  v\t- print a verbose table of contents in the archive\n");
 	printf("  x\t- extract named files\n");
+	printf(" archive-file may be - to read from standard input with t, v and x,\n");
+	printf(" or to write a new archive to standard output with A and q\n");
+	printf(" options:\n");
+	printf("  i\t- keep a member index file next to the archive\n");
+	printf("  j\t- number of threads to use for appending and extraction\n");
+	printf("  k\t- don't append files already stored with the same name and contents\n");
+	printf("  R\t- use io_uring, keeping this many files in flight\n");
+	printf("  S\t- don't create a symbol table for object files\n");
+	printf("  T\t- make a thin archive that refers to files instead of copying them\n");
+	printf("  z\t- compress appended members with zlib at this level, 1 to 9,\n");
+	printf("   \t  or 0 to store them as they are\n");
+	printf("  --stats\t- print system calls, bytes moved, headers read and time\n");
+	printf("         \t  spent in each phase to standard error, as JSON with =json\n");
 	exit(0);
 }
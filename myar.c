@@ -27,12 +27,19 @@
  * Implements an interface for UNIX archive file handling.
  * 
  */
-#define _BSD_SOURCE 1
+#define _GNU_SOURCE 1
 
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <assert.h>
+#include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -40,7 +47,15 @@
 #include <time.h>
 #include <unistd.h>
 #include <utime.h>
+#include <linux/fs.h>
 #include "myar.h"
+#include "arhdr.h"
+#include "armap.h"
+#include "hash.h"
+#include "pack.h"
+#include "pool.h"
+#include "stats.h"
+#include "uring.h"
 
 /// Default file permissions for new archives
 #define DEFAULT_PERMS (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH)
@@ -48,11 +63,29 @@
 /// Bit mask to select only the file permissions from a file mode
 #define PERM_MASK 0x01ff
 
-/// Maximum number of bytes to write in a single write() call
-#define BLOCK_SIZE 4096
+/// Maximum number of bytes to write in a single write() call, not the
+/// kernel's block size that linux/fs.h defines under the same name
+#undef BLOCK_SIZE
+#define BLOCK_SIZE (64 * 1024)
 
-/// Name of temporary archive for remove
-#define TEMP_AR_NAME ".temp.a"
+/// Size of the buffer used to copy data between files
+#define COPY_SIZE (4 * BLOCK_SIZE)
+
+/// Largest window of a file to map at once when copying
+#define MAP_SIZE (64 * 1024 * 1024)
+
+/// Largest transfer the kernel performs in one call, keeps requests within a
+/// 32 bit size_t
+#define IO_MAX 0x7ffff000
+
+/// Size of the window read at once when walking member headers
+#define SCAN_SIZE (1024 * 1024)
+
+/// Size of the window read after skipping past a large member
+#define SCAN_PEEK_SIZE (4 * 1024)
+
+/// Largest amount moved by one splice() call when extracting from a stream
+#define SPLICE_SIZE (1024 * 1024)
 
 /// Size of file time string for verbose output
 #define SFTIME 18
@@ -60,38 +93,346 @@
 /// Size of file mode string for verbose output
 #define SFMODE 10
 
-/// Size of ar file header name string
-#define SARFNAME 16
+/// Initial number of entries allocated for the member table
+#define INDEX_INIT_SIZE 64
+
+/// Marks the end of a hash chain in the member table
+#define INDEX_NONE ((size_t)-1)
+
+/// Marks a member dropped by a rewrite in place of a replacing item
+#define INDEX_DROP (INDEX_NONE - 1)
+
+/// Suffix added to an archive's path to name its member index file
+#define INDEX_SUFFIX ".idx"
+
+/// Magic number at the start of a member index file
+#define INDEX_MAGIC "MYARIDX3"
+
+/// Written in the index file's byte order, so another order reads differently
+#define INDEX_BYTE_ORDER 0x01020304
+
+/// Size of the member index file magic number
+#define SINDEXMAG 8
+
+/// Member name of the GNU long name table
+#define LONG_NAMES_NAME "//"
+
+/// Magic number of a thin archive, whose members live in their own files
+#define THINMAG "!<thin>\n"
+
+/// Smallest amount of space reserved for the symbol table
+#define ARMAP_MIN_SIZE (4 * 1024)
+
+/**
+ * @brief Decoded header of an archive member and its location in the archive.
+ */
+struct ar_member {
+	char name[SARFNAME + 1];	///< Null terminated member name
+	off_t offset;				///< Offset of the member's header
+	off_t size;					///< Size of the member's data
+	time_t date;				///< Modification time
+	uid_t uid;					///< Owner's user ID
+	gid_t gid;					///< Owning group's group ID
+	mode_t mode;				///< File mode
+	off_t long_name;			///< Offset of the name in the long name table,
+								///< -1 if the name fits in the header
+	uint64_t hash;				///< Hash of the member's data, 0 until it is
+								///< needed
+	off_t unpacked;				///< Size of the data once unpacked, -1 if it
+								///< is stored as is
+	size_t next;				///< Index of the next member in the hash chain
+};
+
+struct archive {
+	int fd;						///< File descriptor of the archive
+	char *path;					///< Path the archive was opened with, NULL
+								///< for a stream
+	off_t size;					///< Size of the archive file
+	struct ar_member *members;	///< Members in the order they appear
+	size_t count;				///< Number of members
+	size_t capacity;			///< Number of members allocated
+	size_t *buckets;			///< Hash buckets, each the head of a chain
+	size_t nbuckets;			///< Number of hash buckets, a power of two
+	unsigned int jobs;			///< Number of threads for parallel operations
+	struct uring *ring;			///< io_uring backend, NULL for plain system calls
+	char *index_path;			///< Path of the member index file
+	void *index_map;			///< Mapping of the member index file, if the
+								///< member table lives in it
+	size_t index_map_size;		///< Size of the mapping
+	bool index_wanted;			///< Whether to write the index file on close
+	bool index_fresh;			///< Whether the index file matches the table
+	struct armap armap;			///< Symbol table, once loaded
+	bool armap_loaded;			///< Whether armap matches the archive's table
+	bool armap_wanted;			///< Whether appends create a symbol table
+	bool dedup;					///< Whether appends skip files already stored
+								///< under the same name
+	int pack_level;				///< zlib level appends pack members at, 0 to
+								///< store them as is
+	bool thin;					///< Whether members live in their own files
+	int dir_fd;					///< Directory holding the archive, which thin
+								///< member paths are relative to
+	char *long_names;			///< Long name table, names null terminated
+	size_t long_names_size;		///< Size of the long name table
+	bool stream;				///< Whether the archive can only be read once,
+								///< front to back
+	bool stream_read;			///< Whether the stream has been read to the end
+	bool sink;					///< Whether the archive is written once, front
+								///< to back
+	char *rewrite_path;			///< Path of the file being built to replace
+								///< the archive, which fd refers to, NULL
+								///< outside a rewrite
+	int old_fd;					///< File descriptor of the archive being
+								///< replaced during a rewrite
+};
+
+/**
+ * @brief Header of a member index file.
+ *
+ * The header is followed by the hash buckets and then the member table, laid
+ * out exactly as they are in memory, so the file can be mapped and used in
+ * place. It is only trusted on a machine with the same byte order and layout
+ * of the member table, and if the archive's size and modification time still
+ * match.
+ */
+struct ar_index_hdr {
+	char magic[SINDEXMAG];		///< INDEX_MAGIC
+	uint32_t member_size;		///< Size of struct ar_member when written
+	uint32_t byte_order;		///< INDEX_BYTE_ORDER
+	uint64_t abi;				///< ar_index_abi() when written
+	int64_t ar_size;			///< Size of the archive
+	int64_t ar_mtime;			///< Archive modification time, seconds
+	int64_t ar_mtime_nsec;		///< Archive modification time, nanoseconds
+	uint64_t count;				///< Number of members
+	uint64_t nbuckets;			///< Number of hash buckets
+};
+
+/**
+ * @brief A file planned for a bulk append.
+ */
+struct ar_append_item {
+	const char *path;			///< Path of the file
+	struct stat st;				///< Status of the file when it was planned
+	struct ar_hdr hdr;			///< Header to write for the file
+	off_t offset;				///< Offset of the member's header
+	bool pad;					///< Whether a newline precedes the header
+	bool check;					///< Whether a member may already hold the
+								///< file's data
+	uint64_t hash;				///< Hash of the file's data, if checked or
+								///< packed
+	int packed_fd;				///< Temporary file holding the packed member,
+								///< -1 to copy the file as is
+	off_t unpacked;				///< Size of the file if packed, -1 otherwise
+};
+
+/**
+ * @brief Work shared by the threads of a bulk append.
+ */
+struct ar_append_work {
+	struct archive *ar;			///< Archive being appended to
+	struct ar_append_item *items;	///< Files to append, in archive order
+	struct armap *maps;			///< Symbols defined by each file
+};
+
+/**
+ * @brief Members that move together when members are replaced.
+ */
+struct ar_run {
+	off_t from;					///< Offset of the first member's header
+	off_t to;					///< Offset the first member's header moves to
+	off_t size;					///< Size of the members, padding included
+};
+
+/**
+ * @brief Work shared by the threads hashing files and members for an append.
+ */
+struct ar_dedup_work {
+	struct archive *ar;			///< Archive being appended to
+	struct ar_append_item *items;	///< Files to append
+	size_t *checks;				///< Indexes of the files to hash
+	size_t nchecks;				///< Number of files to hash
+	struct ar_member **members;	///< Members to hash
+};
+
+/**
+ * @brief Work shared by the threads of a parallel extraction.
+ */
+struct ar_extract_work {
+	struct archive *ar;			///< Archive being extracted from
+	struct ar_member **members;	///< Members to extract, in archive order
+};
+
+/**
+ * @brief Work shared by the threads reading symbols from members.
+ */
+struct ar_armap_work {
+	struct archive *ar;			///< Archive being read
+	struct armap *maps;			///< Symbols found in each member
+	size_t first;				///< Index of the first member to read
+};
+
+/**
+ * @brief Opens and verifies an archive file for ar_open, which times it.
+ *
+ * Preconditions: path is not NULL
+ *
+ * Postconditions: As for ar_open
+ *
+ * @param path Path to the archive file
+ * @return Handle to the opened archive, NULL on failure
+ */
+struct archive *ar_open_file(const char *path);
+
+/**
+ * @brief Reads a stream's member table, skipping over the members' data.
+ *
+ * Preconditions: ar is a handle to a stream archive that hasn't been read
+ *
+ * Postconditions: The member table holds every member of the archive, the
+ * stream has been read to the end
+ *
+ * @param ar Handle of an open archive
+ * @return true on success, false otherwise
+ */
+bool ar_stream_build(struct archive *ar);
+
+/**
+ * @brief Extracts members from a stream as they go past.
+ *
+ * Each name is extracted from the first member carrying it.
+ *
+ * Preconditions: ar is a handle to a stream archive that hasn't been read,
+ * names holds count null terminated names
+ *
+ * Postconditions: The named members have been extracted, the stream has
+ * been read to the end
+ *
+ * @param ar Handle of an open archive
+ * @param names Names of the members to extract
+ * @param count Number of names
+ * @return true on success, false otherwise
+ */
+bool ar_stream_extract(struct archive *ar, const char **names, size_t count);
+
+/**
+ * @brief Reads the next member header from a stream.
+ *
+ * Preconditions: ar is a handle to a stream archive positioned at a header
+ *
+ * Postconditions: If a header was read, it is the last member in the table
+ * and the stream is positioned at the member's data
+ *
+ * @param ar Handle of an open archive
+ * @param member Location to store the new member, NULL at the end of the
+ * archive
+ * @return true on success, false otherwise
+ */
+bool ar_stream_next(struct archive *ar, struct ar_member **member);
 
-/// Size of ar file header date string
-#define SARFDATE 12
+/**
+ * @brief Reads past a member's data in a stream.
+ *
+ * Also reads the long name table into memory when it goes past.
+ *
+ * Preconditions: ar is a handle to a stream archive positioned at the data
+ * of member
+ *
+ * Postconditions: The stream is positioned at the next header
+ *
+ * @param ar Handle of an open archive
+ * @param member Member to skip
+ * @return true on success, false otherwise
+ */
+bool ar_stream_skip(struct archive *ar, struct ar_member *member);
 
-/// Size of ar file header UID string
-#define SARFUID 6
+/**
+ * @brief Reads the padding byte that follows a member with an odd size.
+ *
+ * Preconditions: ar is a handle to a stream archive positioned just past a
+ * member's data
+ *
+ * Postconditions: The stream is positioned at the next header
+ *
+ * @param ar Handle of an open archive
+ * @return true on success, false otherwise
+ */
+bool ar_stream_pad(struct archive *ar);
 
-/// Size of ar file header GID string
-#define SARFGID 6
+/**
+ * @brief Extracts the member whose data is next in a stream.
+ *
+ * Preconditions: ar is a handle to a stream archive positioned at the data
+ * of member
+ *
+ * Postconditions: The member has been extracted and the stream is
+ * positioned at the next header, unless the member lives in its own file
+ *
+ * @param ar Handle of an open archive
+ * @param member Member to extract
+ * @return true on success, false otherwise
+ */
+bool ar_stream_member(struct archive *ar, struct ar_member *member);
 
-/// Size of ar file header mode string
-#define SARFMODE 8
+/**
+ * @brief Writes every byte of a buffer to a file at its current position.
+ *
+ * Preconditions: fd is a valid file descriptor, buf holds size bytes
+ *
+ * Postconditions: buf has been written
+ *
+ * @param fd File descriptor to write to
+ * @param buf Buffer to write from
+ * @param size Number of bytes to write
+ * @return true on success, false otherwise
+ */
+bool stream_write(int fd, const uint8_t *buf, size_t size);
 
-/// Size of ar file header size string
-#define SARFSIZE 10
+/**
+ * @brief Copies a file's data to the current position of a stream.
+ *
+ * Uses sendfile(), which can write to pipes and sockets, and falls back to a
+ * buffered copy.
+ *
+ * Preconditions: in_fd and out_fd are valid file descriptors, the first size
+ * bytes of in_fd exist
+ *
+ * Postconditions: The size bytes have been written to out_fd
+ *
+ * @param in_fd File descriptor to read from, from its start
+ * @param out_fd File descriptor to write to
+ * @param size Number of bytes to copy
+ * @return true on success, false otherwise
+ */
+bool stream_send(int in_fd, int out_fd, off_t size);
 
-/// Size of ar file header magic number
-#define SARFMAG 2
+/**
+ * @brief Reads an exact number of bytes from a file, or up to its end.
+ *
+ * Preconditions: fd is a valid file descriptor, buf has room for size bytes
+ *
+ * Postconditions: buf holds the bytes read
+ *
+ * @param fd File descriptor to read from
+ * @param buf Buffer to read to
+ * @param size Number of bytes to read
+ * @return Number of bytes read, less than size only at the end of the file,
+ * or -1 on error
+ */
+ssize_t stream_read(int fd, uint8_t *buf, size_t size);
 
 /**
  * @brief Verifies presence and validity of ar file magic number.
  *
- * Preconditions: fd is an file descriptor for a valid archive
+ * Preconditions: fd is an file descriptor for a valid archive, thin is not
+ * NULL
  *
- * Postconditions: File pointer has been returned to its original position
+ * Postconditions: File pointer has been returned to its original position,
+ * thin tells whether the archive is a thin archive
  *
  * @param fd File descriptor of an open archive
+ * @param thin Location to store whether the archive is thin
  * @return true if magic number is valid, false otherwise
  */
-bool ar_check_global_hdr(int fd);
+bool ar_check_global_hdr(int fd, bool *thin);
 
 /**
  * @brief Writes ar file magic number to the beginning of a file.
@@ -102,9 +443,10 @@ bool ar_check_global_hdr(int fd);
  * global header has been written
  *
  * @param fd File descriptor of an open archive
+ * @param thin true to write the magic number of a thin archive
  * @return true on success, false otherwise
  */
-bool ar_write_global_hdr(int fd);
+bool ar_write_global_hdr(int fd, bool thin);
 
 /**
  * @brief Loads file header from archive file
@@ -121,733 +463,5464 @@ bool ar_write_global_hdr(int fd);
 bool ar_load_hdr(int fd, struct ar_hdr *hdr);
 
 /**
- * @brief Searches through the archive for specific member and loads header data.
+ * @brief Looks up a member and seeks to the beginning of its data.
  *
- * Preconditions: fd is an file descriptor for a valid archive, name is not NULL,
- * name refers to a member of the archive, hdr is not NULL
+ * Preconditions: ar is a handle to a valid archive, name is not NULL
  *
- * Postconditions:
+ * Postconditions: If the member was found, the file pointer is at the
+ * beginning of its data
  *
- * @param fd File descriptor of an open archive
+ * @param ar Handle of an open archive
  * @param name Name of the member to seek to
- * @param hdr Pointer to ar_hdr to load data into
+ * @return Pointer to the member's table entry, NULL if there is no such member
  */
-bool ar_seek(int fd, const char *name, struct ar_hdr *hdr);
+struct ar_member *ar_seek(struct archive *ar, const char *name);
 
 /**
- * @brief Converts a mode integer to an ASCII permissions string.
+ * @brief Extracts a member's data to a file named after the member.
  *
- * Preconditions: str is not NULL, str is an allocated buffer of size SFMODE
+ * Preconditions: ar is a handle to a valid archive, member is an entry in the
+ * member table of ar, a file with the member's name is writable
  *
- * Postconditions: Permissions string has been loaded into str
+ * Postconditions: The member has been extracted and its modification time set
  *
- * @param mode File mode integer
- * @param str Character array of size SFMODE to load permissions string into
+ * @param ar Handle of an open archive
+ * @param member Table entry of the member to extract
+ * @return true on success, false otherwise
  */
-void ar_mode_str(mode_t mode, char *str);
+bool ar_extract_member(struct archive *ar, struct ar_member *member);
 
 /**
- * @brief Retrieves a null terminated member name from an ar_hdr structure.
+ * @brief Extracts one member of a parallel extraction.
  *
- * Preconditions: hdr is not NULL, hdr is a valid ar header, name is not NULL,
- * name is an allocated buffer of size SARFNAME + 1
+ * Preconditions: ctx points to an ar_extract_work, task is an index into its
+ * members
  *
- * Postconditions: A null terminated member name has been loaded into name
+ * Postconditions: The member has been extracted
  *
- * @param hdr Pointer to ar_hdr to retrieve member name from
- * @param name Character array of size SARFNAME + 1 to load the member name into
+ * @param ctx Pointer to the shared ar_extract_work
+ * @param task Index of the member to extract
+ * @return true on success, false otherwise
  */
-void ar_member_name(struct ar_hdr *hdr, char *name);
+bool ar_extract_task(void *ctx, size_t task);
 
 /**
- * @brief Returns a UNIX timestamp from an ar_hdr structure.
+ * @brief Writes one member of a bulk append.
  *
- * Preconditions: hdr is not NULL, hdr is a valid ar header
+ * Preconditions: ctx points to an ar_append_work, task is an index into its
+ * items, the archive is large enough to hold the member
  *
- * Postconditions:
+ * Postconditions: The member's padding, header and data have been written at
+ * its planned offset
  *
- * @param hdr Pointer to ar_hdr to retrieve member name from
- * @return Integer representation of the UNIX timestamp
+ * @param ctx Pointer to the shared ar_append_work
+ * @param task Index of the file to append
+ * @return true on success, false otherwise
  */
-time_t ar_member_date(struct ar_hdr *hdr);
+bool ar_append_task(void *ctx, size_t task);
 
 /**
- * @brief Returns the owner's user ID from an ar_hdr structure.
+ * @brief Writes the members of a bulk append through the io_uring backend.
  *
- * Preconditions: hdr is not NULL, hdr is a valid ar header
+ * Preconditions: ar is a handle with an io_uring backend, items is an array of
+ * count planned files, the archive is large enough to hold them
  *
- * Postconditions:
+ * Postconditions: Each member's padding, header and data have been written at
+ * its planned offset
  *
- * @param hdr Pointer to ar_hdr to retrieve owner's user ID from
- * @return File owner's user ID
+ * @param ar Handle of an open archive
+ * @param items Files to append
+ * @param count Number of files
+ * @return true if every file was written, false otherwise
  */
-uid_t ar_member_uid(struct ar_hdr *hdr);
+bool ar_append_uring(struct archive *ar, struct ar_append_item *items,
+		size_t count);
 
 /**
- * @brief Returns the owning group's user ID from an ar_hdr structure.
+ * @brief Extracts members through the io_uring backend.
  *
- * Preconditions: hdr is not NULL, hdr is a valid ar header
+ * Preconditions: ar is a handle with an io_uring backend, members is an array
+ * of count entries in the member table of ar
  *
- * Postconditions:
+ * Postconditions: The members have been extracted and their modification
+ * times set
  *
- * @param hdr Pointer to ar_hdr to retrieve the owning group's ID from
- * @return File owning group's group ID
+ * @param ar Handle of an open archive
+ * @param members Members to extract
+ * @param count Number of members
+ * @return true if every member was extracted, false otherwise
  */
-gid_t ar_member_gid(struct ar_hdr *hdr);
+bool ar_extract_uring(struct archive *ar, struct ar_member **members,
+		size_t count);
 
 /**
- * @brief Returns a file's mode from an ar_hdr structure.
+ * @brief Appends headers that refer to files to a thin archive.
  *
- * Preconditions: hdr is not NULL, hdr is a valid ar header
+ * Preconditions: ar is a handle to a valid thin archive, items holds count
+ * files that have been stat()ed
  *
- * Postconditions:
+ * Postconditions: The files are members of the archive
  *
- * @param hdr Pointer to ar_hdr to retrieve the file's mode from
- * @return File mode
+ * @param ar Handle of an open archive
+ * @param items Files to append
+ * @param count Number of files
+ * @return true on success, false otherwise
  */
-mode_t ar_member_mode(struct ar_hdr *hdr);
+bool ar_append_thin(struct archive *ar, struct ar_append_item *items,
+		size_t count);
 
 /**
- * @brief Returns a file's size ID from an ar_hdr structure.
+ * @brief Drops files from a bulk append whose data is already stored.
  *
- * Preconditions: hdr is not NULL, hdr is a valid ar header
+ * A file is only hashed when a member with the same name and size exists, and
+ * a member's hash is kept in the member table, and so in the index file, once
+ * it has been computed. The files and members are hashed in parallel.
  *
- * Postconditions:
+ * Preconditions: ar is a handle to a valid archive that isn't thin, items
+ * holds count files that have headers
  *
- * @param hdr Pointer to ar_hdr to retrieve the file's size from
- * @return File size
+ * Postconditions: items holds, in order, only the files no member with the
+ * same name has the same hash as, count is their number
+ *
+ * @param ar Handle of an open archive
+ * @param items Files to append
+ * @param count Number of files, updated to the number left
+ * @return true on success, false if a member couldn't be read
  */
-off_t ar_member_size(struct ar_hdr *hdr);
+bool ar_append_dedup(struct archive *ar, struct ar_append_item *items,
+		size_t *count);
 
 /**
- * @brief Read data from a file in chunks of BLOCK_SIZE bytes.
+ * @brief Marks every member carrying one of a set of names.
  *
- * Preconditions: fd is a valid file descriptor, buf is not NULL,
- * buf is a buffer of size size, from is between zero and the
- * size of the file - size
+ * Names that no member carries are reported.
  *
- * Postconditions: The size bytes following from are loaded into buf
+ * Preconditions: ar is a handle to a valid archive, names holds count names
+ * that are not NULL, drop has an entry for every member
  *
- * @param fd File descriptor to read from
- * @param buf Buffer to read to
- * @param from File offset to read from
- * @param size Number of bytes to read
- * @return true on success, false otherwise
+ * Postconditions: drop is set for every member carrying one of the names
+ *
+ * @param ar Handle of an open archive
+ * @param names Names of the members
+ * @param count Number of names
+ * @param drop Flag for each member
+ * @return true if every name was found, false otherwise
  */
-bool block_read(int fd, uint8_t *buf, off_t from, size_t size);
+bool ar_remove_mark(struct archive *ar, const char **names, size_t count,
+		bool *drop);
 
 /**
- * @brief Write data to a file in chunks of BLOCK_SIZE bytes.
+ * @brief Drops, replaces and appends members in a single rewrite.
  *
- * Preconditions: fd is a valid file descriptor, buf is not NULL,
- * buf is a buffer of size size
+ * Dropped members go first, so a file named like one is appended rather
+ * than replacing it.
  *
- * Postconditions: The first size bytes in buf are written to the file
- * at to
+ * Preconditions: ar is a handle to a valid archive that isn't a stream, drop
+ * is NULL or has an entry for every member, paths holds count paths and
+ * added holds nadded paths, none of them NULL
  *
- * @param fd File descriptor to write to
- * @param buf Buffer to write from
- * @param from File offset to write to
- * @param size Number of bytes to write
+ * Postconditions: Dropped members are gone, members named by a path hold the
+ * file's contents as for ar_replace_set and every added file is appended
+ *
+ * @param ar Handle of an open archive
+ * @param drop Flag for each member to drop, NULL to drop none
+ * @param paths Paths of the files replacing members
+ * @param count Number of paths
+ * @param newer Whether to only replace members older than their files
+ * @param added Paths of files to append as they are
+ * @param nadded Number of files to append
  * @return true on success, false otherwise
  */
-bool block_write(int fd, uint8_t *buf, off_t to, size_t size);
+bool ar_replace_run(struct archive *ar, const bool *drop, const char **paths,
+		size_t count, bool newer, const char **added, size_t nadded);
 
-int ar_open(const char *path) {
-	struct stat st;
-	bool create;
-	int fd;
+/**
+ * @brief Tells whether the archive can be replaced by a rewrite.
+ *
+ * Only a regular file opened by path can be. An archive with other hard links
+ * is left to be changed in place, since renaming over it would separate them.
+ *
+ * Preconditions: ar is a handle to a valid archive
+ *
+ * Postconditions:
+ *
+ * @param ar Handle of an open archive
+ * @return true if a rewrite can replace the archive, false otherwise
+ */
+bool ar_rewrite_usable(struct archive *ar);
 
-	assert(path);
+/**
+ * @brief Starts building a file to replace the archive.
+ *
+ * The file is created next to the archive under a unique name, with the
+ * archive's permissions, and takes the archive's place as ar->fd. A path
+ * through symbolic links is resolved first, so the rename replaces the
+ * archive rather than a link to it.
+ *
+ * Preconditions: ar is a handle to a valid archive outside a rewrite
+ *
+ * Postconditions: If the rewrite started, ar->fd refers to the empty new file
+ * and ar->old_fd to the archive
+ *
+ * @param ar Handle of an open archive
+ * @return true if the rewrite started, false if the archive has to be
+ * changed in place
+ */
+bool ar_rewrite_begin(struct archive *ar);
 
-	// Are we creating the file?
-	if (stat(path, &st) == 0) {
-		create = false;
-	} else {
-		create = true;
-	}
-	
-	fd = open(path, O_RDWR | O_CREAT, DEFAULT_PERMS);
-	if (fd == -1) {
-		// Report error
-		fprintf(stderr, "File (%s) could not be opened\n", path);
-		return -1;
-	}
+/**
+ * @brief Puts the file built by a rewrite in place of the archive.
+ *
+ * The file is flushed to disk before it is renamed over the archive, and its
+ * directory after, so after a crash the archive is either as it was or as it
+ * was rewritten.
+ *
+ * Preconditions: ar is a handle in a rewrite, the new file is complete
+ *
+ * Postconditions: The archive's path refers to the new file, or if it
+ * couldn't be renamed, the rewrite has been abandoned
+ *
+ * @param ar Handle of an open archive
+ * @return true on success, false otherwise
+ */
+bool ar_rewrite_commit(struct archive *ar);
 
-	lseek(fd, 0, SEEK_SET);
+/**
+ * @brief Flushes the directory holding a file to disk, so a rename into it
+ * survives a crash.
+ *
+ * Preconditions: path is not NULL
+ *
+ * Postconditions: The directory's entries are on disk
+ *
+ * @param path Path of a file in the directory
+ * @return true on success, false otherwise
+ */
+bool ar_sync_dir(const char *path);
 
-	if (create == false) {
-		// Verify that the archive is valid
-		if (!ar_check_global_hdr(fd)) {
-			// Report error
-			fprintf(stderr, "Bad global header\n");
+/**
+ * @brief Abandons a rewrite, leaving the archive as it was.
+ *
+ * The member table and symbol table may already describe the new file, so
+ * they are read from the archive again.
+ *
+ * Preconditions: ar is a handle in a rewrite
+ *
+ * Postconditions: The new file is gone, ar->fd refers to the archive again
+ * and the member table matches it
+ *
+ * @param ar Handle of an open archive
+ */
+void ar_rewrite_abort(struct archive *ar);
 
-			// Clean up
-			ar_close(fd);
+/**
+ * @brief Writes replacements for members in place.
+ *
+ * The archive is laid out anew from the first replaced or dropped member on.
+ * Runs of members between those keep their order and are each moved once,
+ * those moving toward the front first and those moving toward the back from
+ * the last. The new headers and data are then written into the gaps. In a
+ * rewrite, everything is copied from the old archive into the new file
+ * instead, sharing blocks where the filesystem allows.
+ *
+ * Preconditions: ar is a handle to a valid archive that owns its member
+ * table, with maps each member to the index of the item replacing it,
+ * INDEX_DROP or INDEX_NONE, first is the index of the first member that isn't
+ * mapped to INDEX_NONE
+ *
+ * Postconditions: The replaced members hold their files and the member table
+ * records every member's new place, dropped members are left in the table
+ * with an offset of -1 for the caller to remove
+ *
+ * @param ar Handle of an open archive
+ * @param items Files replacing members, with headers
+ * @param with Item replacing each member
+ * @param first Index of the first replaced or dropped member
+ * @return true on success, false otherwise
+ */
+bool ar_replace_write(struct archive *ar, struct ar_append_item *items,
+		const size_t *with, size_t first);
 
-			return -1;
-		}
-	} else {
-		// Write a global header
-		if (ar_write_global_hdr(fd) == false) {
-			// Report error
-			fprintf(stderr, "Unable to write global header\n");
+/**
+ * @brief Hashes one file or member for a dedup-aware append.
+ *
+ * Tasks below the number of files hash a file, the rest hash a member. A file
+ * that can't be read is left for the append to report.
+ *
+ * Preconditions: ctx points to an ar_dedup_work
+ *
+ * Postconditions: The file's or member's hash has been set
+ *
+ * @param ctx Pointer to the shared ar_dedup_work
+ * @param task Index of the file or member
+ * @return true on success, false if a member couldn't be read
+ */
+bool ar_dedup_task(void *ctx, size_t task);
 
-			// Clean up
-			ar_close(fd);
+/**
+ * @brief Packs the files of a bulk append in parallel.
+ *
+ * Files that don't come out smaller are left to be stored as is.
+ *
+ * Preconditions: ar is a handle with a pack level that isn't thin, items
+ * holds count files that have headers and no packed files
+ *
+ * Postconditions: Each packed file's data is in its temporary file, and its
+ * size and header describe the packed member
+ *
+ * @param ar Handle of an open archive
+ * @param items Files to pack
+ * @param count Number of files
+ * @return true on success, false otherwise
+ */
+bool ar_pack_set(struct archive *ar, struct ar_append_item *items,
+		size_t count);
 
-			return -1;
-		}
-	}
+/**
+ * @brief Packs one file of a bulk append into a temporary file.
+ *
+ * Preconditions: ctx points to an ar_append_work
+ *
+ * Postconditions: The file has been packed if that made it smaller
+ *
+ * @param ctx Pointer to the shared ar_append_work
+ * @param task Index of the file
+ * @return true on success, false otherwise
+ */
+bool ar_pack_task(void *ctx, size_t task);
 
-	return fd;
-}
+/**
+ * @brief Closes the temporary files holding packed members.
+ *
+ * Preconditions: items holds count files
+ *
+ * Postconditions: No file has a packed copy
+ *
+ * @param items Files of a bulk append
+ * @param count Number of files
+ */
+void ar_pack_release(struct ar_append_item *items, size_t count);
 
-void ar_close(int fd) {
-	assert(fd >= 0);
+/**
+ * @brief Records that a member just added to the table was packed.
+ *
+ * Preconditions: member is in the member table, item is the file it was
+ * written from
+ *
+ * Postconditions: The member's unpacked size and hash are known
+ *
+ * @param member Member added for the file
+ * @param item File the member holds
+ */
+void ar_pack_note(struct ar_member *member, const struct ar_append_item *item);
 
-	if (close(fd) == -1) {
-		// Report error
+/**
+ * @brief Notices a packed member from the start of its data.
+ *
+ * Preconditions: member is in the member table of ar, data holds len bytes
+ * from the start of the member's data
+ *
+ * Postconditions: If the member is packed, its unpacked size and hash are
+ * known
+ *
+ * @param ar Handle of an open archive
+ * @param member Member to check
+ * @param data Start of the member's data
+ * @param len Number of bytes available
+ */
+void ar_pack_check(struct archive *ar, struct ar_member *member,
+		const uint8_t *data, size_t len);
+
+/**
+ * @brief Gets the size of a member's data as it would be extracted.
+ *
+ * Preconditions: member is in the member table of ar
+ *
+ * Postconditions:
+ *
+ * @param ar Handle of an open archive
+ * @param member Member to size
+ * @return The unpacked size of a packed member, the stored size otherwise
+ */
+off_t ar_full_size(struct archive *ar, struct ar_member *member);
+
+/**
+ * @brief Describes a member table entry for a library caller.
+ *
+ * Preconditions: member is in the member table of ar, entry is not NULL
+ *
+ * Postconditions: entry describes the member
+ *
+ * @param ar Handle of an open archive
+ * @param member Member to describe
+ * @param entry Location to describe the member in
+ */
+void ar_entry_fill(struct archive *ar, struct ar_member *member,
+		struct ar_entry *entry);
+
+/**
+ * @brief Appends files to an archive being written to a stream.
+ *
+ * Everything is written in order, padding included, with offsets tracked
+ * here rather than asked of the file. A symbol table can only lead the
+ * archive, so one is only written by the first append.
+ *
+ * Preconditions: ar is a handle to an archive being written to a stream,
+ * paths holds count null terminated paths
+ *
+ * Postconditions: The files have been written to the stream
+ *
+ * @param ar Handle of an open archive
+ * @param paths Paths of the files to append
+ * @param count Number of paths
+ * @return true on success, false otherwise
+ */
+bool ar_append_sink(struct archive *ar, const char **paths, size_t count);
+
+/**
+ * @brief Reads the symbols defined by one file of a bulk append.
+ *
+ * Symbols are recorded against the file's index in the append, to be moved
+ * to its member offset once that is known.
+ *
+ * Preconditions: ctx points to an ar_append_work with maps
+ *
+ * Postconditions: The file's symbols are in its entry of the work's maps
+ *
+ * @param ctx Pointer to the shared ar_append_work
+ * @param task Index of the file
+ * @return true on success, false otherwise
+ */
+bool ar_sink_symbols_task(void *ctx, size_t task);
+
+/**
+ * @brief Returns the full name of a member.
+ *
+ * Preconditions: ar is a handle to a valid archive, member is one of its
+ * members
+ *
+ * Postconditions:
+ *
+ * @param ar Handle of an open archive
+ * @param member Member to name
+ * @return The name from the long name table, or the name in the header
+ */
+const char *ar_full_name(struct archive *ar, struct ar_member *member);
+
+/**
+ * @brief Returns the number of bytes of a member's data kept in the archive.
+ *
+ * Preconditions: ar is a handle to a valid archive, member is one of its
+ * members
+ *
+ * Postconditions:
+ *
+ * @param ar Handle of an open archive
+ * @param member Member to measure
+ * @return Size of the member's data, or zero if it lives in its own file
+ */
+off_t ar_data_size(struct archive *ar, struct ar_member *member);
+
+/**
+ * @brief Reads the archive's long name table into memory.
+ *
+ * The table is one of the first two members when present.
+ *
+ * Preconditions: ar is a handle to a valid archive
+ *
+ * Postconditions: ar->long_names holds the table
+ *
+ * @param ar Handle of an open archive
+ * @return true on success, false otherwise
+ */
+bool ar_names_load(struct archive *ar);
+
+/**
+ * @brief Makes a long name table read from the archive the current one.
+ *
+ * Preconditions: ar is a handle to a valid archive, names was allocated with
+ * malloc() and holds size bytes of the table followed by room for one more
+ *
+ * Postconditions: ar owns names, which holds null terminated names
+ *
+ * @param ar Handle of an open archive
+ * @param names Table as stored in the archive
+ * @param size Size of the table
+ */
+void ar_names_take(struct archive *ar, char *names, size_t size);
+
+/**
+ * @brief Adds names to the long name table.
+ *
+ * Creates the table after the symbol table if there isn't one, and moves
+ * the members behind the table when it grows.
+ *
+ * Preconditions: ar is a handle to a valid archive, names holds count null
+ * terminated names, offsets has room for count offsets
+ *
+ * Postconditions: The names are in the table, offsets holds where
+ *
+ * @param ar Handle of an open archive
+ * @param names Names to add
+ * @param count Number of names
+ * @param offsets Location to store the offset of each name in the table
+ * @return true on success, false otherwise
+ */
+bool ar_names_add(struct archive *ar, const char **names, size_t count,
+		off_t *offsets);
+
+/**
+ * @brief Moves the most recently added member to another place in the table.
+ *
+ * Members from pos on move back one place to make room.
+ *
+ * Preconditions: ar is a handle to a valid archive, pos is less than the
+ * member count
+ *
+ * Postconditions: The last member is at pos, the rest keep their order
+ *
+ * @param ar Handle of an open archive
+ * @param pos Index to move the member to
+ * @return true on success, false otherwise
+ */
+bool ar_index_place(struct archive *ar, size_t pos);
+
+/**
+ * @brief Returns the archive's symbol table member.
+ *
+ * Preconditions: ar is a handle to a valid archive
+ *
+ * Postconditions:
+ *
+ * @param ar Handle of an open archive
+ * @return The symbol table member, or NULL if the archive has none
+ */
+struct ar_member *ar_armap_member(struct archive *ar);
+
+/**
+ * @brief Reads the archive's symbol table into memory.
+ *
+ * Preconditions: ar is a handle to a valid archive
+ *
+ * Postconditions: ar->armap holds the archive's symbols
+ *
+ * @param ar Handle of an open archive
+ * @return true on success, false otherwise
+ */
+bool ar_armap_load(struct archive *ar);
+
+/**
+ * @brief Reads the symbols defined by a run of members, in parallel.
+ *
+ * Preconditions: ar is a handle to a valid archive, first is no greater than
+ * last, last is no greater than the member count, map has been initialized
+ *
+ * Postconditions: The symbols have been added to map in archive order
+ *
+ * @param ar Handle of an open archive
+ * @param first Index of the first member to read
+ * @param last Index one past the last member to read
+ * @param map Symbol table to add to
+ * @return true on success, false otherwise
+ */
+bool ar_armap_scan(struct archive *ar, size_t first, size_t last,
+		struct armap *map);
+
+/**
+ * @brief Reads the symbols defined by one member.
+ *
+ * Preconditions: ctx points to an ar_armap_work
+ *
+ * Postconditions: The member's symbols are in its entry of the work's maps
+ *
+ * @param ctx Pointer to the shared ar_armap_work
+ * @param task Index of the member, counted from the work's first member
+ * @return true on success, false otherwise
+ */
+bool ar_armap_task(void *ctx, size_t task);
+
+/**
+ * @brief Adds the symbols of newly appended members to the symbol table.
+ *
+ * The first members to define symbols cause the table to be created, and
+ * the members already in the archive to be read along with them.
+ *
+ * Preconditions: ar is a handle to a valid archive, members from first on
+ * have just been appended
+ *
+ * Postconditions: The archive's symbol table covers every member
+ *
+ * @param ar Handle of an open archive
+ * @param first Index of the first new member
+ * @return true on success, false otherwise
+ */
+bool ar_armap_update(struct archive *ar, size_t first);
+
+/**
+ * @brief Reads the symbol table afresh from every member.
+ *
+ * Used when the table in the archive can't be carried through a change, such
+ * as one written by another tool that names offsets no member starts at.
+ *
+ * Preconditions: ar is a handle to a valid archive
+ *
+ * Postconditions: ar->armap holds the symbols every member defines
+ *
+ * @param ar Handle of an open archive
+ * @return true on success, false otherwise
+ */
+bool ar_armap_rebuild(struct archive *ar);
+
+/**
+ * @brief Writes the in memory symbol table to the archive.
+ *
+ * The table member is given spare room, so most updates rewrite it in place.
+ * Only when it outgrows that room are the members behind it moved.
+ *
+ * Preconditions: ar is a handle to a valid archive, ar->armap is current
+ *
+ * Postconditions: The archive's first member is the symbol table
+ *
+ * @param ar Handle of an open archive
+ * @return true on success, false otherwise
+ */
+bool ar_armap_write(struct archive *ar);
+
+/**
+ * @brief Sizes the space given to a new symbol table member.
+ *
+ * Preconditions:
+ *
+ * Postconditions:
+ *
+ * @param size Size the table needs
+ * @return Size of the member, with room for the table to grow in place
+ */
+size_t ar_armap_room(size_t size);
+
+/**
+ * @brief Fills an ar header for a file.
+ *
+ * Preconditions: hdr is not NULL, path is not NULL, st is not NULL, st holds
+ * the status of the file at path
+ *
+ * Postconditions: hdr describes the file
+ *
+ * @param hdr Pointer to ar_hdr to fill
+ * @param path Path of the file, used as the member name
+ * @param st Status of the file
+ * @return true on success, false if the file is too large for the header
+ */
+bool ar_make_hdr(struct ar_hdr *hdr, const char *path, struct stat *st);
+
+/**
+ * @brief Orders pointers to members by their offset in the archive.
+ *
+ * Preconditions: a and b point to pointers to members
+ *
+ * Postconditions:
+ *
+ * @param a Pointer to the first member pointer
+ * @param b Pointer to the second member pointer
+ * @return Negative, zero or positive as a is before, at or after b
+ */
+int ar_member_cmp_offset(const void *a, const void *b);
+
+/**
+ * @brief Builds the member table by reading each header in the archive.
+ *
+ * Headers are walked in a window read from the archive, so runs of small
+ * members cost one read per window rather than one per member.
+ *
+ * Preconditions: ar is a handle with a valid file descriptor, the member table
+ * is empty
+ *
+ * Postconditions: The member table holds every member of the archive
+ *
+ * @param ar Handle of an open archive
+ * @return true on success, false otherwise
+ */
+bool ar_index_build(struct archive *ar);
+
+/**
+ * @brief Maps the member index file in place of scanning the archive.
+ *
+ * Preconditions: ar is a handle with a valid file descriptor and index path,
+ * the member table is empty
+ *
+ * Postconditions: If the index file matches the archive, the member table
+ * lives in a private mapping of it
+ *
+ * @param ar Handle of an open archive
+ * @return true if the index file was used, false otherwise
+ */
+bool ar_index_load(struct archive *ar);
+
+/**
+ * @brief Describes how this build lays out the member table.
+ *
+ * The sizes of the types the table is made of and the offset of its last
+ * field are packed into one number, which differs between ABIs whose tables
+ * can't be read in place by each other.
+ *
+ * Preconditions: None
+ *
+ * Postconditions: None
+ *
+ * @return The layout of the member table
+ */
+uint64_t ar_index_abi(void);
+
+/**
+ * @brief Writes the member table to the member index file.
+ *
+ * Preconditions: ar is a handle to a valid archive, no writes to the archive
+ * are pending
+ *
+ * Postconditions: The index file holds the member table and the archive's
+ * current size and modification time
+ *
+ * @param ar Handle of an open archive
+ * @return true on success, false otherwise
+ */
+bool ar_index_save(struct archive *ar);
+
+/**
+ * @brief Moves a mapped member table into memory that can be changed.
+ *
+ * Preconditions: ar is a handle to a valid archive
+ *
+ * Postconditions: The member table no longer lives in the index file mapping
+ *
+ * @param ar Handle of an open archive
+ * @return true on success, false otherwise
+ */
+bool ar_index_own(struct archive *ar);
+
+/**
+ * @brief Decodes a header and adds the member to the member table.
+ *
+ * Preconditions: ar is a handle to a valid archive, hdr is not NULL, hdr is a
+ * valid ar header
+ *
+ * Postconditions: The member has been added to the end of the member table
+ *
+ * @param ar Handle of an open archive
+ * @param hdr Header of the member
+ * @param offset Offset of the header in the archive
+ * @return true on success, false otherwise
+ */
+bool ar_index_add(struct archive *ar, struct ar_hdr *hdr, off_t offset);
+
+/**
+ * @brief Rebuilds the hash chains of the member table.
+ *
+ * Preconditions: ar is a handle to a valid archive
+ *
+ * Postconditions: Every member in the table can be found by name
+ *
+ * @param ar Handle of an open archive
+ * @return true on success, false otherwise
+ */
+bool ar_index_rehash(struct archive *ar);
+
+/**
+ * @brief Looks up the first member with a given name.
+ *
+ * Preconditions: ar is a handle to a valid archive, name is not NULL
+ *
+ * Postconditions:
+ *
+ * @param ar Handle of an open archive
+ * @param name Name of the member to find
+ * @return Pointer to the member's table entry, NULL if there is no such member
+ */
+struct ar_member *ar_index_find(struct archive *ar, const char *name);
+
+/**
+ * @brief Converts a mode integer to an ASCII permissions string.
+ *
+ * Preconditions: str is not NULL, str is an allocated buffer of size SFMODE
+ *
+ * Postconditions: Permissions string has been loaded into str
+ *
+ * @param mode File mode integer
+ * @param str Character array of size SFMODE to load permissions string into
+ */
+void ar_mode_str(mode_t mode, char *str);
+
+/**
+ * @brief Tells whether a member name belongs to a special member.
+ *
+ * Special members hold the symbol table or long names and aren't files.
+ *
+ * Preconditions: name is not NULL
+ *
+ * Postconditions:
+ *
+ * @param name Null terminated member name
+ * @return true if the member is special, false otherwise
+ */
+bool ar_is_special(const char *name);
+
+/**
+ * @brief Copies a range of bytes from one file to another.
+ *
+ * Data is moved through a fixed size buffer of COPY_SIZE bytes, so memory use
+ * does not depend on size.
+ *
+ * Preconditions: in_fd and out_fd are valid file descriptors, the size bytes
+ * following from exist in in_fd
+ *
+ * Postconditions: The size bytes following from in in_fd have been written to
+ * out_fd at to
+ *
+ * @param in_fd File descriptor to read from
+ * @param from File offset to read from
+ * @param out_fd File descriptor to write to
+ * @param to File offset to write to
+ * @param size Number of bytes to copy
+ * @return true on success, false otherwise
+ */
+bool ar_copy_range(int in_fd, off_t from, int out_fd, off_t to, off_t size);
+
+/**
+ * @brief Copies a range of bytes between two files without passing the data
+ * through user space where possible.
+ *
+ * Tries copy_file_range(), then sendfile(), then writing from a mapping of the
+ * source, and finishes with a buffered copy for anything left. sendfile()
+ * writes at the output's file pointer, so it is skipped when other threads
+ * are writing to out_fd at the same time.
+ *
+ * Preconditions: in_fd and out_fd are valid file descriptors of different
+ * files
+ *
+ * Postconditions: The size bytes following from in in_fd have been written to
+ * out_fd at to, unless in_fd ends before them
+ *
+ * @param in_fd File descriptor to read from
+ * @param from File offset to read from
+ * @param out_fd File descriptor to write to
+ * @param to File offset to write to
+ * @param size Number of bytes to copy
+ * @param shared true if other threads may be writing to out_fd
+ * @return true on success, false otherwise
+ */
+bool ar_send_range(int in_fd, off_t from, int out_fd, off_t to, off_t size,
+		bool shared);
+
+/**
+ * @brief Moves a range of bytes toward the front of a file.
+ *
+ * Uses copy_file_range() where the kernel supports it and falls back to a
+ * buffered copy otherwise.
+ *
+ * Preconditions: fd is a valid file descriptor, to is less than from, the size
+ * bytes following from exist in the file
+ *
+ * Postconditions: The size bytes that followed from now follow to, bytes
+ * between the end of the moved range and from + size are unspecified
+ *
+ * @param fd File descriptor of the file
+ * @param from File offset to move from
+ * @param to File offset to move to
+ * @param size Number of bytes to move
+ * @return true on success, false otherwise
+ */
+bool ar_move_range(int fd, off_t from, off_t to, off_t size);
+
+/**
+ * @brief Moves a range of bytes toward the back of a file.
+ *
+ * Works back from the end of the range so nothing is overwritten before it
+ * has been moved. Uses copy_file_range() where the kernel supports it and
+ * falls back to a buffered copy otherwise.
+ *
+ * Preconditions: fd is a valid file descriptor, to is greater than from, the
+ * size bytes following from exist in the file
+ *
+ * Postconditions: The size bytes that followed from now follow to, bytes
+ * between from and the start of the moved range are unspecified
+ *
+ * @param fd File descriptor of the file
+ * @param from File offset to move from
+ * @param to File offset to move to
+ * @param size Number of bytes to move
+ * @return true on success, false otherwise
+ */
+bool ar_shift_range(int fd, off_t from, off_t to, off_t size);
+
+/**
+ * @brief Hashes a range of a file.
+ *
+ * Preconditions: fd is a valid file descriptor, hash is not NULL
+ *
+ * Postconditions: hash holds the hash of the range
+ *
+ * @param fd File to read
+ * @param from Offset of the range
+ * @param size Size of the range
+ * @param hash Location to store the hash in
+ * @return true on success, false if the range couldn't be read
+ */
+bool ar_hash_range(int fd, off_t from, off_t size, uint64_t *hash);
+
+/**
+ * @brief Removes a range of bytes from a file without copying what follows.
+ *
+ * Uses fallocate() with FALLOC_FL_COLLAPSE_RANGE, which only succeeds for
+ * ranges aligned to filesystem blocks on filesystems that support it.
+ * Members are only aligned to two bytes, so a gap left by deleted members is
+ * rarely whole blocks and this nearly always fails. Collapsing just the
+ * aligned middle of a gap would gain nothing, since everything behind it
+ * would still have to be copied down by the rest of the gap.
+ *
+ * Preconditions: fd is a valid file descriptor, the range ends before the end
+ * of the file
+ *
+ * Postconditions: If successful, the len bytes following offset have been
+ * removed and everything after them has moved len bytes toward the front
+ *
+ * @param fd File descriptor of the file
+ * @param offset File offset of the range to remove
+ * @param len Number of bytes to remove
+ * @return true if the range was removed, false if the file is unchanged
+ */
+bool ar_collapse_range(int fd, off_t offset, off_t len);
+
+/**
+ * @brief Copies a range of bytes between two files, sharing their blocks
+ * where the filesystem allows.
+ *
+ * FICLONERANGE shares whole blocks on filesystems with reflinks, but only
+ * where both offsets sit equally far into a block. Whatever can't be shared
+ * is copied with ar_send_range(), whose copy_file_range() may still share
+ * blocks on such filesystems.
+ *
+ * Preconditions: in_fd and out_fd are valid file descriptors of different
+ * files, the size bytes following from exist in in_fd, nothing else is
+ * writing to out_fd
+ *
+ * Postconditions: The size bytes following from in in_fd have been written to
+ * out_fd at to
+ *
+ * @param in_fd File descriptor to read from
+ * @param from File offset to read from
+ * @param out_fd File descriptor to write to
+ * @param to File offset to write to
+ * @param size Number of bytes to copy
+ * @return true on success, false otherwise
+ */
+bool ar_clone_range(int in_fd, off_t from, int out_fd, off_t to, off_t size);
+
+/**
+ * @brief Read data from a file in chunks of BLOCK_SIZE bytes.
+ *
+ * Preconditions: fd is a valid file descriptor, buf is not NULL,
+ * buf is a buffer of size size, from is between zero and the
+ * size of the file - size
+ *
+ * Postconditions: The size bytes following from are loaded into buf, the
+ * file pointer is unchanged
+ *
+ * @param fd File descriptor to read from
+ * @param buf Buffer to read to
+ * @param from File offset to read from
+ * @param size Number of bytes to read
+ * @return true on success, false otherwise
+ */
+bool block_read(int fd, uint8_t *buf, off_t from, size_t size);
+
+/**
+ * @brief Write data to a file in chunks of BLOCK_SIZE bytes.
+ *
+ * Preconditions: fd is a valid file descriptor, buf is not NULL,
+ * buf is a buffer of size size
+ *
+ * Postconditions: The first size bytes in buf are written to the file
+ * at to, the file pointer is unchanged
+ *
+ * @param fd File descriptor to write to
+ * @param buf Buffer to write from
+ * @param from File offset to write to
+ * @param size Number of bytes to write
+ * @return true on success, false otherwise
+ */
+bool block_write(int fd, uint8_t *buf, off_t to, size_t size);
+
+struct archive *ar_open(const char *path) {
+	struct archive *ar;
+	int prev;
+
+	prev = STATS_ENTER(STATS_PHASE_OPEN);
+	ar = ar_open_file(path);
+	STATS_LEAVE(prev);
+
+	return ar;
+}
+
+struct archive *ar_open_file(const char *path) {
+	struct archive *ar;
+	struct stat st;
+	bool ok;
+	const char *slash;
+	char *dir;
+	bool create;
+
+	assert(path);
+
+	// Are we creating the file?
+	if (stat(path, &st) == 0) {
+		create = false;
+	} else {
+		create = true;
+	}
+
+	ar = (struct archive *)calloc(1, sizeof(struct archive));
+	if (ar == NULL) {
+		perror(NULL);
+		return NULL;
+	}
+
+	ar->jobs = 1;
+	ar->armap_wanted = true;
+	armap_init(&ar->armap);
+
+	ar->index_path = (char *)malloc(strlen(path) + strlen(INDEX_SUFFIX) + 1);
+	if (ar->index_path == NULL) {
+		perror(NULL);
+		free(ar);
+		return NULL;
+	}
+
+	strcpy(ar->index_path, path);
+	strcat(ar->index_path, INDEX_SUFFIX);
+
+	ar->path = strdup(path);
+	if (ar->path == NULL) {
+		perror(NULL);
+		free(ar->index_path);
+		free(ar);
+		return NULL;
+	}
+
+	// Thin archive members are found relative to the archive
+	slash = strrchr(path, '/');
+	if (slash == NULL) {
+		dir = strdup(".");
+	} else {
+		dir = strndup(path, (slash == path) ? 1 : (size_t)(slash - path));
+	}
+
+	if (dir == NULL) {
+		perror(NULL);
+		free(ar->index_path);
+		free(ar->path);
+		free(ar);
+		return NULL;
+	}
+
+	ar->dir_fd = open(dir, O_PATH | O_DIRECTORY);
+	STATS_IO(STATS_OPEN, 0, 0);
+	free(dir);
+	
+	ar->fd = open(path, O_RDWR | O_CREAT, DEFAULT_PERMS);
+	STATS_IO(STATS_OPEN, 0, 0);
+	if (ar->fd == -1) {
+		// Report error
+		fprintf(stderr, "File (%s) could not be opened\n", path);
+
+		// Clean up
+		if (ar->dir_fd != -1) {
+			close(ar->dir_fd);
+		}
+
+		free(ar->index_path);
+		free(ar->path);
+		free(ar);
+
+		return NULL;
+	}
+
+	lseek(ar->fd, 0, SEEK_SET);
+
+	if (create == false) {
+		// Verify that the archive is valid
+		if (!ar_check_global_hdr(ar->fd, &ar->thin)) {
+			// Report error
+			fprintf(stderr, "Bad global header\n");
+
+			// Clean up
+			ar_close(ar);
+
+			return NULL;
+		}
+	} else {
+		// Write a global header
+		if (ar_write_global_hdr(ar->fd, false) == false) {
+			// Report error
+			fprintf(stderr, "Unable to write global header\n");
+
+			// Clean up
+			ar_close(ar);
+
+			return NULL;
+		}
+	}
+
+	// Use the index file if it is current, otherwise read every header once
+	// so lookups don't have to scan the archive
+	STATS_ENTER(STATS_PHASE_SCAN);
+	ok = ar_index_load(ar) ? ar_names_load(ar) : ar_index_build(ar);
+	STATS_ENTER(STATS_PHASE_OPEN);
+	if (ok == false) {
+		// Report error
+		fprintf(stderr, "Could not read archive members\n");
+
+		// Clean up
+		ar_close(ar);
+
+		return NULL;
+	}
+
+	return ar;
+}
+
+struct archive *ar_open_stream(int fd) {
+	struct archive *ar;
+	uint8_t magic[SARMAG];
+	int prev;
+
+	assert(fd >= 0);
+
+	ar = (struct archive *)calloc(1, sizeof(struct archive));
+	if (ar == NULL) {
+		perror(NULL);
+		return NULL;
+	}
+
+	prev = STATS_ENTER(STATS_PHASE_OPEN);
+	ar->fd = fd;
+	ar->jobs = 1;
+	ar->stream = true;
+	armap_init(&ar->armap);
+
+	// Thin member paths can only be taken relative to where we are
+	ar->dir_fd = open(".", O_PATH | O_DIRECTORY);
+	STATS_IO(STATS_OPEN, 0, 0);
+
+	// Verify that the archive is valid
+	if ((stream_read(fd, magic, SARMAG) != SARMAG) ||
+			((memcmp(magic, ARMAG, SARMAG) != 0) &&
+			(memcmp(magic, THINMAG, SARMAG) != 0))) {
+		// Report error
+		fprintf(stderr, "Bad global header\n");
+
+		// Clean up
+		STATS_LEAVE(prev);
+		ar_close(ar);
+
+		return NULL;
+	}
+
+	ar->thin = (memcmp(magic, THINMAG, SARMAG) == 0);
+	ar->size = SARMAG;
+	STATS_LEAVE(prev);
+
+	return ar;
+}
+
+struct archive *ar_create_stream(int fd) {
+	struct archive *ar;
+
+	assert(fd >= 0);
+
+	ar = (struct archive *)calloc(1, sizeof(struct archive));
+	if (ar == NULL) {
+		perror(NULL);
+		return NULL;
+	}
+
+	ar->fd = fd;
+	ar->jobs = 1;
+	ar->sink = true;
+	ar->armap_wanted = true;
+	ar->dir_fd = -1;
+	armap_init(&ar->armap);
+
+	if (stream_write(fd, (const uint8_t *)ARMAG, SARMAG) == false) {
+		// Report error
+		fprintf(stderr, "Unable to write global header\n");
+
+		// Clean up
+		ar_close(ar);
+
+		return NULL;
+	}
+
+	ar->size = SARMAG;
+
+	return ar;
+}
+
+void ar_close(struct archive *ar) {
+	int prev;
+
+	assert(ar != NULL);
+	assert(ar->fd >= 0);
+
+	prev = STATS_ENTER(STATS_PHASE_SYNC);
+
+	// Bring the index file up to date
+	if (ar->index_wanted && (ar->index_fresh == false) &&
+			(ar->stream == false) && (ar->sink == false)) {
+		ar_index_save(ar);
+	}
+
+	if (close(ar->fd) == -1) {
+		// Report error
 		fprintf(stderr, "File could not be closed\n");
 	}
+
+	if (ar->ring != NULL) {
+		uring_close(ar->ring);
+	}
+
+	if (ar->dir_fd != -1) {
+		close(ar->dir_fd);
+	}
+
+	if (ar->index_map != NULL) {
+		munmap(ar->index_map, ar->index_map_size);
+	} else {
+		free(ar->members);
+		free(ar->buckets);
+	}
+
+	armap_free(&ar->armap);
+	free(ar->long_names);
+	free(ar->index_path);
+	free(ar->path);
+	free(ar);
+
+	STATS_LEAVE(prev);
+}
+
+void ar_keep_index(struct archive *ar) {
+	assert(ar != NULL);
+
+	ar->index_wanted = true;
+}
+
+bool ar_make_thin(struct archive *ar) {
+	assert(ar != NULL);
+
+	if (ar->thin) {
+		return true;
+	}
+
+	if (ar->stream || ar->sink) {
+		fprintf(stderr, "Can't make a streamed archive thin\n");
+		return false;
+	}
+
+	// Members already copied in can't be turned into references
+	if (ar->count > 0) {
+		fprintf(stderr, "Can't make an archive with members thin\n");
+		return false;
+	}
+
+	if (ar->dir_fd == -1) {
+		fprintf(stderr, "Can't find the archive's directory\n");
+		return false;
+	}
+
+	if (ar_write_global_hdr(ar->fd, true) == false) {
+		fprintf(stderr, "Unable to write global header\n");
+		return false;
+	}
+
+	ar->thin = true;
+	ar->index_fresh = false;
+
+	return true;
+}
+
+void ar_skip_symtab(struct archive *ar) {
+	assert(ar != NULL);
+
+	ar->armap_wanted = false;
+}
+
+void ar_skip_duplicates(struct archive *ar) {
+	assert(ar != NULL);
+
+	ar->dedup = true;
+}
+
+void ar_set_compression(struct archive *ar, int level) {
+	assert(ar != NULL);
+	assert((level >= 0) && (level <= 9));
+
+	ar->pack_level = level;
+}
+
+void ar_set_jobs(struct archive *ar, unsigned int jobs) {
+	assert(ar != NULL);
+
+	ar->jobs = (jobs == 0) ? 1 : jobs;
+}
+
+bool ar_use_uring(struct archive *ar, unsigned int depth) {
+	assert(ar != NULL);
+	assert(depth > 0);
+
+	if (ar->ring != NULL) {
+		uring_close(ar->ring);
+	}
+
+	ar->ring = uring_open(depth);
+
+	return ar->ring != NULL;
+}
+
+bool ar_append(struct archive *ar, const char *path) {
+	assert(ar != NULL);
+	assert(path != NULL);
+
+	return ar_append_set(ar, &path, 1);
+}
+
+bool ar_append_set(struct archive *ar, const char **paths, size_t count) {
+	struct ar_append_work work;
+	struct ar_append_item *items;
+	off_t start;
+	off_t pos;
+	size_t nitems;
+	size_t first;
+	size_t i;
+	bool written;
+	bool ok;
+	int copy;
+
+	assert(ar != NULL);
+	assert(paths != NULL);
+
+	if (ar->stream) {
+		fprintf(stderr, "Can't change an archive read from a stream\n");
+		return false;
+	}
+
+	// Nothing can be taken back from a stream, so it is written in order
+	if (ar->sink) {
+		return ar_append_sink(ar, paths, count);
+	}
+
+	if (count == 0) {
+		return true;
+	}
+
+	items = (struct ar_append_item *)malloc(count * sizeof(struct ar_append_item));
+	if (items == NULL) {
+		perror(NULL);
+		return false;
+	}
+
+	// Lay out every member before writing anything
+	ok = true;
+	start = lseek(ar->fd, 0, SEEK_END);
+	pos = start;
+	nitems = 0;
+	for (i = 0; i < count; i++) {
+		struct ar_append_item *item = &items[nitems];
+
+		assert(paths[i] != NULL);
+
+		if (stat(paths[i], &item->st) == -1) {
+			fprintf(stderr, "Failed to add %s to archive\n", paths[i]);
+			ok = false;
+			continue;
+		}
+
+		if (ar_make_hdr(&item->hdr, paths[i], &item->st) == false) {
+			fprintf(stderr, "%s is too large for an archive\n", paths[i]);
+			ok = false;
+			continue;
+		}
+
+		item->path = paths[i];
+		item->packed_fd = -1;
+		item->unpacked = -1;
+		nitems++;
+	}
+
+	// Thin members only refer to their files, so there is no data to share
+	// or pack
+	if (ar->dedup && (ar->thin == false) &&
+			(ar_append_dedup(ar, items, &nitems) == false)) {
+		free(items);
+		return false;
+	}
+
+	if ((ar->pack_level > 0) && (ar->thin == false) &&
+			(ar_pack_set(ar, items, nitems) == false)) {
+		free(items);
+		return false;
+	}
+
+	for (i = 0; i < nitems; i++) {
+		struct ar_append_item *item = &items[i];
+
+		// Members start on an even byte boundary
+		item->pad = ((pos % 2) == 1);
+		if (item->pad) {
+			pos++;
+		}
+
+		item->offset = pos;
+
+		pos += sizeof(struct ar_hdr) + item->st.st_size;
+	}
+
+	// Thin archives only take headers
+	if (ar->thin) {
+		if (ar_append_thin(ar, items, nitems) == false) {
+			ok = false;
+		}
+
+		free(items);
+		return ok;
+	}
+
+	// Reserve the space up front, the filesystem may not support it
+	if ((pos > start) && (fallocate(ar->fd, 0, start, pos - start) == -1)) {
+		if ((errno == ENOSPC) || (ftruncate(ar->fd, pos) == -1)) {
+			perror("Could not grow archive");
+			ar_pack_release(items, nitems);
+			free(items);
+			return false;
+		}
+	}
+
+	// Every member has its own place in the file, so they can be filled in
+	// by separate threads or all at once through the ring. The ring opens
+	// files by path, so packed members go through the threads.
+	work.ar = ar;
+	work.items = items;
+	work.maps = NULL;
+	copy = STATS_ENTER(STATS_PHASE_COPY);
+	if ((ar->ring != NULL) && (ar->pack_level == 0)) {
+		written = ar_append_uring(ar, items, nitems);
+	} else {
+		written = pool_run(nitems, ar->jobs, ar_append_task, &work);
+	}
+
+	STATS_LEAVE(copy);
+
+	ar_pack_release(items, nitems);
+
+	if (written == false) {
+		// Don't leave holes in the archive
+		fprintf(stderr, "Could not append files, archive left unchanged\n");
+		if (ftruncate(ar->fd, start) == -1) {
+			perror("Could not truncate archive");
+		}
+
+		free(items);
+		return false;
+	}
+
+	ar->size = pos;
+
+	// Keep the member table current
+	first = ar->count;
+	for (i = 0; i < nitems; i++) {
+		if (ar_index_add(ar, &items[i].hdr, items[i].offset) == false) {
+			free(items);
+			return false;
+		}
+
+		ar_pack_note(&ar->members[ar->count - 1], &items[i]);
+	}
+
+	free(items);
+
+	// Then the symbol table
+	return ar_armap_update(ar, first) && ok;
+}
+
+bool ar_remove(struct archive *ar, const char *name) {
+	assert(ar != NULL);
+	assert(name != NULL);
+
+	return ar_remove_set(ar, &name, 1);
+}
+
+bool ar_remove_set(struct archive *ar, const char **names, size_t count) {
+	uint64_t *old_offsets;
+	uint64_t *new_offsets;
+	bool *drop;
+	off_t collapsed;
+	off_t pos;
+	size_t first;
+	size_t kept;
+	size_t i;
+	bool rebuild;
+	bool ok;
+
+	assert(ar != NULL);
+	assert(names != NULL);
+
+	if (ar->stream) {
+		fprintf(stderr, "Can't change an archive read from a stream\n");
+		return false;
+	}
+
+	if (ar->sink) {
+		fprintf(stderr, "Can't read an archive being written to a stream\n");
+		return false;
+	}
+
+	if (count == 0) {
+		return true;
+	}
+
+	drop = (bool *)calloc(ar->count + 1, sizeof(bool));
+	if (drop == NULL) {
+		perror(NULL);
+		return false;
+	}
+
+	ok = ar_remove_mark(ar, names, count, drop);
+
+	// Build the archive anew beside the old one where it can be renamed into
+	// place, otherwise close the gaps in place
+	if (ar_rewrite_usable(ar)) {
+		ok = ar_replace_run(ar, drop, NULL, 0, false, NULL, 0) && ok;
+		free(drop);
+		return ok;
+	}
+
+	if (ar_index_own(ar) == false) {
+		free(drop);
+		return false;
+	}
+
+	// Nothing before the first removed member moves
+	for (first = 0; (first < ar->count) && (drop[first] == false); first++);
+
+	if (first == ar->count) {
+		free(drop);
+		return ok;
+	}
+
+	// Remember where every member was, so the symbol table can follow them
+	old_offsets = NULL;
+	new_offsets = NULL;
+	rebuild = false;
+	if (ar_armap_member(ar) != NULL) {
+		old_offsets = (uint64_t *)malloc(ar->count * sizeof(uint64_t));
+		new_offsets = (uint64_t *)malloc(ar->count * sizeof(uint64_t));
+		if ((old_offsets == NULL) || (new_offsets == NULL) ||
+				(ar_armap_load(ar) == false)) {
+			if ((old_offsets == NULL) || (new_offsets == NULL)) {
+				perror(NULL);
+			}
+
+			free(old_offsets);
+			free(new_offsets);
+			free(drop);
+			return false;
+		}
+
+		for (i = 0; i < ar->count; i++) {
+			old_offsets[i] = ar->members[i].offset;
+		}
+	}
+
+	// Slide each surviving member down over the gap left by removed ones
+	pos = ar->members[first].offset;
+	collapsed = 0;
+	kept = first;
+	for (i = first; i < ar->count; i++) {
+		struct ar_member *member = &ar->members[i];
+		off_t from;
+		off_t size;
+
+		// Remove the member?
+		if (drop[i]) {
+			continue;
+		}
+
+		// Write a newline if we're not on an even byte boundary
+		if ((pos % 2) == 1) {
+			STATS_IO(STATS_WRITE, 0, sizeof(char));
+			if (pwrite(ar->fd, "\n", sizeof(char), pos) == -1) {
+				perror("Write error");
+				break;
+			}
+
+			pos++;
+		}
+
+		// Close the gap by dropping it from the file if it happens to be
+		// whole filesystem blocks, otherwise copy the member down into it
+		from = member->offset - collapsed;
+		size = sizeof(struct ar_hdr) + ar_data_size(ar, member);
+		if ((from > pos) && ar_collapse_range(ar->fd, pos, from - pos)) {
+			collapsed += from - pos;
+		} else if ((from > pos) &&
+				(ar_move_range(ar->fd, from, pos, size) == false)) {
+			break;
+		}
+
+		// Record where the member now lives
+		member->offset = pos;
+		ar->members[kept++] = *member;
+		pos += size;
+	}
+
+	if (i < ar->count) {
+		// Members past the failure are in an unknown state
+		fprintf(stderr, "Archive may be corrupt\n");
+		ar->count = kept;
+		ar_index_rehash(ar);
+		free(old_offsets);
+		free(new_offsets);
+		free(drop);
+		return false;
+	}
+
+	// Point symbols at the members' new homes and forget removed ones
+	if (old_offsets != NULL) {
+		size_t k = 0;
+
+		for (i = 0; i < ar->count; i++) {
+			new_offsets[i] = drop[i] ? ARMAP_DROPPED :
+					(uint64_t)ar->members[k++].offset;
+		}
+
+		rebuild = (armap_relocate(&ar->armap, old_offsets, new_offsets,
+				ar->count) == false);
+	}
+
+	free(drop);
+
+	ar->count = kept;
+
+	// Drop the old tail
+	if (ftruncate(ar->fd, pos) == -1) {
+		perror("Could not truncate archive");
+		ok = false;
+	}
+
+	ar->size = pos;
+
+	if (ar_index_rehash(ar) == false) {
+		ok = false;
+	} else if ((old_offsets != NULL) && ((rebuild &&
+			(ar_armap_rebuild(ar) == false)) || (ar_armap_write(ar) == false))) {
+		ok = false;
+	}
+
+	free(old_offsets);
+	free(new_offsets);
+
+	return ok;
+}
+
+bool ar_remove_mark(struct archive *ar, const char **names, size_t count,
+		bool *drop) {
+	size_t i;
+	bool ok;
+
+	assert(ar != NULL);
+	assert((names != NULL) || (count == 0));
+	assert(drop != NULL);
+
+	// Mark every member carrying one of the names
+	ok = true;
+	for (i = 0; i < count; i++) {
+		bool found = false;
+		size_t j;
+
+		assert(names[i] != NULL);
+
+		if ((ar->nbuckets > 0) && (ar_is_special(names[i]) == false)) {
+			j = ar->buckets[hash_name(names[i]) & (ar->nbuckets - 1)];
+			while (j < ar->count) {
+				if (strcmp(ar_full_name(ar, &ar->members[j]), names[i]) == 0) {
+					drop[j] = true;
+					found = true;
+				}
+
+				j = ar->members[j].next;
+			}
+		}
+
+		if (found == false) {
+			printf("File %s not found in archive\n", names[i]);
+			ok = false;
+		}
+	}
+
+	return ok;
+}
+
+bool ar_replace_set(struct archive *ar, const char **paths, size_t count,
+		bool newer) {
+	assert(ar != NULL);
+	assert(paths != NULL);
+
+	if (ar->stream) {
+		fprintf(stderr, "Can't change an archive read from a stream\n");
+		return false;
+	}
+
+	if (ar->sink) {
+		fprintf(stderr, "Can't read an archive being written to a stream\n");
+		return false;
+	}
+
+	return ar_replace_run(ar, NULL, paths, count, newer, NULL, 0);
+}
+
+bool ar_apply_set(struct archive *ar, const char **removed, size_t nremoved,
+		const char **replaced, size_t nreplaced, const char **added,
+		size_t nadded) {
+	bool *drop;
+	bool ok;
+
+	assert(ar != NULL);
+	assert((removed != NULL) || (nremoved == 0));
+	assert((replaced != NULL) || (nreplaced == 0));
+	assert((added != NULL) || (nadded == 0));
+
+	if (ar->stream) {
+		fprintf(stderr, "Can't change an archive read from a stream\n");
+		return false;
+	}
+
+	// Nothing can be taken back from a stream, only appended
+	if (ar->sink) {
+		if ((nremoved > 0) || (nreplaced > 0)) {
+			fprintf(stderr, "Can't read an archive being written to a stream\n");
+			return false;
+		}
+
+		return (nadded == 0) || ar_append_set(ar, added, nadded);
+	}
+
+	drop = (bool *)calloc(ar->count + 1, sizeof(bool));
+	if (drop == NULL) {
+		perror(NULL);
+		return false;
+	}
+
+	ok = ar_remove_mark(ar, removed, nremoved, drop);
+	ok = ar_replace_run(ar, drop, replaced, nreplaced, false, added, nadded) &&
+			ok;
+
+	free(drop);
+
+	return ok;
+}
+
+bool ar_replace_run(struct archive *ar, const bool *drop, const char **paths,
+		size_t count, bool newer, const char **added, size_t nadded) {
+	struct ar_append_item *items;
+	const char **appended;
+	uint64_t *old_offsets;
+	uint64_t *new_offsets;
+	size_t *with;
+	size_t nappended;
+	size_t first;
+	size_t kept;
+	size_t i;
+	bool rewriting;
+	bool rebuild;
+	bool ok;
+
+	assert(ar != NULL);
+	assert((paths != NULL) || (count == 0));
+	assert((added != NULL) || (nadded == 0));
+
+	rebuild = false;
+
+	items = (struct ar_append_item *)malloc((count + 1) *
+			sizeof(struct ar_append_item));
+	appended = (const char **)malloc((count + nadded + 1) * sizeof(const char *));
+	with = (size_t *)malloc((ar->count + 1) * sizeof(size_t));
+	if ((items == NULL) || (appended == NULL) || (with == NULL)) {
+		perror(NULL);
+		free(items);
+		free(appended);
+		free(with);
+		return false;
+	}
+
+	// Dropped members make way first
+	first = ar->count;
+	for (i = 0; i < ar->count; i++) {
+		with[i] = INDEX_NONE;
+		if ((drop != NULL) && drop[i]) {
+			with[i] = INDEX_DROP;
+			if (i < first) {
+				first = i;
+			}
+		}
+	}
+
+	// Pair each file with the member it replaces, if it changed
+	ok = true;
+	nappended = 0;
+	for (i = 0; i < count; i++) {
+		struct ar_append_item *item = &items[i];
+		struct arhdr_fields fields;
+		struct ar_member *member;
+		size_t j;
+
+		assert(paths[i] != NULL);
+
+		if (stat(paths[i], &item->st) == -1) {
+			fprintf(stderr, "Failed to add %s to archive\n", paths[i]);
+			ok = false;
+			continue;
+		}
+
+		// Members are found by the name they would be stored under
+		if (ar->thin) {
+			member = ar_index_find(ar, paths[i]);
+			if (member == NULL) {
+				char *full = realpath(paths[i], NULL);
+
+				if (full != NULL) {
+					member = ar_index_find(ar, full);
+					free(full);
+				}
+			}
+		} else {
+			ar_make_hdr(&item->hdr, paths[i], &item->st);
+			arhdr_decode(&item->hdr, &fields);
+			member = ar_index_find(ar, fields.name);
+		}
+
+		if ((member == NULL) || (with[member - ar->members] == INDEX_DROP)) {
+			appended[nappended++] = paths[i];
+			continue;
+		}
+
+		// Leave members that are current alone
+		if (newer ? (item->st.st_mtim.tv_sec <= member->date) :
+				((item->st.st_mtim.tv_sec == member->date) &&
+				(item->st.st_size == ar_full_size(ar, member)))) {
+			continue;
+		}
+
+		// Keep the member's name, which may refer to the long name table
+		if (ar_make_hdr(&item->hdr, member->name, &item->st) == false) {
+			fprintf(stderr, "%s is too large for an archive\n", paths[i]);
+			ok = false;
+			continue;
+		}
+
+		item->path = paths[i];
+		item->packed_fd = -1;
+		item->unpacked = -1;
+		j = member - ar->members;
+		with[j] = i;
+		if (j < first) {
+			first = j;
+		}
+	}
+
+	// Files to append as they are go after the new ones
+	for (i = 0; i < nadded; i++) {
+		appended[nappended++] = added[i];
+	}
+
+	if (first == ar->count) {
+		free(items);
+		free(with);
+		ok = ar_append_set(ar, appended, nappended) && ok;
+		free(appended);
+		return ok;
+	}
+
+	if (ar_index_own(ar) == false) {
+		free(items);
+		free(appended);
+		free(with);
+		return false;
+	}
+
+	// Remember where every member was, so the symbol table can follow them
+	old_offsets = NULL;
+	new_offsets = NULL;
+	if (ar_armap_member(ar) != NULL) {
+		old_offsets = (uint64_t *)malloc(ar->count * sizeof(uint64_t));
+		new_offsets = (uint64_t *)malloc(ar->count * sizeof(uint64_t));
+		if ((old_offsets == NULL) || (new_offsets == NULL) ||
+				(ar_armap_load(ar) == false)) {
+			if ((old_offsets == NULL) || (new_offsets == NULL)) {
+				perror(NULL);
+			}
+
+			free(old_offsets);
+			free(new_offsets);
+			free(items);
+			free(appended);
+			free(with);
+			return false;
+		}
+
+		for (i = 0; i < ar->count; i++) {
+			old_offsets[i] = ar->members[i].offset;
+		}
+	}
+
+	// Build the archive anew beside the old one where it can be renamed into
+	// place, so a failure leaves the archive as it was
+	rewriting = ar_rewrite_begin(ar);
+
+	if (ar_replace_write(ar, items, with, first) == false) {
+		if (rewriting) {
+			fprintf(stderr, "Archive left unchanged\n");
+			ar_rewrite_abort(ar);
+		}
+
+		free(old_offsets);
+		free(new_offsets);
+		free(items);
+		free(appended);
+		free(with);
+		return false;
+	}
+
+	// Symbols follow the members that stayed, replaced members' symbols are
+	// read again from their new contents
+	if (old_offsets != NULL) {
+		for (i = 0; i < ar->count; i++) {
+			new_offsets[i] = (with[i] != INDEX_NONE) ? ARMAP_DROPPED :
+					(uint64_t)ar->members[i].offset;
+		}
+
+		rebuild = (armap_relocate(&ar->armap, old_offsets, new_offsets,
+				ar->count) == false);
+	}
+
+	// Forget dropped members
+	for (i = first, kept = first; i < ar->count; i++) {
+		if (with[i] != INDEX_DROP) {
+			with[kept] = with[i];
+			ar->members[kept++] = ar->members[i];
+		}
+	}
+
+	if (kept < ar->count) {
+		ar->count = kept;
+		if (ar_index_rehash(ar) == false) {
+			ok = false;
+		}
+	}
+
+	if ((old_offsets != NULL) && rebuild) {
+		if ((ar_armap_rebuild(ar) == false) || (ar_armap_write(ar) == false)) {
+			ok = false;
+		}
+	} else if (old_offsets != NULL) {
+		bool mapped = true;
+
+		for (i = first; (i < ar->count) && mapped; i++) {
+			if (with[i] != INDEX_NONE) {
+				mapped = ar_armap_scan(ar, i, i + 1, &ar->armap);
+			}
+		}
+
+		if (mapped == false) {
+			fprintf(stderr, "Could not update symbol table\n");
+			ok = false;
+		} else if (ar_armap_write(ar) == false) {
+			ok = false;
+		}
+	}
+
+	free(old_offsets);
+	free(new_offsets);
+	free(items);
+	free(with);
+
+	// Files new to the archive go on the end, before the new file takes the
+	// archive's place so the whole batch lands at once
+	ok = ar_append_set(ar, appended, nappended) && ok;
+	free(appended);
+
+	if (rewriting == false) {
+		return ok;
+	}
+
+	// A half updated new file must not take the archive's place
+	if (ok == false) {
+		fprintf(stderr, "Archive left unchanged\n");
+		ar_rewrite_abort(ar);
+		return false;
+	}
+
+	return ar_rewrite_commit(ar);
+}
+
+bool ar_replace_write(struct archive *ar, struct ar_append_item *items,
+		const size_t *with, size_t first) {
+	struct ar_append_work work;
+	struct ar_append_item *placed;
+	struct ar_run *runs;
+	off_t *offsets;
+	off_t pos;
+	off_t end;
+	size_t nplaced;
+	size_t nruns;
+	size_t i;
+	size_t j;
+	size_t k;
+	bool ok;
+	int copy;
+
+	assert(ar != NULL);
+	assert(ar->index_map == NULL);
+	assert(items != NULL);
+	assert(with != NULL);
+	assert(first < ar->count);
+
+	offsets = (off_t *)malloc((ar->count - first) * sizeof(off_t));
+	runs = (struct ar_run *)malloc((ar->count - first) * sizeof(struct ar_run));
+	placed = (struct ar_append_item *)malloc((ar->count - first) *
+			sizeof(struct ar_append_item));
+	if ((offsets == NULL) || (runs == NULL) || (placed == NULL)) {
+		perror(NULL);
+		free(offsets);
+		free(runs);
+		free(placed);
+		return false;
+	}
+
+	// Take the replacements in archive order, packed if asked for, since
+	// their sizes decide the layout
+	nplaced = 0;
+	for (i = first; i < ar->count; i++) {
+		if ((with[i] != INDEX_NONE) && (with[i] != INDEX_DROP)) {
+			placed[nplaced++] = items[with[i]];
+		}
+	}
+
+	if ((ar->pack_level > 0) && (ar->thin == false) &&
+			(ar_pack_set(ar, placed, nplaced) == false)) {
+		free(offsets);
+		free(runs);
+		free(placed);
+		return false;
+	}
+
+	// Lay out the members from the first replaced or dropped one on, each
+	// starting on an even byte boundary
+	pos = ar->members[first].offset;
+	end = pos;
+	for (i = first, j = 0; i < ar->count; i++) {
+		off_t size = ar_data_size(ar, &ar->members[i]);
+
+		if (with[i] == INDEX_DROP) {
+			offsets[i - first] = -1;
+			continue;
+		}
+
+		if (with[i] != INDEX_NONE) {
+			placed[j].offset = pos;
+			placed[j].pad = false;
+			size = ar->thin ? 0 : placed[j].st.st_size;
+			j++;
+		}
+
+		offsets[i - first] = pos;
+		end = pos + sizeof(struct ar_hdr) + size;
+		pos = end + (end % 2);
+	}
+
+	// The members between replaced or dropped ones move together, padding
+	// and all
+	nruns = 0;
+	for (i = first; i < ar->count; i = j) {
+		if (with[i] != INDEX_NONE) {
+			j = i + 1;
+			continue;
+		}
+
+		for (j = i + 1; (j < ar->count) && (with[j] == INDEX_NONE); j++);
+
+		runs[nruns].from = ar->members[i].offset;
+		runs[nruns].to = offsets[i - first];
+		runs[nruns].size = ((j < ar->count) ? ar->members[j].offset :
+				ar->size) - runs[nruns].from;
+		nruns++;
+	}
+
+	// A new file starts out sparse, so blocks shared with the old one aren't
+	// allocated first. Otherwise reserve the space up front, the filesystem
+	// may not support it.
+	if (ar->rewrite_path != NULL) {
+		if (ftruncate(ar->fd, end) == -1) {
+			perror("Could not size new archive");
+			ar_pack_release(placed, nplaced);
+			free(offsets);
+			free(runs);
+			free(placed);
+			return false;
+		}
+	} else if ((end > ar->size) &&
+			(fallocate(ar->fd, 0, ar->size, end - ar->size) == -1)) {
+		if ((errno == ENOSPC) || (ftruncate(ar->fd, end) == -1)) {
+			perror("Could not grow archive");
+			ar_pack_release(placed, nplaced);
+			free(offsets);
+			free(runs);
+			free(placed);
+			return false;
+		}
+	}
+
+	// A rewrite copies everything before the first change and each run from
+	// the old archive, in any order. In place, a run moving toward the front
+	// only lands on space already vacated, and runs moving toward the back
+	// are moved last to first so none lands on one that hasn't moved yet.
+	copy = STATS_ENTER(STATS_PHASE_COPY);
+	ok = true;
+	if (ar->rewrite_path != NULL) {
+		ok = ar_clone_range(ar->old_fd, 0, ar->fd, 0, ar->members[first].offset);
+		for (i = 0; (i < nruns) && ok; i++) {
+			ok = ar_clone_range(ar->old_fd, runs[i].from, ar->fd, runs[i].to,
+					runs[i].size);
+		}
+
+		nruns = 0;
+	}
+
+	for (i = 0; (i < nruns) && ok; i = k) {
+		for (k = i; (k < nruns) && (runs[k].to > runs[k].from); k++);
+
+		if (k == i) {
+			if (runs[i].to < runs[i].from) {
+				ok = ar_move_range(ar->fd, runs[i].from, runs[i].to,
+						runs[i].size);
+			}
+
+			k = i + 1;
+			continue;
+		}
+
+		for (j = k; (j > i) && ok; j--) {
+			ok = ar_shift_range(ar->fd, runs[j - 1].from, runs[j - 1].to,
+					runs[j - 1].size);
+		}
+	}
+
+	// Then fill in the replaced members, thin ones are just a header
+	if (ok && ar->thin) {
+		for (i = 0; (i < nplaced) && ok; i++) {
+			ok = block_write(ar->fd, (uint8_t *)&placed[i].hdr,
+					placed[i].offset, sizeof(struct ar_hdr));
+		}
+	} else if (ok) {
+		work.ar = ar;
+		work.items = placed;
+		work.maps = NULL;
+		if ((ar->ring != NULL) && (ar->pack_level == 0)) {
+			ok = ar_append_uring(ar, placed, nplaced);
+		} else {
+			ok = pool_run(nplaced, ar->jobs, ar_append_task, &work);
+		}
+
+		// Members of odd size are followed by a newline, unless last
+		for (i = 0; (i < nplaced) && ok; i++) {
+			off_t data_end = placed[i].offset + sizeof(struct ar_hdr) +
+					placed[i].st.st_size;
+
+			if ((data_end < end) && ((data_end % 2) == 1)) {
+				STATS_IO(STATS_WRITE, 0, sizeof(char));
+				if (pwrite(ar->fd, "\n", sizeof(char), data_end) == -1) {
+					perror("Write error");
+					ok = false;
+				}
+			}
+		}
+	}
+
+	ar_pack_release(placed, nplaced);
+	STATS_LEAVE(copy);
+
+	if ((ok == false) || ((end < ar->size) && (ftruncate(ar->fd, end) == -1))) {
+		// A rewrite's failure is only the new file's
+		if (ar->rewrite_path == NULL) {
+			fprintf(stderr, "Archive may be corrupt\n");
+		}
+
+		free(offsets);
+		free(runs);
+		free(placed);
+		return false;
+	}
+
+	// Record where every member now lives and what replaced members hold
+	for (i = first, j = 0; i < ar->count; i++) {
+		struct ar_member *member = &ar->members[i];
+
+		member->offset = offsets[i - first];
+		if ((with[i] != INDEX_NONE) && (with[i] != INDEX_DROP)) {
+			struct arhdr_fields fields;
+
+			arhdr_decode(&placed[j].hdr, &fields);
+			member->size = fields.size;
+			member->date = fields.date;
+			member->uid = fields.uid;
+			member->gid = fields.gid;
+			member->mode = fields.mode;
+			member->hash = 0;
+			member->unpacked = -1;
+			ar_pack_note(member, &placed[j++]);
+		}
+	}
+
+	ar->size = end;
+	ar->index_fresh = false;
+
+	free(offsets);
+	free(runs);
+	free(placed);
+
+	return true;
+}
+
+bool ar_rewrite_usable(struct archive *ar) {
+	struct stat st;
+
+	assert(ar != NULL);
+
+	if ((ar->path == NULL) || (fstat(ar->fd, &st) == -1)) {
+		return false;
+	}
+
+	return S_ISREG(st.st_mode) && (st.st_nlink == 1);
+}
+
+bool ar_rewrite_begin(struct archive *ar) {
+	struct stat st;
+	char *real_path;
+	char *temp_path;
+	int fd;
+
+	assert(ar != NULL);
+	assert(ar->rewrite_path == NULL);
+
+	if ((ar_rewrite_usable(ar) == false) || (fstat(ar->fd, &st) == -1)) {
+		return false;
+	}
+
+	// Rename over the file a link points to, not the link
+	real_path = realpath(ar->path, NULL);
+	if (real_path == NULL) {
+		return false;
+	}
+
+	free(ar->path);
+	ar->path = real_path;
+
+	// Next to the archive, so it can be renamed over it
+	temp_path = (char *)malloc(strlen(ar->path) + sizeof(".XXXXXX"));
+	if (temp_path == NULL) {
+		perror(NULL);
+		return false;
+	}
+
+	strcpy(temp_path, ar->path);
+	strcat(temp_path, ".XXXXXX");
+
+	fd = mkstemp(temp_path);
+	STATS_IO(STATS_OPEN, 0, 0);
+	if (fd == -1) {
+		free(temp_path);
+		return false;
+	}
+
+	// Keep the archive's owner where we may, and its permissions
+	if ((fchown(fd, st.st_uid, st.st_gid) == -1) && (errno != EPERM)) {
+		perror("Could not set owner of new archive");
+	}
+
+	if (fchmod(fd, st.st_mode & (PERM_MASK | S_ISUID | S_ISGID | S_ISVTX)) == -1) {
+		perror("Could not set permissions of new archive");
+		close(fd);
+		unlink(temp_path);
+		free(temp_path);
+		return false;
+	}
+
+	ar->old_fd = ar->fd;
+	ar->fd = fd;
+	ar->rewrite_path = temp_path;
+
+	return true;
+}
+
+bool ar_rewrite_commit(struct archive *ar) {
+	int prev;
+	bool ok;
+
+	assert(ar != NULL);
+	assert(ar->rewrite_path != NULL);
+
+	// The data has to be on disk before the name can point at it
+	prev = STATS_ENTER(STATS_PHASE_SYNC);
+	STATS_IO(STATS_FSYNC, 0, 0);
+	ok = (fsync(ar->fd) == 0) && (rename(ar->rewrite_path, ar->path) == 0);
+	if (ok == false) {
+		STATS_LEAVE(prev);
+		perror("Could not replace archive");
+		fprintf(stderr, "Archive left unchanged\n");
+		ar_rewrite_abort(ar);
+		return false;
+	}
+
+	// The rename is only durable once the directory holding it is
+	if (ar_sync_dir(ar->path) == false) {
+		perror("Could not sync archive directory");
+	}
+
+	STATS_LEAVE(prev);
+
+	close(ar->old_fd);
+	free(ar->rewrite_path);
+	ar->rewrite_path = NULL;
+	ar->index_fresh = false;
+
+	return true;
+}
+
+bool ar_sync_dir(const char *path) {
+	const char *slash;
+	char *dir;
+	bool ok;
+	int fd;
+
+	assert(path != NULL);
+
+	slash = strrchr(path, '/');
+	if (slash == NULL) {
+		dir = strdup(".");
+	} else {
+		dir = strndup(path, (slash == path) ? 1 : (size_t)(slash - path));
+	}
+
+	if (dir == NULL) {
+		return false;
+	}
+
+	fd = open(dir, O_RDONLY | O_DIRECTORY);
+	STATS_IO(STATS_OPEN, 0, 0);
+	free(dir);
+	if (fd == -1) {
+		return false;
+	}
+
+	STATS_IO(STATS_FSYNC, 0, 0);
+	ok = (fsync(fd) == 0);
+	close(fd);
+
+	return ok;
+}
+
+void ar_rewrite_abort(struct archive *ar) {
+	assert(ar != NULL);
+	assert(ar->rewrite_path != NULL);
+	assert(ar->index_map == NULL);
+
+	close(ar->fd);
+	unlink(ar->rewrite_path);
+	free(ar->rewrite_path);
+	ar->rewrite_path = NULL;
+	ar->fd = ar->old_fd;
+
+	// Read the tables of the archive that stayed
+	armap_free(&ar->armap);
+	armap_init(&ar->armap);
+	ar->armap_loaded = false;
+	ar->count = 0;
+	ar->index_fresh = false;
+	if (ar_index_build(ar) == false) {
+		fprintf(stderr, "Could not read archive members\n");
+	}
+}
+
+bool ar_extract(struct archive *ar, const char *name) {
+	assert(ar != NULL);
+	assert(name != NULL);
+
+	return ar_extract_set(ar, &name, 1);
+}
+
+bool ar_extract_set(struct archive *ar, const char **names, size_t count) {
+	struct ar_extract_work work;
+	struct ar_member **wanted;
+	size_t nwanted;
+	size_t unique;
+	size_t i;
+	bool ok;
+	int copy;
+
+	assert(ar != NULL);
+	assert(names != NULL);
+
+	if (ar->sink) {
+		fprintf(stderr, "Can't read an archive being written to a stream\n");
+		return false;
+	}
+
+	// Members can only be taken as they go past
+	if (ar->stream) {
+		if (ar->stream_read) {
+			fprintf(stderr, "Archive stream has already been read\n");
+			return false;
+		}
+
+		return ar_stream_extract(ar, names, count);
+	}
+
+	if (count == 0) {
+		return true;
+	}
+
+	wanted = (struct ar_member **)malloc(count * sizeof(struct ar_member *));
+	if (wanted == NULL) {
+		perror(NULL);
+		return false;
+	}
+
+	// Look up every name before touching the archive data
+	ok = true;
+	nwanted = 0;
+	for (i = 0; i < count; i++) {
+		struct ar_member *member;
+
+		assert(names[i] != NULL);
+
+		member = ar_index_find(ar, names[i]);
+		if (member != NULL) {
+			wanted[nwanted++] = member;
+		}
+	}
+
+	// Visit members in archive order, dropping repeated names
+	qsort(wanted, nwanted, sizeof(struct ar_member *), ar_member_cmp_offset);
+
+	unique = 0;
+	for (i = 0; i < nwanted; i++) {
+		if ((unique == 0) || (wanted[i] != wanted[unique - 1])) {
+			wanted[unique++] = wanted[i];
+		}
+	}
+
+	// Members don't depend on each other, so they can go to separate threads
+	// or all be in flight at once in the ring. The ring only copies, so
+	// packed members are moved to the end to be unpacked by the threads.
+	work.ar = ar;
+	work.members = wanted;
+	copy = STATS_ENTER(STATS_PHASE_COPY);
+	if ((ar->ring != NULL) && (ar->thin == false)) {
+		size_t plain = 0;
+
+		for (i = 0; i < unique; i++) {
+			if (wanted[i]->unpacked < 0) {
+				struct ar_member *member = wanted[i];
+
+				wanted[i] = wanted[plain];
+				wanted[plain++] = member;
+			}
+		}
+
+		if (ar_extract_uring(ar, wanted, plain) == false) {
+			ok = false;
+		}
+
+		work.members = wanted + plain;
+		if (pool_run(unique - plain, ar->jobs, ar_extract_task, &work) ==
+				false) {
+			ok = false;
+		}
+	} else if (pool_run(unique, ar->jobs, ar_extract_task, &work) == false) {
+		ok = false;
+	}
+
+	STATS_LEAVE(copy);
+	free(wanted);
+
+	// Report anything that was never found
+	for (i = 0; i < count; i++) {
+		if (ar_index_find(ar, names[i]) == NULL) {
+			printf("File %s not found in archive\n", names[i]);
+			ok = false;
+		}
+	}
+
+	return ok;
+}
+
+void ar_print_concise(struct archive *ar) {
+	size_t i;
+
+	assert(ar != NULL);
+
+	// A stream's members aren't known until it has been read
+	if (ar->stream && (ar->stream_read == false) &&
+			(ar_stream_build(ar) == false)) {
+		fprintf(stderr, "Could not read archive members\n");
+	}
+
+	// For each member
+	for (i = 0; i < ar->count; i++) {
+		if (ar_is_special(ar->members[i].name) == false) {
+			printf("%s\n", ar_full_name(ar, &ar->members[i]));
+		}
+	}
+}
+
+void ar_print_verbose(struct archive *ar) {
+	size_t i;
+
+	assert(ar != NULL);
+
+	// A stream's members aren't known until it has been read
+	if (ar->stream && (ar->stream_read == false) &&
+			(ar_stream_build(ar) == false)) {
+		fprintf(stderr, "Could not read archive members\n");
+	}
+
+	// For each member
+	for (i = 0; i < ar->count; i++) {
+		struct ar_member *member = &ar->members[i];
+		struct tm time;
+		char ftime[SFTIME];
+		char mode[SFMODE];
+
+		if (ar_is_special(member->name)) {
+			continue;
+		}
+
+		ar_mode_str(member->mode, mode);
+		
+		// localtime() checks the time zone file on every call
+		localtime_r(&member->date, &time);
+		strftime(ftime, SFTIME, "%b %d %H:%M %Y", &time);
+		
+		printf("%s %6u/%-6u %10lld %s %s\n",
+			mode,
+			member->uid,
+			member->gid,
+			(long long)ar_full_size(ar, member),
+			ftime,
+			ar_full_name(ar, member));
+	}
+}
+
+bool ar_iter_init(struct ar_iter *iter, struct archive *ar) {
+	assert(iter != NULL);
+	assert(ar != NULL);
+
+	iter->ar = ar;
+	iter->next = 0;
+
+	// A stream's members aren't known until it has been read
+	if (ar->stream && (ar->stream_read == false) &&
+			(ar_stream_build(ar) == false)) {
+		fprintf(stderr, "Could not read archive members\n");
+		return false;
+	}
+
+	return true;
+}
+
+bool ar_iter_next(struct ar_iter *iter, struct ar_entry *entry) {
+	struct archive *ar;
+
+	assert(iter != NULL);
+	assert(iter->ar != NULL);
+	assert(entry != NULL);
+
+	ar = iter->ar;
+
+	while (iter->next < ar->count) {
+		struct ar_member *member = &ar->members[iter->next++];
+
+		if (ar_is_special(member->name) == false) {
+			ar_entry_fill(ar, member, entry);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool ar_lookup(struct archive *ar, const char *name, struct ar_entry *entry) {
+	struct ar_member *member;
+
+	assert(ar != NULL);
+	assert(name != NULL);
+	assert(entry != NULL);
+
+	if (ar->stream && (ar->stream_read == false) &&
+			(ar_stream_build(ar) == false)) {
+		fprintf(stderr, "Could not read archive members\n");
+		return false;
+	}
+
+	member = ar_index_find(ar, name);
+	if (member == NULL) {
+		return false;
+	}
+
+	ar_entry_fill(ar, member, entry);
+
+	return true;
+}
+
+void ar_entry_fill(struct archive *ar, struct ar_member *member,
+		struct ar_entry *entry) {
+	assert(ar != NULL);
+	assert(member != NULL);
+	assert(entry != NULL);
+
+	entry->name = ar_full_name(ar, member);
+	entry->size = ar_full_size(ar, member);
+	entry->date = member->date;
+	entry->uid = member->uid;
+	entry->gid = member->gid;
+	entry->mode = member->mode & ~PACK_MODE;
+	entry->stored_size = ar_data_size(ar, member);
+	entry->packed = (member->unpacked >= 0);
+
+	// A thin member's data lives in its own file
+	if (ar->thin) {
+		entry->data_offset = -1;
+	} else {
+		entry->data_offset = member->offset + sizeof(struct ar_hdr);
+	}
+}
+
+bool ar_stream_build(struct archive *ar) {
+	struct ar_member *member;
+	int prev;
+	bool ok;
+
+	assert(ar != NULL);
+	assert(ar->stream);
+
+	prev = STATS_ENTER(STATS_PHASE_SCAN);
+	do {
+		ok = ar_stream_next(ar, &member) &&
+				((member == NULL) || ar_stream_skip(ar, member));
+	} while (ok && (member != NULL));
+	STATS_LEAVE(prev);
+
+	return ok;
+}
+
+bool ar_stream_extract(struct archive *ar, const char **names, size_t count) {
+	struct ar_member *member;
+	bool *found;
+	size_t i;
+	bool ok;
+	int prev;
+
+	assert(ar != NULL);
+	assert(ar->stream);
+	assert((names != NULL) || (count == 0));
+
+	found = (bool *)calloc(count + 1, sizeof(bool));
+	if (found == NULL) {
+		perror(NULL);
+		return false;
+	}
+
+	// Headers and skipped data are scanned, wanted members copied
+	prev = STATS_ENTER(STATS_PHASE_SCAN);
+	ok = true;
+	for (;;) {
+		bool wanted = false;
+
+		if (ar_stream_next(ar, &member) == false) {
+			ok = false;
+			break;
+		}
+
+		if (member == NULL) {
+			break;
+		}
+
+		// Take the first member carrying each name
+		if (ar_is_special(member->name) == false) {
+			const char *name = ar_full_name(ar, member);
+
+			for (i = 0; i < count; i++) {
+				if ((found[i] == false) && (strcmp(names[i], name) == 0)) {
+					found[i] = true;
+					wanted = true;
+				}
+			}
+		}
+
+		// A failed copy may stop anywhere in the member's data, and the
+		// stream can't be trusted to line up with the next header after it
+		if (wanted) {
+			STATS_ENTER(STATS_PHASE_COPY);
+			if (ar_stream_member(ar, member) == false) {
+				ok = false;
+				break;
+			}
+
+			STATS_ENTER(STATS_PHASE_SCAN);
+		} else if (ar_stream_skip(ar, member) == false) {
+			ok = false;
+			break;
+		}
+	}
+
+	STATS_LEAVE(prev);
+
+	// Report anything that was never found, if the whole stream was read
+	for (i = 0; (i < count) && ar->stream_read; i++) {
+		if (found[i] == false) {
+			printf("File %s not found in archive\n", names[i]);
+			ok = false;
+		}
+	}
+
+	free(found);
+
+	return ok;
+}
+
+bool ar_stream_next(struct archive *ar, struct ar_member **member) {
+	struct ar_hdr hdr;
+	ssize_t n;
+
+	assert(ar != NULL);
+	assert(ar->stream);
+	assert(member != NULL);
+
+	*member = NULL;
+
+	n = stream_read(ar->fd, (uint8_t *)&hdr, sizeof(struct ar_hdr));
+	if (n == 0) {
+		ar->stream_read = true;
+		return true;
+	}
+
+	if (n != sizeof(struct ar_hdr)) {
+		fprintf(stderr, "Error reading header data\n");
+		return false;
+	}
+
+	// Verify file header
+	if (memcmp(hdr.ar_fmag, ARFMAG, SARFMAG) != 0) {
+		// Magic number incorrect
+		fprintf(stderr, "Magic number mismatch\n");
+		return false;
+	}
+
+	STATS_HEADERS(1);
+	if (ar_index_add(ar, &hdr, ar->size) == false) {
+		return false;
+	}
+
+	ar->size += sizeof(struct ar_hdr);
+	*member = &ar->members[ar->count - 1];
+
+	return true;
+}
+
+bool ar_stream_skip(struct archive *ar, struct ar_member *member) {
+	uint8_t buf[COPY_SIZE];
+	off_t left;
+
+	assert(ar != NULL);
+	assert(ar->stream);
+	assert(member != NULL);
+
+	left = ar_data_size(ar, member);
+	ar->size += left;
+
+	// Later members may be named in the long name table
+	if (strcmp(member->name, LONG_NAMES_NAME) == 0) {
+		char *names = (char *)malloc(left + 1);
+
+		if (names == NULL) {
+			perror(NULL);
+			return false;
+		}
+
+		if (stream_read(ar->fd, (uint8_t *)names, left) != left) {
+			fprintf(stderr, "Error reading long name table\n");
+			free(names);
+			return false;
+		}
+
+		ar_names_take(ar, names, left);
+		left = 0;
+	} else if ((ar->thin == false) && (member->mode & PACK_MODE) &&
+			(left >= PACK_HDR_SIZE)) {
+		// Tell if the member is packed from the start of its data
+		if (stream_read(ar->fd, buf, PACK_HDR_SIZE) != PACK_HDR_SIZE) {
+			fprintf(stderr, "Unexpected end of archive\n");
+			return false;
+		}
+
+		ar_pack_check(ar, member, buf, PACK_HDR_SIZE);
+		left -= PACK_HDR_SIZE;
+	}
+
+	// Seek past the data if the stream allows it, otherwise read past it
+	if ((left > 0) && (lseek(ar->fd, left, SEEK_CUR) == -1)) {
+		while (left > 0) {
+			size_t count = (left < COPY_SIZE) ? left : COPY_SIZE;
+
+			if (stream_read(ar->fd, buf, count) != (ssize_t)count) {
+				fprintf(stderr, "Unexpected end of archive\n");
+				return false;
+			}
+
+			left -= count;
+		}
+	}
+
+	return ar_stream_pad(ar);
+}
+
+bool ar_stream_pad(struct archive *ar) {
+	uint8_t pad;
+
+	assert(ar != NULL);
+	assert(ar->stream);
+
+	// The last member's padding may be missing
+	if ((ar->size % 2) == 1) {
+		if (stream_read(ar->fd, &pad, sizeof(uint8_t)) == -1) {
+			return false;
+		}
+
+		ar->size++;
+	}
+
+	return true;
+}
+
+bool ar_stream_member(struct archive *ar, struct ar_member *member) {
+	uint8_t buf[COPY_SIZE];
+	struct utimbuf tbuf;
+	const char *name;
+	int extract_fd;
+	off_t left;
+	bool ok;
+
+	assert(ar != NULL);
+	assert(ar->stream);
+	assert(member != NULL);
+
+	// Thin members are copied from their own files
+	if (ar->thin) {
+		return ar_extract_member(ar, member);
+	}
+
+	name = ar_full_name(ar, member);
+
+	// Create a file to extract to
+	extract_fd = creat(name, DEFAULT_PERMS);
+	STATS_IO(STATS_OPEN, 0, 0);
+	if (extract_fd == -1) {
+		perror("Could not open file for extraction");
+		ar_stream_skip(ar, member);
+		return false;
+	}
+
+	// Read far enough to tell if a member marked as packed is, and if it is
+	// unpack the rest as it arrives
+	left = member->size;
+	if ((member->mode & PACK_MODE) && (left >= PACK_HDR_SIZE)) {
+		if (stream_read(ar->fd, buf, PACK_HDR_SIZE) != PACK_HDR_SIZE) {
+			fprintf(stderr, "Unexpected end of archive\n");
+			close(extract_fd);
+			return false;
+		}
+
+		left -= PACK_HDR_SIZE;
+		ar_pack_check(ar, member, buf, PACK_HDR_SIZE);
+		if (member->unpacked >= 0) {
+			off_t unpacked;
+			uint64_t hash;
+
+			ok = pack_expand(ar->fd, -1, left, extract_fd, &unpacked, &hash) &&
+					(unpacked == member->unpacked) && (hash == member->hash);
+			if (ok == false) {
+				// The rest of the stream can't be trusted to line up
+				fprintf(stderr, "Could not extract %s\n", name);
+				close(extract_fd);
+				return false;
+			}
+
+			left = 0;
+		} else if (stream_write(extract_fd, buf, PACK_HDR_SIZE) == false) {
+			fprintf(stderr, "Could not extract %s\n", name);
+			close(extract_fd);
+			return false;
+		}
+	}
+
+	// Move pages out of a pipe straight into the file where the kernel
+	// allows it, otherwise copy through a buffer
+	while (left > 0) {
+		size_t count = (left < SPLICE_SIZE) ? left : SPLICE_SIZE;
+		ssize_t n = splice(ar->fd, NULL, extract_fd, NULL, count,
+				SPLICE_F_MOVE);
+
+		STATS_IO(STATS_SPLICE, (n > 0) ? n : 0, (n > 0) ? n : 0);
+		if (n <= 0) {
+			break;
+		}
+
+		left -= n;
+	}
+
+	ok = true;
+	while (left > 0) {
+		size_t count = (left < COPY_SIZE) ? left : COPY_SIZE;
+
+		if ((stream_read(ar->fd, buf, count) != (ssize_t)count) ||
+				(block_write(extract_fd, buf, member->size - left, count) ==
+				false)) {
+			fprintf(stderr, "Could not extract %s\n", name);
+			ok = false;
+			break;
+		}
+
+		left -= count;
+	}
+
+	ar->size += member->size - left;
+
+	if (close(extract_fd) == -1) {
+		perror("Could not close file");
+		ok = false;
+	}
+
+	if (ok == false) {
+		return false;
+	}
+
+	// Set file modification time
+	tbuf.actime = member->date;
+	tbuf.modtime = member->date;
+
+	if (utime(name, &tbuf) == -1) {
+		perror("Unable set modification time");
+		ok = false;
+	}
+
+	return ar_stream_pad(ar) && ok;
+}
+
+bool ar_check_global_hdr(int fd, bool *thin) {
+	char hdr[SARMAG];
+	off_t init_pos;
+	bool hdr_good;
+
+	assert(fd >= 0);
+	assert(thin != NULL);
+
+	// Remember initial position
+   	init_pos = lseek(fd, 0, SEEK_CUR);
+
+	lseek(fd, 0, SEEK_SET);
+
+	STATS_IO(STATS_READ, SARMAG, 0);
+	if (read(fd, hdr, SARMAG) == -1) {
+		// Report error
+		fprintf(stderr, "Read error (line %d)\n", __LINE__);
+
+		return false;
+	}
+
+	// Verify the header is valid
+	*thin = (memcmp(hdr, THINMAG, SARMAG) == 0);
+	hdr_good = *thin || (memcmp(hdr, ARMAG, SARMAG) == 0);
+
+	// Reset file position
+	lseek(fd, init_pos, SEEK_SET);
+
+	return hdr_good;
+}
+
+bool ar_write_global_hdr(int fd, bool thin) {
+	assert(fd >= 0);
+
+	lseek(fd, 0, SEEK_SET);
+
+	STATS_IO(STATS_WRITE, 0, SARMAG);
+	if (write(fd, thin ? THINMAG : ARMAG, SARMAG) == -1) {
+		fprintf(stderr, "Write error (line %d)\n", __LINE__);
+		return false;
+	}
+
+	return true;
+}
+
+bool ar_load_hdr(int fd, struct ar_hdr *hdr) {
+	assert(fd >= 0);
+	assert(hdr);
+
+	STATS_IO(STATS_READ, sizeof(struct ar_hdr), 0);
+	if (read(fd, hdr, sizeof(struct ar_hdr)) == -1) {
+		fprintf(stderr, "Error reading header data\n");
+		return false;
+	}
+
+	// Verify file header
+	if (memcmp(hdr->ar_fmag, ARFMAG, SARFMAG) != 0) {
+		// Magic number incorrect
+		fprintf(stderr, "Magic number mismatch\n");
+		return false;
+	}
+
+	return true;
+}
+
+struct ar_member *ar_seek(struct archive *ar, const char *name) {
+	struct ar_member *member;
+
+	assert(ar != NULL);
+	assert(name != NULL);
+
+	member = ar_index_find(ar, name);
+	if (member == NULL) {
+		return NULL;
+	}
+
+	// Seek past the header to the member's data
+	lseek(ar->fd, member->offset + sizeof(struct ar_hdr), SEEK_SET);
+
+	return member;
+}
+
+bool ar_extract_member(struct archive *ar, struct ar_member *member) {
+	struct utimbuf tbuf;
+	const char *name;
+	const char *slash;
+	int extract_fd;
+	int data_fd;
+	off_t from;
+	bool ok;
+
+	assert(ar != NULL);
+	assert(member != NULL);
+
+	name = ar_full_name(ar, member);
+	data_fd = ar->fd;
+	from = member->offset + sizeof(struct ar_hdr);
+
+	// A thin member's data is in the file it refers to, which is copied into
+	// the current directory under its own name
+	if (ar->thin) {
+		struct stat in_st;
+		struct stat out_st;
+
+		data_fd = openat(ar->dir_fd, name, O_RDONLY);
+		STATS_IO(STATS_OPEN, 0, 0);
+		if (data_fd == -1) {
+			fprintf(stderr, "Could not open %s\n", name);
+			return false;
+		}
+
+		from = 0;
+		slash = strrchr(name, '/');
+		if (slash != NULL) {
+			name = slash + 1;
+		}
+
+		// Already where it would be extracted to
+		if ((fstat(data_fd, &in_st) == 0) && (stat(name, &out_st) == 0) &&
+				(in_st.st_dev == out_st.st_dev) &&
+				(in_st.st_ino == out_st.st_ino)) {
+			close(data_fd);
+			return true;
+		}
+	}
+
+	// Create a file to extract to
+	extract_fd = creat(name, DEFAULT_PERMS);
+	STATS_IO(STATS_OPEN, 0, 0);
+	if (extract_fd == -1) {
+		perror("Could not open file for extraction");
+		if (data_fd != ar->fd) {
+			close(data_fd);
+		}
+
+		return false;
+	}
+
+	// Copy the member's data out, in the kernel when possible, unpacking
+	// it and checking it against its hash if it was packed
+	if ((ar->thin == false) && (member->unpacked >= 0)) {
+		off_t unpacked;
+		uint64_t hash;
+
+		ok = pack_expand(data_fd, from + PACK_HDR_SIZE,
+				member->size - PACK_HDR_SIZE, extract_fd, &unpacked, &hash) &&
+				(unpacked == member->unpacked) && (hash == member->hash);
+	} else {
+		ok = ar_send_range(data_fd, from, extract_fd, 0, member->size, false);
+	}
+
+	if (data_fd != ar->fd) {
+		close(data_fd);
+	}
+
+	if (ok == false) {
+		fprintf(stderr, "Could not extract %s\n", name);
+		close(extract_fd);
+		return false;
+	}
+
+	if (close(extract_fd) == -1) {
+		perror("Could not close file");
+		return false;
+	}
+	
+	// Set file modification time
+	tbuf.actime = member->date;
+	tbuf.modtime = member->date;
+
+	if (utime(name, &tbuf) == -1) {
+		perror("Unable set modification time");
+		return false;
+	}
+
+	return true;
+}
+
+bool ar_extract_task(void *ctx, size_t task) {
+	struct ar_extract_work *work = (struct ar_extract_work *)ctx;
+
+	assert(work != NULL);
+
+	return ar_extract_member(work->ar, work->members[task]);
+}
+
+bool ar_append_task(void *ctx, size_t task) {
+	struct ar_append_work *work = (struct ar_append_work *)ctx;
+	struct ar_append_item *item;
+	struct iovec iov[2];
+	ssize_t hdr_size;
+	int iovcnt;
+	int append_fd;
+	bool ok;
+
+	assert(work != NULL);
+
+	item = &work->items[task];
+
+	// A packed member is copied from its temporary file
+	append_fd = (item->packed_fd != -1) ? dup(item->packed_fd) :
+			open(item->path, O_RDONLY);
+	STATS_IO(STATS_OPEN, 0, 0);
+	if (append_fd < 0) {
+		// Report error
+		fprintf(stderr, "Failed to add %s to archive\n", item->path);
+		return false;
+	}
+
+	iovcnt = 0;
+
+	// If on an odd byte offset, write a newline ahead of the header
+	if (item->pad) {
+		iov[iovcnt].iov_base = (char *)"\n";
+		iov[iovcnt].iov_len = sizeof(char);
+		iovcnt++;
+	}
+
+	iov[iovcnt].iov_base = &item->hdr;
+	iov[iovcnt].iov_len = sizeof(struct ar_hdr);
+	iovcnt++;
+
+	// Write the padding and header together
+	hdr_size = (iovcnt - 1) * sizeof(char) + sizeof(struct ar_hdr);
+	STATS_IO(STATS_WRITE, 0, hdr_size);
+	if (pwritev(work->ar->fd, iov, iovcnt, item->offset - (iovcnt - 1)) !=
+			hdr_size) {
+		// Report error
+		fprintf(stderr, "Write error (line %d)\n", __LINE__);
+
+		// Clean up
+		close(append_fd);
+
+		return false;
+	}
+
+	// Copy the file's data into the archive, in the kernel when possible
+	ok = ar_send_range(append_fd, 0, work->ar->fd,
+			item->offset + sizeof(struct ar_hdr), item->st.st_size, true);
+	if (ok == false) {
+		fprintf(stderr, "Could not copy %s into archive\n", item->path);
+	}
+
+	close(append_fd);
+
+	return ok;
+}
+
+bool ar_append_uring(struct archive *ar, struct ar_append_item *items,
+		size_t count) {
+	struct uring_file *files;
+	uint8_t (*leads)[1 + sizeof(struct ar_hdr)];
+	size_t i;
+	bool ok;
+
+	assert(ar != NULL);
+	assert(ar->ring != NULL);
+	assert(items != NULL);
+
+	files = (struct uring_file *)calloc(count + 1, sizeof(struct uring_file));
+	leads = malloc((count + 1) * sizeof(*leads));
+	if ((files == NULL) || (leads == NULL)) {
+		perror(NULL);
+		free(files);
+		free(leads);
+		return false;
+	}
+
+	for (i = 0; i < count; i++) {
+		struct ar_append_item *item = &items[i];
+
+		// The padding and header go out in the same write as the first data
+		leads[i][0] = '\n';
+		memcpy(&leads[i][1], &item->hdr, sizeof(struct ar_hdr));
+
+		files[i].path = item->path;
+		files[i].flags = O_RDONLY;
+		files[i].to_file = false;
+		files[i].fd = ar->fd;
+		files[i].offset = item->offset - (item->pad ? 1 : 0);
+		files[i].size = item->st.st_size;
+		files[i].prefix = item->pad ? &leads[i][0] : &leads[i][1];
+		files[i].prefix_len = (item->pad ? 1 : 0) + sizeof(struct ar_hdr);
+	}
+
+	ok = uring_transfer(ar->ring, files, count);
+
+	for (i = 0; i < count; i++) {
+		if (files[i].ok == false) {
+			fprintf(stderr, "Failed to add %s to archive\n", items[i].path);
+		}
+	}
+
+	free(files);
+	free(leads);
+
+	return ok;
+}
+
+bool ar_extract_uring(struct archive *ar, struct ar_member **members,
+		size_t count) {
+	struct uring_file *files;
+	size_t i;
+	bool ok;
+
+	assert(ar != NULL);
+	assert(ar->ring != NULL);
+	assert(members != NULL);
+
+	files = (struct uring_file *)calloc(count + 1, sizeof(struct uring_file));
+	if (files == NULL) {
+		perror(NULL);
+		return false;
+	}
+
+	// Long names are resolved the same way ar_extract_member does, the header
+	// only holds an offset into the name table
+	for (i = 0; i < count; i++) {
+		files[i].path = ar_full_name(ar, members[i]);
+		files[i].flags = O_WRONLY | O_CREAT | O_TRUNC;
+		files[i].mode = DEFAULT_PERMS;
+		files[i].to_file = true;
+		files[i].fd = ar->fd;
+		files[i].offset = members[i]->offset + sizeof(struct ar_hdr);
+		files[i].size = members[i]->size;
+	}
+
+	ok = uring_transfer(ar->ring, files, count);
+
+	// Set file modification times
+	for (i = 0; i < count; i++) {
+		struct utimbuf tbuf;
+
+		if (files[i].ok == false) {
+			fprintf(stderr, "Could not extract %s\n", files[i].path);
+			continue;
+		}
+
+		tbuf.actime = members[i]->date;
+		tbuf.modtime = members[i]->date;
+
+		if (utime(files[i].path, &tbuf) == -1) {
+			perror("Unable set modification time");
+			ok = false;
+		}
+	}
+
+	free(files);
+
+	return ok;
+}
+
+bool ar_append_sink(struct archive *ar, const char **paths, size_t count) {
+	struct ar_append_work work;
+	struct ar_append_item *items;
+	struct armap map;
+	uint64_t *old_offsets;
+	uint64_t *new_offsets;
+	uint8_t *data;
+	size_t nitems;
+	size_t planned;
+	size_t size;
+	size_t i;
+	off_t pos;
+	off_t total;
+	bool wide;
+	bool ok;
+	int copy;
+
+	assert(ar != NULL);
+	assert(ar->sink);
+	assert((paths != NULL) || (count == 0));
+
+	items = (struct ar_append_item *)malloc((count + 1) *
+			sizeof(struct ar_append_item));
+	if (items == NULL) {
+		perror(NULL);
+		return false;
+	}
+
+	ok = true;
+	nitems = 0;
+	total = ar->size;
+	for (i = 0; i < count; i++) {
+		struct ar_append_item *item = &items[nitems];
+
+		if ((stat(paths[i], &item->st) == -1) ||
+				(S_ISREG(item->st.st_mode) == false)) {
+			fprintf(stderr, "Failed to add %s to archive\n", paths[i]);
+			ok = false;
+			continue;
+		}
+
+		if (ar_make_hdr(&item->hdr, paths[i], &item->st) == false) {
+			fprintf(stderr, "%s is too large for an archive\n", paths[i]);
+			ok = false;
+			continue;
+		}
+
+		item->path = paths[i];
+		item->packed_fd = -1;
+		item->unpacked = -1;
+		nitems++;
+	}
+
+	if ((ar->pack_level > 0) && (ar_pack_set(ar, items, nitems) == false)) {
+		free(items);
+		return false;
+	}
+
+	planned = nitems;
+	for (i = 0; i < nitems; i++) {
+		total += sizeof(struct ar_hdr) + items[i].st.st_size + 1;
+	}
+
+	// The symbol table has to come first, so read every file's symbols
+	// before writing anything
+	armap_init(&map);
+	if (ar->armap_wanted && (ar->count == 0) && (nitems > 0)) {
+		work.ar = ar;
+		work.items = items;
+		work.maps = (struct armap *)malloc(nitems * sizeof(struct armap));
+		if (work.maps == NULL) {
+			perror(NULL);
+			ar_pack_release(items, nitems);
+			free(items);
+			return false;
+		}
+
+		for (i = 0; i < nitems; i++) {
+			armap_init(&work.maps[i]);
+		}
+
+		if (pool_run(nitems, ar->jobs, ar_sink_symbols_task, &work) == false) {
+			ok = false;
+		}
+
+		for (i = 0; i < nitems; i++) {
+			if (armap_merge(&map, &work.maps[i]) == false) {
+				ok = false;
+			}
+
+			armap_free(&work.maps[i]);
+		}
+
+		free(work.maps);
+	}
+
+	// Lay out the table, its size doesn't depend on the offsets in it. It is
+	// given the same room q gives it, so both write the same archive.
+	pos = ar->size;
+	wide = false;
+	size = 0;
+	if (map.count > 0) {
+		wide = (total + 2 * armap_size(&map, true) + ARMAP_MIN_SIZE >
+				UINT32_MAX);
+		size = ar_armap_room(armap_size(&map, wide));
+		pos += sizeof(struct ar_hdr) + size;
+	}
+
+	// Then the members after it
+	old_offsets = (uint64_t *)malloc((nitems + 1) * sizeof(uint64_t));
+	new_offsets = (uint64_t *)malloc((nitems + 1) * sizeof(uint64_t));
+	if ((old_offsets == NULL) || (new_offsets == NULL)) {
+		perror(NULL);
+		free(old_offsets);
+		free(new_offsets);
+		armap_free(&map);
+		ar_pack_release(items, nitems);
+		free(items);
+		return false;
+	}
+
+	for (i = 0; i < nitems; i++) {
+		items[i].pad = ((pos % 2) == 1);
+		if (items[i].pad) {
+			pos++;
+		}
+
+		items[i].offset = pos;
+		old_offsets[i] = i;
+		new_offsets[i] = pos;
+		pos += sizeof(struct ar_hdr) + items[i].st.st_size;
+	}
+
+	if (map.count > 0) {
+		struct ar_hdr hdr;
+		struct stat st;
+
+		// Symbols were recorded against each file's place in the list, so
+		// every one is found
+		armap_relocate(&map, old_offsets, new_offsets, nitems);
+
+		data = (uint8_t *)malloc(size);
+		if (data == NULL) {
+			perror(NULL);
+			ok = false;
+			nitems = 0;
+		} else {
+			// Written with no owner, mode or date, as GNU ar does
+			memset(&st, 0, sizeof(struct stat));
+			st.st_size = size;
+			ar_make_hdr(&hdr, wide ? ARMAP_NAME64 : ARMAP_NAME, &st);
+			armap_encode(&map, data, size, wide);
+
+			if ((stream_write(ar->fd, (uint8_t *)&hdr, sizeof(struct ar_hdr)) ==
+					false) || (stream_write(ar->fd, data, size) == false)) {
+				fprintf(stderr, "Write error (line %d)\n", __LINE__);
+				ok = false;
+				nitems = 0;
+			} else if (ar_index_add(ar, &hdr, ar->size) == false) {
+				ok = false;
+			}
+
+			ar->size += sizeof(struct ar_hdr) + size;
+			free(data);
+		}
+	}
+
+	free(old_offsets);
+	free(new_offsets);
+	armap_free(&map);
+
+	// Write each member in turn
+	copy = STATS_ENTER(STATS_PHASE_COPY);
+	for (i = 0; i < nitems; i++) {
+		struct ar_append_item *item = &items[i];
+		int append_fd;
+
+		if (item->pad) {
+			if (stream_write(ar->fd, (const uint8_t *)"\n", sizeof(char)) ==
+					false) {
+				fprintf(stderr, "Write error (line %d)\n", __LINE__);
+				ok = false;
+				break;
+			}
+
+			ar->size++;
+		}
+
+		append_fd = (item->packed_fd != -1) ? dup(item->packed_fd) :
+				open(item->path, O_RDONLY);
+		STATS_IO(STATS_OPEN, 0, 0);
+		if (append_fd < 0) {
+			// Nothing can be taken back, so the stream is useless
+			fprintf(stderr, "Failed to add %s to archive\n", item->path);
+			ok = false;
+			break;
+		}
+
+		if ((stream_write(ar->fd, (uint8_t *)&item->hdr, sizeof(struct ar_hdr)) ==
+				false) || (stream_send(append_fd, ar->fd, item->st.st_size) ==
+				false)) {
+			fprintf(stderr, "Could not copy %s into archive\n", item->path);
+			close(append_fd);
+			ok = false;
+			break;
+		}
+
+		close(append_fd);
+
+		if (ar_index_add(ar, &item->hdr, item->offset) == false) {
+			ok = false;
+			break;
+		}
+
+		ar_pack_note(&ar->members[ar->count - 1], item);
+
+		ar->size = item->offset + sizeof(struct ar_hdr) + item->st.st_size;
+	}
+
+	STATS_LEAVE(copy);
+	ar_pack_release(items, planned);
+	free(items);
+
+	return ok;
+}
+
+bool ar_sink_symbols_task(void *ctx, size_t task) {
+	struct ar_append_work *work = (struct ar_append_work *)ctx;
+	struct ar_append_item *item;
+	int fd;
+	bool ok;
+
+	assert(work != NULL);
+	assert(work->maps != NULL);
+
+	item = &work->items[task];
+
+	// Packed members can't be linked against
+	if (item->packed_fd != -1) {
+		return true;
+	}
+
+	fd = open(item->path, O_RDONLY);
+	STATS_IO(STATS_OPEN, 0, 0);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to add %s to archive\n", item->path);
+		return false;
+	}
+
+	ok = armap_read_elf(&work->maps[task], fd, 0, item->st.st_size, task);
+	close(fd);
+
+	return ok;
+}
+
+bool ar_append_dedup(struct archive *ar, struct ar_append_item *items,
+		size_t *count) {
+	struct ar_dedup_work work;
+	struct arhdr_fields fields;
+	size_t nmembers;
+	size_t capacity;
+	size_t kept;
+	size_t i;
+	size_t j;
+
+	assert(ar != NULL);
+	assert(items != NULL);
+	assert(count != NULL);
+
+	if ((ar->nbuckets == 0) || (*count == 0)) {
+		return true;
+	}
+
+	work.ar = ar;
+	work.items = items;
+	work.checks = (size_t *)malloc(*count * sizeof(size_t));
+	work.nchecks = 0;
+	work.members = NULL;
+	if (work.checks == NULL) {
+		perror(NULL);
+		return false;
+	}
+
+	// Only files that a member could match by name and size need hashing,
+	// along with any of those members not hashed yet
+	nmembers = 0;
+	capacity = 0;
+	for (i = 0; i < *count; i++) {
+		arhdr_decode(&items[i].hdr, &fields);
+		items[i].check = false;
+
+		j = ar->buckets[hash_name(fields.name) & (ar->nbuckets - 1)];
+		for (; j < ar->count; j = ar->members[j].next) {
+			struct ar_member *member = &ar->members[j];
+
+			if ((ar_full_size(ar, member) != items[i].st.st_size) ||
+					(strcmp(ar_full_name(ar, member), fields.name) != 0)) {
+				continue;
+			}
+
+			items[i].check = true;
+			if (member->hash != 0) {
+				continue;
+			}
+
+			if (nmembers == capacity) {
+				struct ar_member **members;
+
+				capacity = (capacity == 0) ? INDEX_INIT_SIZE : capacity * 2;
+				members = (struct ar_member **)realloc(work.members,
+						capacity * sizeof(struct ar_member *));
+				if (members == NULL) {
+					perror(NULL);
+					free(work.checks);
+					free(work.members);
+					return false;
+				}
+
+				work.members = members;
+			}
+
+			work.members[nmembers++] = member;
+		}
+
+		if (items[i].check) {
+			work.checks[work.nchecks++] = i;
+		}
+	}
+
+	// Files with the same name share members, hash each member only once
+	if (nmembers > 1) {
+		qsort(work.members, nmembers, sizeof(struct ar_member *),
+				ar_member_cmp_offset);
+
+		j = 1;
+		for (i = 1; i < nmembers; i++) {
+			if (work.members[i] != work.members[j - 1]) {
+				work.members[j++] = work.members[i];
+			}
+		}
+
+		nmembers = j;
+	}
+
+	if (pool_run(work.nchecks + nmembers, ar->jobs, ar_dedup_task,
+			&work) == false) {
+		free(work.checks);
+		free(work.members);
+		return false;
+	}
+
+	// Hashes computed now are worth keeping
+	if (nmembers > 0) {
+		ar->index_fresh = false;
+	}
+
+	free(work.checks);
+	free(work.members);
+
+	// Drop the files a member already holds
+	kept = 0;
+	for (i = 0; i < *count; i++) {
+		bool stored = false;
+
+		if (items[i].check) {
+			arhdr_decode(&items[i].hdr, &fields);
+
+			j = ar->buckets[hash_name(fields.name) & (ar->nbuckets - 1)];
+			for (; (j < ar->count) && (stored == false);
+					j = ar->members[j].next) {
+				struct ar_member *member = &ar->members[j];
+
+				stored = (ar_full_size(ar, member) == items[i].st.st_size) &&
+						(member->hash == items[i].hash) &&
+						(strcmp(ar_full_name(ar, member), fields.name) == 0);
+			}
+		}
+
+		if (stored == false) {
+			items[kept++] = items[i];
+		}
+	}
+
+	*count = kept;
+
+	return true;
+}
+
+bool ar_dedup_task(void *ctx, size_t task) {
+	struct ar_dedup_work *work = (struct ar_dedup_work *)ctx;
+	struct ar_member *member;
+
+	assert(work != NULL);
+
+	if (task < work->nchecks) {
+		struct ar_append_item *item = &work->items[work->checks[task]];
+		int fd;
+
+		fd = open(item->path, O_RDONLY);
+		STATS_IO(STATS_OPEN, 0, 0);
+		if ((fd == -1) || (ar_hash_range(fd, 0, item->st.st_size,
+				&item->hash) == false)) {
+			item->check = false;
+		}
+
+		if (fd != -1) {
+			close(fd);
+		}
+
+		return true;
+	}
+
+	member = work->members[task - work->nchecks];
+	if (ar_hash_range(work->ar->fd, member->offset + sizeof(struct ar_hdr),
+			member->size, &member->hash) == false) {
+		fprintf(stderr, "Could not read %s\n", member->name);
+		return false;
+	}
+
+	return true;
+}
+
+bool ar_pack_set(struct archive *ar, struct ar_append_item *items,
+		size_t count) {
+	struct ar_append_work work;
+	int copy;
+	bool ok;
+
+	assert(ar != NULL);
+	assert(ar->pack_level > 0);
+	assert((items != NULL) || (count == 0));
+
+	// Packing reads and writes every file, so it counts as copying
+	work.ar = ar;
+	work.items = items;
+	work.maps = NULL;
+	copy = STATS_ENTER(STATS_PHASE_COPY);
+	ok = pool_run(count, ar->jobs, ar_pack_task, &work);
+	STATS_LEAVE(copy);
+	if (ok == false) {
+		ar_pack_release(items, count);
+		return false;
+	}
+
+	return true;
+}
+
+bool ar_pack_task(void *ctx, size_t task) {
+	struct ar_append_work *work = (struct ar_append_work *)ctx;
+	struct ar_append_item *item;
+	struct arhdr_fields fields;
+	char temp_path[] = "/tmp/myarXXXXXX";
+	off_t packed;
+	int in_fd;
+	int out_fd;
+
+	assert(work != NULL);
+
+	item = &work->items[task];
+
+	// Too small to gain anything from packing
+	if (item->st.st_size <= PACK_HDR_SIZE) {
+		return true;
+	}
+
+	in_fd = open(item->path, O_RDONLY);
+	STATS_IO(STATS_OPEN, 0, 0);
+	if (in_fd == -1) {
+		fprintf(stderr, "Failed to add %s to archive\n", item->path);
+		return false;
+	}
+
+	// Pack next to the archive so the copy in can stay in the filesystem,
+	// or failing that wherever temporary files go
+	out_fd = -1;
+	if (work->ar->dir_fd != -1) {
+		out_fd = openat(work->ar->dir_fd, ".", O_TMPFILE | O_RDWR,
+				S_IRUSR | S_IWUSR);
+		STATS_IO(STATS_OPEN, 0, 0);
+	}
+
+	if (out_fd == -1) {
+		out_fd = mkstemp(temp_path);
+		STATS_IO(STATS_OPEN, 0, 0);
+		if (out_fd != -1) {
+			unlink(temp_path);
+		}
+	}
+
+	if (out_fd == -1) {
+		perror("Could not create temporary file");
+		close(in_fd);
+		return false;
+	}
+
+	if (pack_file(in_fd, item->st.st_size, out_fd, work->ar->pack_level,
+			&packed, &item->hash) == false) {
+		fprintf(stderr, "Could not pack %s\n", item->path);
+		close(in_fd);
+		close(out_fd);
+		return false;
+	}
+
+	close(in_fd);
+
+	// Store the file as is if packing didn't make it smaller
+	if (packed >= item->st.st_size) {
+		close(out_fd);
+		return true;
+	}
+
+	item->packed_fd = out_fd;
+	item->unpacked = item->st.st_size;
+	item->st.st_size = packed;
+
+	// The header describes the packed member and marks it as packed
+	arhdr_decode(&item->hdr, &fields);
+	fields.size = packed;
+	fields.mode |= PACK_MODE;
+	arhdr_encode(&item->hdr, &fields);
+
+	return true;
+}
+
+void ar_pack_release(struct ar_append_item *items, size_t count) {
+	size_t i;
+
+	assert((items != NULL) || (count == 0));
+
+	for (i = 0; i < count; i++) {
+		if (items[i].packed_fd != -1) {
+			close(items[i].packed_fd);
+			items[i].packed_fd = -1;
+		}
+	}
+}
+
+void ar_pack_note(struct ar_member *member, const struct ar_append_item *item) {
+	assert(member != NULL);
+	assert(item != NULL);
+
+	if (item->unpacked >= 0) {
+		member->unpacked = item->unpacked;
+		member->hash = item->hash;
+	}
+}
+
+void ar_pack_check(struct archive *ar, struct ar_member *member,
+		const uint8_t *data, size_t len) {
+	assert(ar != NULL);
+	assert(member != NULL);
+	assert((data != NULL) || (len == 0));
+
+	// Thin members and the special ones are never packed, and nor is a
+	// member its header doesn't mark as packed
+	if (ar->thin || ((member->mode & PACK_MODE) == 0) ||
+			ar_is_special(member->name)) {
+		return;
+	}
+
+	if ((off_t)len > member->size) {
+		len = member->size;
+	}
+
+	pack_hdr_decode(data, len, &member->unpacked, &member->hash);
+}
+
+off_t ar_full_size(struct archive *ar, struct ar_member *member) {
+	assert(ar != NULL);
+	assert(member != NULL);
+
+	return (member->unpacked >= 0) ? member->unpacked : member->size;
+}
+
+bool ar_append_thin(struct archive *ar, struct ar_append_item *items,
+		size_t count) {
+	struct ar_hdr *hdrs;
+	struct stat dir_st;
+	struct stat cwd_st;
+	const char **names;
+	char **owned;
+	off_t *offsets;
+	off_t start;
+	size_t first;
+	size_t i;
+	bool relative;
+	bool ok;
+
+	assert(ar != NULL);
+	assert(ar->thin);
+	assert((items != NULL) || (count == 0));
+
+	if (count == 0) {
+		return true;
+	}
+
+	hdrs = (struct ar_hdr *)malloc(count * sizeof(struct ar_hdr));
+	names = (const char **)malloc(count * sizeof(const char *));
+	owned = (char **)calloc(count, sizeof(char *));
+	offsets = (off_t *)malloc(count * sizeof(off_t));
+	if ((hdrs == NULL) || (names == NULL) || (owned == NULL) ||
+			(offsets == NULL)) {
+		perror(NULL);
+		ok = false;
+		goto out;
+	}
+
+	// Paths are relative to the archive, so keep relative paths only when
+	// the archive is in the current directory
+	relative = (fstat(ar->dir_fd, &dir_st) == 0) && (stat(".", &cwd_st) == 0) &&
+			(dir_st.st_dev == cwd_st.st_dev) && (dir_st.st_ino == cwd_st.st_ino);
+
+	ok = true;
+	for (i = 0; i < count; i++) {
+		names[i] = items[i].path;
+		if ((relative == false) && (items[i].path[0] != '/')) {
+			owned[i] = realpath(items[i].path, NULL);
+			if (owned[i] == NULL) {
+				fprintf(stderr, "Failed to add %s to archive\n", items[i].path);
+				ok = false;
+				goto out;
+			}
+
+			names[i] = owned[i];
+		}
+	}
+
+	// Every path goes in the long name table
+	if (ar_names_add(ar, names, count, offsets) == false) {
+		ok = false;
+		goto out;
+	}
+
+	start = ar->size;
+	if ((start % 2) == 1) {
+		STATS_IO(STATS_WRITE, 0, sizeof(char));
+		if (pwrite(ar->fd, "\n", sizeof(char), start) == -1) {
+			perror("Write error");
+			ok = false;
+			goto out;
+		}
+
+		start++;
+	}
+
+	for (i = 0; i < count; i++) {
+		char name[SARFNAME + 1];
+
+		snprintf(name, SARFNAME + 1, "/%lld", (long long)offsets[i]);
+		ar_make_hdr(&hdrs[i], name, &items[i].st);
+	}
+
+	// The headers are the whole member, so write them all at once
+	if (block_write(ar->fd, (uint8_t *)hdrs, start,
+			count * sizeof(struct ar_hdr)) == false) {
+		fprintf(stderr, "Could not append files, archive left unchanged\n");
+		if (ftruncate(ar->fd, ar->size) == -1) {
+			perror("Could not truncate archive");
+		}
+
+		ok = false;
+		goto out;
+	}
+
+	ar->size = start + count * sizeof(struct ar_hdr);
+
+	first = ar->count;
+	for (i = 0; i < count; i++) {
+		if (ar_index_add(ar, &hdrs[i], start + i * sizeof(struct ar_hdr)) ==
+				false) {
+			ok = false;
+			goto out;
+		}
+	}
+
+	ok = ar_armap_update(ar, first);
+
+out:
+	if (owned != NULL) {
+		for (i = 0; i < count; i++) {
+			free(owned[i]);
+		}
+	}
+
+	free(hdrs);
+	free(names);
+	free(owned);
+	free(offsets);
+
+	return ok;
+}
+
+const char *ar_full_name(struct archive *ar, struct ar_member *member) {
+	assert(ar != NULL);
+	assert(member != NULL);
+
+	if ((member->long_name >= 0) &&
+			((size_t)member->long_name < ar->long_names_size)) {
+		return ar->long_names + member->long_name;
+	}
+
+	return member->name;
+}
+
+off_t ar_data_size(struct archive *ar, struct ar_member *member) {
+	assert(ar != NULL);
+	assert(member != NULL);
+
+	// Special members are stored even in thin archives
+	if (ar->thin && (ar_is_special(member->name) == false)) {
+		return 0;
+	}
+
+	return member->size;
+}
+
+bool ar_names_load(struct archive *ar) {
+	struct ar_member *table;
+	char *names;
+	size_t i;
+
+	assert(ar != NULL);
+
+	table = NULL;
+	for (i = 0; (i < ar->count) && (i < 2); i++) {
+		if (strcmp(ar->members[i].name, LONG_NAMES_NAME) == 0) {
+			table = &ar->members[i];
+		}
+	}
+
+	if (table == NULL) {
+		return true;
+	}
+
+	names = (char *)malloc(table->size + 1);
+	if (names == NULL) {
+		perror(NULL);
+		return false;
+	}
+
+	// An empty table is taken as it is, there is nothing to read
+	if ((table->size > 0) && (block_read(ar->fd, (uint8_t *)names,
+			table->offset + sizeof(struct ar_hdr), table->size) == false)) {
+		fprintf(stderr, "Error reading long name table\n");
+		free(names);
+		return false;
+	}
+
+	ar_names_take(ar, names, table->size);
+
+	return true;
+}
+
+void ar_names_take(struct archive *ar, char *names, size_t size) {
+	size_t i;
+
+	assert(ar != NULL);
+	assert(names != NULL);
+
+	// Names end in "/\n", null terminate them instead
+	for (i = 0; i < size; i++) {
+		if (names[i] == '\n') {
+			names[i] = '\0';
+			if ((i > 0) && (names[i - 1] == '/')) {
+				names[i - 1] = '\0';
+			}
+		}
+	}
+
+	names[size] = '\0';
+
+	free(ar->long_names);
+	ar->long_names = names;
+	ar->long_names_size = size;
+}
+
+bool ar_names_add(struct archive *ar, const char **names, size_t count,
+		off_t *offsets) {
+	struct ar_member *table;
+	struct ar_hdr hdr;
+	struct stat st;
+	char *long_names;
+	char *data;
+	size_t table_index;
+	size_t added;
+	size_t i;
+	off_t table_offset;
+	off_t old_span;
+	off_t size;
+	off_t end;
+	off_t delta;
+	bool ok;
+
+	assert(ar != NULL);
+	assert((names != NULL) || (count == 0));
+	assert((offsets != NULL) || (count == 0));
+
+	// The table follows the symbol table, if there is one
+	table_index = (ar_armap_member(ar) != NULL) ? 1 : 0;
+	table = NULL;
+	if ((table_index < ar->count) &&
+			(strcmp(ar->members[table_index].name, LONG_NAMES_NAME) == 0)) {
+		table = &ar->members[table_index];
+	}
+
+	if (table != NULL) {
+		table_offset = table->offset;
+		old_span = sizeof(struct ar_hdr) + table->size + (table->size % 2);
+	} else if (table_index > 0) {
+		table_offset = ar->members[0].offset + sizeof(struct ar_hdr) +
+				ar->members[0].size + (ar->members[0].size % 2);
+		old_span = 0;
+	} else {
+		table_offset = SARMAG;
+		old_span = 0;
+	}
+
+	// Symbols point at member offsets, which are about to change
+	if ((ar_armap_member(ar) != NULL) && (ar_armap_load(ar) == false)) {
+		return false;
+	}
+
+	added = 0;
+	for (i = 0; i < count; i++) {
+		added += strlen(names[i]) + 2;
+	}
+
+	size = (off_t)ar->long_names_size + added;
+	data = (char *)malloc(added + 1);
+	long_names = (char *)realloc(ar->long_names, size + 1);
+	if ((data == NULL) || (long_names == NULL)) {
+		perror(NULL);
+		free(data);
+		if (long_names != NULL) {
+			ar->long_names = long_names;
+		}
+
+		return false;
+	}
+
+	ar->long_names = long_names;
+
+	// Each name is written ending in "/\n" and kept in memory null terminated
+	added = 0;
+	for (i = 0; i < count; i++) {
+		size_t len = strlen(names[i]);
+
+		offsets[i] = ar->long_names_size + added;
+		memcpy(data + added, names[i], len);
+		memcpy(data + added + len, "/\n", 2);
+		memcpy(ar->long_names + offsets[i], names[i], len);
+		memset(ar->long_names + offsets[i] + len, '\0', 2);
+		added += len + 2;
+	}
+
+	ar->long_names[size] = '\0';
+
+	// Make room by moving everything behind the table
+	end = table_offset + old_span;
+	delta = sizeof(struct ar_hdr) + size + (size % 2) - old_span;
+	if ((ar->size > end) &&
+			(ar_shift_range(ar->fd, end, end + delta, ar->size - end) == false)) {
+		fprintf(stderr, "Archive may be corrupt\n");
+		free(data);
+		return false;
+	}
+
+	if ((size % 2) == 1) {
+		data[added] = '\n';
+	}
+
+	// Written with no owner, mode or date, as GNU ar does
+	memset(&st, 0, sizeof(struct stat));
+	st.st_size = size;
+	ar_make_hdr(&hdr, LONG_NAMES_NAME, &st);
+
+	ok = block_write(ar->fd, (uint8_t *)&hdr, table_offset,
+			sizeof(struct ar_hdr)) &&
+			block_write(ar->fd, (uint8_t *)data, table_offset +
+			sizeof(struct ar_hdr) + ar->long_names_size, added + (size % 2));
+
+	free(data);
+
+	ar->long_names_size = size;
+
+	if (ok == false) {
+		fprintf(stderr, "Archive may be corrupt\n");
+		return false;
+	}
+
+	if (ar_index_own(ar) == false) {
+		return false;
+	}
+
+	for (i = 0; i < ar->count; i++) {
+		if (ar->members[i].offset >= end) {
+			ar->members[i].offset += delta;
+		}
+	}
+
+	ar->size += delta;
+
+	if (table == NULL) {
+		if ((ar_index_add(ar, &hdr, table_offset) == false) ||
+				(ar_index_place(ar, table_index) == false)) {
+			return false;
+		}
+	} else {
+		ar->members[table_index].size = size;
+	}
+
+	if (ar_armap_member(ar) != NULL) {
+		armap_shift(&ar->armap, delta);
+		return ar_armap_write(ar);
+	}
+
+	return true;
+}
+
+struct ar_member *ar_armap_member(struct archive *ar) {
+	assert(ar != NULL);
+
+	// The symbol table is always the first member
+	if ((ar->count > 0) && ((strcmp(ar->members[0].name, ARMAP_NAME) == 0) ||
+			(strcmp(ar->members[0].name, ARMAP_NAME64) == 0))) {
+		return &ar->members[0];
+	}
+
+	return NULL;
+}
+
+bool ar_armap_load(struct archive *ar) {
+	struct ar_member *member;
+	uint8_t *data;
+	bool ok;
+
+	assert(ar != NULL);
+
+	if (ar->armap_loaded) {
+		return true;
+	}
+
+	member = ar_armap_member(ar);
+	// An empty table lists no symbols
+	if ((member == NULL) || (member->size == 0)) {
+		ar->armap_loaded = true;
+		return true;
+	}
+
+	data = (uint8_t *)malloc(member->size);
+	if (data == NULL) {
+		perror(NULL);
+		return false;
+	}
+
+	ok = block_read(ar->fd, data, member->offset + sizeof(struct ar_hdr),
+			member->size);
+	if (ok) {
+		ok = armap_decode(&ar->armap, data, member->size,
+				strcmp(member->name, ARMAP_NAME64) == 0);
+		if (ok == false) {
+			fprintf(stderr, "Malformed symbol table\n");
+			armap_free(&ar->armap);
+		}
+	}
+
+	free(data);
+
+	ar->armap_loaded = ok;
+
+	return ok;
+}
+
+bool ar_armap_scan(struct archive *ar, size_t first, size_t last,
+		struct armap *map) {
+	struct ar_armap_work work;
+	size_t i;
+	bool ok;
+
+	assert(ar != NULL);
+	assert(first <= last);
+	assert(last <= ar->count);
+	assert(map != NULL);
+
+	if (first == last) {
+		return true;
+	}
+
+	work.ar = ar;
+	work.first = first;
+	work.maps = (struct armap *)malloc((last - first) * sizeof(struct armap));
+	if (work.maps == NULL) {
+		perror(NULL);
+		return false;
+	}
+
+	for (i = 0; i < last - first; i++) {
+		armap_init(&work.maps[i]);
+	}
+
+	// Each member is parsed on its own, then the results are joined in order
+	ok = pool_run(last - first, ar->jobs, ar_armap_task, &work);
+
+	for (i = 0; i < last - first; i++) {
+		if (ok) {
+			ok = armap_merge(map, &work.maps[i]);
+		}
+
+		armap_free(&work.maps[i]);
+	}
+
+	free(work.maps);
+
+	return ok;
+}
+
+bool ar_armap_task(void *ctx, size_t task) {
+	struct ar_armap_work *work = (struct ar_armap_work *)ctx;
+	struct ar_member *member;
+
+	assert(work != NULL);
+
+	member = &work->ar->members[work->first + task];
+	if (ar_is_special(member->name)) {
+		return true;
+	}
+
+	// Thin members are read from the files they refer to
+	if (work->ar->thin) {
+		const char *name = ar_full_name(work->ar, member);
+		int fd = openat(work->ar->dir_fd, name, O_RDONLY);
+		bool ok;
+
+		STATS_IO(STATS_OPEN, 0, 0);
+		if (fd == -1) {
+			fprintf(stderr, "Could not open %s\n", name);
+			return false;
+		}
+
+		ok = armap_read_elf(&work->maps[task], fd, 0, member->size,
+				member->offset);
+		close(fd);
+
+		return ok;
+	}
+
+	return armap_read_elf(&work->maps[task], work->ar->fd,
+			member->offset + sizeof(struct ar_hdr), member->size,
+			member->offset);
+}
+
+bool ar_armap_update(struct archive *ar, size_t first) {
+	struct armap added;
+	bool ok;
+
+	assert(ar != NULL);
+	assert(first <= ar->count);
+
+	if ((ar->armap_wanted == false) || (first == ar->count)) {
+		return true;
+	}
+
+	// Only the new members need to be read
+	armap_init(&added);
+	ok = ar_armap_scan(ar, first, ar->count, &added);
+
+	if (ok && (ar_armap_member(ar) == NULL)) {
+		// Plain archives don't get a symbol table
+		if (added.count == 0) {
+			armap_free(&added);
+			return true;
+		}
+
+		// First symbols in the archive, pick up any the older members define
+		armap_free(&ar->armap);
+		ok = ar_armap_scan(ar, 0, first, &ar->armap);
+		ar->armap_loaded = ok;
+	} else if (ok) {
+		ok = ar_armap_load(ar);
+	}
+
+	if (ok) {
+		ok = armap_merge(&ar->armap, &added);
+	}
+
+	armap_free(&added);
+
+	if (ok == false) {
+		fprintf(stderr, "Could not update symbol table\n");
+		return false;
+	}
+
+	return ar_armap_write(ar);
+}
+
+bool ar_armap_rebuild(struct archive *ar) {
+	assert(ar != NULL);
+
+	fprintf(stderr, "Symbol table doesn't match the members, rebuilding it\n");
+
+	armap_free(&ar->armap);
+	ar->armap_loaded = ar_armap_scan(ar, 0, ar->count, &ar->armap);
+
+	return ar->armap_loaded;
+}
+
+size_t ar_armap_room(size_t size) {
+	size = 2 * size;
+
+	return (size < ARMAP_MIN_SIZE) ? ARMAP_MIN_SIZE : size + (size % 2);
 }
 
-bool ar_append(int fd, const char *path) {
+bool ar_armap_write(struct archive *ar) {
+	struct ar_member *member;
 	struct ar_hdr hdr;
 	struct stat st;
-	char name[SARFNAME + 1];
-	char date[SARFDATE + 1];
-	char uid[SARFUID + 1];
-	char gid[SARFGID + 1];
-	char mode[SARFMODE + 1];
-	char size[SARFSIZE + 1];
-	int append_fd;
+	uint8_t *data;
+	size_t size;
+	off_t old_span;
+	off_t delta;
+	bool wide;
+	bool ok;
+
+	assert(ar != NULL);
+	assert(ar->armap_loaded);
+
+	member = ar_armap_member(ar);
+
+	// Member offsets past 4 GiB need the wide format, allow for growth
+	wide = ((member != NULL) && (strcmp(member->name, ARMAP_NAME64) == 0)) ||
+			(ar->size + 2 * armap_size(&ar->armap, true) + ARMAP_MIN_SIZE >
+			UINT32_MAX);
+	size = armap_size(&ar->armap, wide);
+
+	// Reuse the table's space if it fits, otherwise grow it and move
+	// everything behind it
+	if ((member != NULL) && ((size_t)member->size >= size)) {
+		size = member->size;
+		delta = 0;
+	} else {
+		size = ar_armap_room(size);
+
+		old_span = 0;
+		if (member != NULL) {
+			old_span = sizeof(struct ar_hdr) + member->size + (member->size % 2);
+		}
+
+		delta = sizeof(struct ar_hdr) + size - old_span;
+		if ((ar->size > SARMAG + old_span) && (ar_shift_range(ar->fd,
+				SARMAG + old_span, SARMAG + old_span + delta,
+				ar->size - SARMAG - old_span) == false)) {
+			fprintf(stderr, "Archive may be corrupt\n");
+			return false;
+		}
+	}
 
-	stat(path, &st);
+	data = (uint8_t *)malloc(size);
+	if (data == NULL) {
+		perror(NULL);
+		return false;
+	}
 
-	append_fd = open(path, O_RDONLY);
+	if (delta > 0) {
+		size_t i;
 
-	if (append_fd < 0) {
-		// Report error
+		if (ar_index_own(ar) == false) {
+			free(data);
+			return false;
+		}
+
+		// Everything behind the table moved
+		for (i = (member != NULL) ? 1 : 0; i < ar->count; i++) {
+			ar->members[i].offset += delta;
+		}
+
+		armap_shift(&ar->armap, delta);
+		ar->size += delta;
+	}
+
+	// Written with no owner, mode or date, as GNU ar does
+	memset(&st, 0, sizeof(struct stat));
+	st.st_size = size;
+	ar_make_hdr(&hdr, wide ? ARMAP_NAME64 : ARMAP_NAME, &st);
+	armap_encode(&ar->armap, data, size, wide);
+
+	ok = block_write(ar->fd, (uint8_t *)&hdr, SARMAG, sizeof(struct ar_hdr)) &&
+			block_write(ar->fd, data, SARMAG + sizeof(struct ar_hdr), size);
+
+	free(data);
+
+	if (ok == false) {
+		fprintf(stderr, "Archive may be corrupt\n");
 		return false;
 	}
 
-	// Create NULL terminated versions of each header value
-	snprintf(name, SARFNAME + 1, "%-16s", path);
-	snprintf(date, SARFDATE + 1, "%12d", st.st_mtim.tv_sec);
-	snprintf(uid, SARFUID + 1, "%6u", st.st_uid);
-	snprintf(gid, SARFGID + 1, "%6u", st.st_gid);
-	snprintf(mode, SARFMODE + 1, "%8o", st.st_mode);
-	snprintf(size, SARFSIZE + 1, "%10d", st.st_size);
+	// Put the table at the front of the member table
+	if (member == NULL) {
+		return ar_index_add(ar, &hdr, SARMAG) && ar_index_place(ar, 0);
+	}
 
-	// Fill the header
-	memcpy(hdr.ar_name, name, SARFNAME);
-	memcpy(hdr.ar_date, date, SARFDATE);
-	memcpy(hdr.ar_uid, uid, SARFUID);
-	memcpy(hdr.ar_gid, gid, SARFGID);
-	memcpy(hdr.ar_mode, mode, SARFMODE);
-	memcpy(hdr.ar_size, size, SARFSIZE);
-	memcpy(hdr.ar_fmag, ARFMAG, SARFMAG);
+	if (ar_index_own(ar) == false) {
+		return false;
+	}
 
-	// Seek to end of file
-	lseek(fd, 0, SEEK_END);
+	strcpy(ar->members[0].name, wide ? ARMAP_NAME64 : ARMAP_NAME);
+	ar->members[0].size = size;
 
-	// If on an odd byte offset, write a newline
-	if ((lseek(fd, 0, SEEK_CUR) % 2) == 1) {
-		if (write(fd, "\n", sizeof(char)) == -1) {
-			// Report error
-			fprintf(stderr, "Write error (line %d)\n", __LINE__);
+	return ar_index_rehash(ar);
+}
 
-			// Clean up
-			close(append_fd);
+bool ar_make_hdr(struct ar_hdr *hdr, const char *path, struct stat *st) {
+	struct arhdr_fields fields;
+
+	assert(hdr != NULL);
+	assert(path != NULL);
+	assert(st != NULL);
+
+	// Names longer than the field are cut short
+	strncpy(fields.name, path, SARFNAME);
+	fields.name[SARFNAME] = '\0';
+	fields.date = st->st_mtim.tv_sec;
+	fields.uid = st->st_uid;
+	fields.gid = st->st_gid;
+	fields.mode = st->st_mode;
+	fields.size = st->st_size;
+
+	return arhdr_encode(hdr, &fields);
+}
+
+int ar_member_cmp_offset(const void *a, const void *b) {
+	const struct ar_member *ma = *(struct ar_member * const *)a;
+	const struct ar_member *mb = *(struct ar_member * const *)b;
+
+	assert(ma != NULL);
+	assert(mb != NULL);
+
+	if (ma->offset < mb->offset) {
+		return -1;
+	}
+
+	return (ma->offset > mb->offset) ? 1 : 0;
+}
+
+bool ar_index_build(struct archive *ar) {
+	uint8_t *window;
+	off_t want_end;
+	off_t base;
+	off_t len;
+	off_t pos;
+
+	assert(ar != NULL);
+	assert(ar->fd >= 0);
+	assert(ar->count == 0);
+
+	// Get file size
+	ar->size = lseek(ar->fd, 0, SEEK_END);
+
+	window = (uint8_t *)malloc(SCAN_SIZE);
+	if (window == NULL) {
+		perror(NULL);
+		return false;
+	}
+
+	// Start at the end of the global header
+	pos = SARMAG;
+	base = pos;
+	len = 0;
+
+	// For each member
+	while (pos < ar->size) {
+		struct ar_hdr *hdr;
+
+		// Only read when the next header, and enough of its data to tell if
+		// it is packed, aren't already in the window. Small members are read
+		// a large window at a time, a header found past the end of the window
+		// follows a large member so just peek at it.
+		want_end = pos + sizeof(struct ar_hdr) + PACK_HDR_SIZE;
+		if (want_end > ar->size) {
+			want_end = ar->size;
+		}
+
+		if ((pos + (off_t)sizeof(struct ar_hdr) > base + len) ||
+				(want_end > base + len)) {
+			off_t want = (pos > base + len) ? SCAN_PEEK_SIZE : SCAN_SIZE;
+
+			base = pos;
+			len = ((ar->size - pos) < want) ? (ar->size - pos) : want;
+			if ((len < (off_t)sizeof(struct ar_hdr)) ||
+					(block_read(ar->fd, window, base, len) == false)) {
+				fprintf(stderr, "Error reading header data\n");
+				free(window);
+				return false;
+			}
+		}
+
+		hdr = (struct ar_hdr *)(window + (pos - base));
 
+		// Verify file header
+		if (memcmp(hdr->ar_fmag, ARFMAG, SARFMAG) != 0) {
+			// Magic number incorrect
+			fprintf(stderr, "Magic number mismatch\n");
+			free(window);
 			return false;
 		}
+
+		STATS_HEADERS(1);
+		if (ar_index_add(ar, hdr, pos) == false) {
+			free(window);
+			return false;
+		}
+
+		ar_pack_check(ar, &ar->members[ar->count - 1],
+				window + (pos - base) + sizeof(struct ar_hdr),
+				base + len - pos - sizeof(struct ar_hdr));
+
+		// Later members may be named in the long name table
+		if ((strcmp(ar->members[ar->count - 1].name, LONG_NAMES_NAME) == 0) &&
+				(ar_names_load(ar) == false)) {
+			free(window);
+			return false;
+		}
+
+		// Skip to the next header
+		pos += sizeof(struct ar_hdr) +
+				ar_data_size(ar, &ar->members[ar->count - 1]);
+
+		// If on an odd byte offset, skip ahead one byte
+		if ((pos % 2) == 1) {
+			pos++;
+		}
 	}
 
-	// Write the header
-	if (write(fd, &hdr, sizeof(struct ar_hdr)) == -1) {
-		// Report error
-		fprintf(stderr, "Write error (line %d)\n", __LINE__);
+	free(window);
 
-		// Clean up
-		close(append_fd);
+	return true;
+}
 
+bool ar_index_load(struct archive *ar) {
+	struct ar_index_hdr hdr;
+	struct stat st;
+	struct stat index_st;
+	uint8_t *map;
+	int fd;
+
+	assert(ar != NULL);
+	assert(ar->index_path != NULL);
+	assert(ar->count == 0);
+
+	fd = open(ar->index_path, O_RDONLY);
+	STATS_IO(STATS_OPEN, 0, 0);
+	if (fd == -1) {
 		return false;
 	}
 
-	// Read data from file and append to archive block by block
-	while (lseek(append_fd, 0, SEEK_CUR) < st.st_size) {
-		char buf[BLOCK_SIZE];
-		off_t remaining = st.st_size - lseek(append_fd, 0, SEEK_CUR);
-		size_t wr_size = (remaining < BLOCK_SIZE) ? remaining : BLOCK_SIZE;
+	// Keep an existing index file up to date even if it is stale now
+	ar->index_wanted = true;
 
-		if (read(append_fd, buf, wr_size) == -1) {
-			// Report error
-			fprintf(stderr, "Read error (line %d)\n", __LINE__);
+	STATS_IO(STATS_READ, sizeof(hdr), 0);
+	if ((fstat(ar->fd, &st) == -1) || (fstat(fd, &index_st) == -1) ||
+			(pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))) {
+		close(fd);
+		return false;
+	}
 
-			// Clean up
-			close(append_fd);
+	// Only trust an index written for this exact archive by this build
+	if ((memcmp(hdr.magic, INDEX_MAGIC, SINDEXMAG) != 0) ||
+			(hdr.byte_order != INDEX_BYTE_ORDER) ||
+			(hdr.abi != ar_index_abi()) ||
+			(hdr.member_size != sizeof(struct ar_member)) ||
+			(hdr.ar_size != st.st_size) ||
+			(hdr.ar_mtime != st.st_mtim.tv_sec) ||
+			(hdr.ar_mtime_nsec != st.st_mtim.tv_nsec) ||
+			(hdr.nbuckets == 0) ||
+			((hdr.nbuckets & (hdr.nbuckets - 1)) != 0) ||
+			(hdr.count > hdr.nbuckets) ||
+			((uint64_t)index_st.st_size != sizeof(hdr) +
+				hdr.nbuckets * sizeof(size_t) +
+				hdr.count * sizeof(struct ar_member))) {
+		close(fd);
+		return false;
+	}
+
+	// Pages are only read as lookups touch them
+	map = (uint8_t *)mmap(NULL, index_st.st_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE, fd, 0);
+	STATS_IO(STATS_MMAP, 0, 0);
+	close(fd);
+
+	if (map == MAP_FAILED) {
+		return false;
+	}
+
+	ar->index_map = map;
+	ar->index_map_size = index_st.st_size;
+	ar->buckets = (size_t *)(map + sizeof(hdr));
+	ar->nbuckets = hdr.nbuckets;
+	ar->members = (struct ar_member *)(ar->buckets + hdr.nbuckets);
+	ar->count = hdr.count;
+	ar->capacity = hdr.count;
+	ar->size = st.st_size;
+	ar->index_fresh = true;
+
+	return true;
+}
+
+uint64_t ar_index_abi(void) {
+	return (uint64_t)sizeof(size_t) | ((uint64_t)sizeof(off_t) << 8) |
+			((uint64_t)sizeof(time_t) << 16) | ((uint64_t)sizeof(uid_t) << 24) |
+			((uint64_t)sizeof(gid_t) << 32) | ((uint64_t)sizeof(mode_t) << 40) |
+			((uint64_t)offsetof(struct ar_member, next) << 48);
+}
+
+bool ar_index_save(struct archive *ar) {
+	struct ar_index_hdr hdr;
+	struct stat st;
+	char *temp_path;
+	off_t pos;
+	int fd;
+	bool ok;
+
+	assert(ar != NULL);
+	assert(ar->index_path != NULL);
+
+	if ((ar->nbuckets == 0) && (ar_index_rehash(ar) == false)) {
+		return false;
+	}
+
+	if (fstat(ar->fd, &st) == -1) {
+		perror("Could not stat archive");
+		return false;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, INDEX_MAGIC, SINDEXMAG);
+	hdr.member_size = sizeof(struct ar_member);
+	hdr.byte_order = INDEX_BYTE_ORDER;
+	hdr.abi = ar_index_abi();
+	hdr.ar_size = st.st_size;
+	hdr.ar_mtime = st.st_mtim.tv_sec;
+	hdr.ar_mtime_nsec = st.st_mtim.tv_nsec;
+	hdr.count = ar->count;
+	hdr.nbuckets = ar->nbuckets;
+
+	// Write a new file and move it into place so readers never see half of it
+	temp_path = (char *)malloc(strlen(ar->index_path) + sizeof(".XXXXXX"));
+	if (temp_path == NULL) {
+		perror(NULL);
+		return false;
+	}
+
+	strcpy(temp_path, ar->index_path);
+	strcat(temp_path, ".XXXXXX");
+
+	fd = mkstemp(temp_path);
+	STATS_IO(STATS_OPEN, 0, 0);
+	if (fd == -1) {
+		perror("Could not create index file");
+		free(temp_path);
+		return false;
+	}
+
+	// Readable by whoever can read the archive
+	fchmod(fd, st.st_mode & PERM_MASK);
+
+	pos = 0;
+	ok = block_write(fd, (uint8_t *)&hdr, pos, sizeof(hdr));
+	pos += sizeof(hdr);
+	ok = ok && block_write(fd, (uint8_t *)ar->buckets, pos,
+			ar->nbuckets * sizeof(size_t));
+	pos += ar->nbuckets * sizeof(size_t);
+	if (ar->count > 0) {
+		ok = ok && block_write(fd, (uint8_t *)ar->members, pos,
+				ar->count * sizeof(struct ar_member));
+	}
+
+	if (close(fd) == -1) {
+		ok = false;
+	}
+
+	if (ok && (rename(temp_path, ar->index_path) == -1)) {
+		perror("Could not write index file");
+		ok = false;
+	}
+
+	if (ok == false) {
+		unlink(temp_path);
+	}
+
+	free(temp_path);
+
+	return ok;
+}
+
+bool ar_index_own(struct archive *ar) {
+	struct ar_member *members;
+	size_t *buckets;
+	size_t capacity;
+
+	assert(ar != NULL);
+
+	if (ar->index_map == NULL) {
+		return true;
+	}
+
+	capacity = (ar->count < INDEX_INIT_SIZE) ? INDEX_INIT_SIZE : ar->count;
+	members = (struct ar_member *)malloc(capacity * sizeof(struct ar_member));
+	buckets = (size_t *)malloc(ar->nbuckets * sizeof(size_t));
+	if ((members == NULL) || (buckets == NULL)) {
+		perror(NULL);
+		free(members);
+		free(buckets);
+		return false;
+	}
+
+	memcpy(members, ar->members, ar->count * sizeof(struct ar_member));
+	memcpy(buckets, ar->buckets, ar->nbuckets * sizeof(size_t));
+	munmap(ar->index_map, ar->index_map_size);
+
+	ar->index_map = NULL;
+	ar->members = members;
+	ar->buckets = buckets;
+	ar->capacity = capacity;
+
+	return true;
+}
 
+bool ar_index_add(struct archive *ar, struct ar_hdr *hdr, off_t offset) {
+	struct arhdr_fields fields;
+	struct ar_member *member;
+	size_t bucket;
+
+	assert(ar != NULL);
+	assert(hdr != NULL);
+
+	if (ar_index_own(ar) == false) {
+		return false;
+	}
+
+	ar->index_fresh = false;
+
+	// Grow the table, keeping at least one bucket per member
+	if (ar->count == ar->capacity) {
+		size_t capacity;
+		struct ar_member *members;
+
+		capacity = (ar->capacity == 0) ? INDEX_INIT_SIZE : ar->capacity * 2;
+		members = (struct ar_member *)realloc(ar->members,
+				capacity * sizeof(struct ar_member));
+		if (members == NULL) {
+			perror(NULL);
 			return false;
 		}
 
-		if (write(fd, buf, wr_size) == -1) {
-			// Report error
-			fprintf(stderr, "Write error (line %d)\n", __LINE__);
+		ar->members = members;
+		ar->capacity = capacity;
+	}
 
-			// Clean up
-			close(append_fd);
+	member = &ar->members[ar->count++];
+
+	// Decode the whole header at once
+	arhdr_decode(hdr, &fields);
+	memcpy(member->name, fields.name, sizeof(member->name));
+	member->offset = offset;
+	member->size = fields.size;
+	member->date = fields.date;
+	member->uid = fields.uid;
+	member->gid = fields.gid;
+	member->mode = fields.mode;
+	member->hash = 0;
+	member->unpacked = -1;
+
+	// GNU ar stores long names as "/" and an offset into the name table
+	member->long_name = -1;
+	if ((member->name[0] == '/') && isdigit((unsigned char)member->name[1])) {
+		member->long_name = strtoll(member->name + 1, NULL, 10);
+	}
+
+	if (ar->nbuckets < ar->capacity) {
+		return ar_index_rehash(ar);
+	}
+
+	// Link into the front of its chain
+	bucket = hash_name(ar_full_name(ar, member)) & (ar->nbuckets - 1);
+	member->next = ar->buckets[bucket];
+	ar->buckets[bucket] = ar->count - 1;
 
+	return true;
+}
+
+bool ar_index_rehash(struct archive *ar) {
+	size_t nbuckets;
+	size_t i;
+
+	assert(ar != NULL);
+
+	if (ar_index_own(ar) == false) {
+		return false;
+	}
+
+	ar->index_fresh = false;
+
+	// Size the table to a power of two no smaller than the member capacity
+	nbuckets = INDEX_INIT_SIZE;
+	while (nbuckets < ar->capacity) {
+		nbuckets *= 2;
+	}
+
+	if (nbuckets != ar->nbuckets) {
+		size_t *buckets;
+
+		buckets = (size_t *)realloc(ar->buckets, nbuckets * sizeof(size_t));
+		if (buckets == NULL) {
+			perror(NULL);
 			return false;
 		}
+
+		ar->buckets = buckets;
+		ar->nbuckets = nbuckets;
+	}
+
+	for (i = 0; i < ar->nbuckets; i++) {
+		ar->buckets[i] = INDEX_NONE;
+	}
+
+	// Link each member into the front of its chain
+	for (i = 0; i < ar->count; i++) {
+		size_t bucket = hash_name(ar_full_name(ar, &ar->members[i])) &
+				(ar->nbuckets - 1);
+
+		ar->members[i].next = ar->buckets[bucket];
+		ar->buckets[bucket] = i;
 	}
 
 	return true;
 }
 
-bool ar_remove(int fd, const char *name) {
-	struct ar_hdr hdr;
-	struct stat st;
-	uint8_t *buf;
-	int temp_fd;
-
-	assert(fd >= 0);
+bool ar_index_place(struct archive *ar, size_t pos) {
+	struct ar_member member;
+
+	assert(ar != NULL);
+	assert(pos < ar->count);
+
+	if (ar_index_own(ar) == false) {
+		return false;
+	}
+
+	member = ar->members[ar->count - 1];
+	memmove(&ar->members[pos + 1], &ar->members[pos],
+			(ar->count - 1 - pos) * sizeof(struct ar_member));
+	ar->members[pos] = member;
+
+	return ar_index_rehash(ar);
+}
+
+struct ar_member *ar_index_find(struct archive *ar, const char *name) {
+	struct ar_member *found;
+	size_t i;
+
+	assert(ar != NULL);
+	assert(name != NULL);
+
+	if ((ar->nbuckets == 0) || ar_is_special(name)) {
+		return NULL;
+	}
+
+	// Chains run from the newest member to the oldest, keep the oldest match
+	found = NULL;
+	i = ar->buckets[hash_name(name) & (ar->nbuckets - 1)];
+	while (i < ar->count) {
+		if (strcmp(ar_full_name(ar, &ar->members[i]), name) == 0) {
+			found = &ar->members[i];
+		}
+
+		i = ar->members[i].next;
+	}
+
+	return found;
+}
+
+void ar_mode_str(mode_t mode, char *str) {
+	assert(str != NULL);
+	
+	// Check each file permission
+	str[0] = (mode & S_IRUSR) ? 'r' : '-';
+	str[1] = (mode & S_IWUSR) ? 'w' : '-';
+	str[2] = (mode & S_IXUSR) ? 'x' : '-';
+	str[3] = (mode & S_IRGRP) ? 'r' : '-';
+	str[4] = (mode & S_IWGRP) ? 'w' : '-';
+	str[5] = (mode & S_IXGRP) ? 'x' : '-';
+	str[6] = (mode & S_IROTH) ? 'r' : '-';
+	str[7] = (mode & S_IWOTH) ? 'w' : '-';
+	str[8] = (mode & S_IXOTH) ? 'x' : '-';
+	str[9] = '\0';
+}
+
+bool ar_is_special(const char *name) {
 	assert(name != NULL);
 
-	fstat(fd, &st);
-
-	// Open a temporary file
-	temp_fd = open(TEMP_AR_NAME, O_CREAT | O_TRUNC | O_RDWR, DEFAULT_PERMS);
-	write(temp_fd, ARMAG, SARMAG);
-	lseek(fd, SARMAG, SEEK_SET);
-
-	// For each file in the archive
-	while (lseek(fd, 0, SEEK_CUR) < st.st_size) {
-		char member_name[SARFNAME + 1];
-		size_t size;
-		off_t next_member;
-		off_t pos;
+	return (name[0] == '/') && ((strcmp(name, ARMAP_NAME) == 0) ||
+			(strcmp(name, ARMAP_NAME64) == 0) ||
+			(strcmp(name, LONG_NAMES_NAME) == 0));
+}
 
-		ar_load_hdr(fd, &hdr);
-		size = ar_member_size(&hdr);
-		ar_member_name(&hdr, member_name);
+bool ar_copy_range(int in_fd, off_t from, int out_fd, off_t to, off_t size) {
+	uint8_t buf[COPY_SIZE];
+	off_t done;
 
-		// Remove the member?
-		if (strcmp(member_name, name) == 0) {
-			// Skip the file
-			lseek(fd, size, SEEK_CUR);
-		} else {
-			// Write a newline if we're not on an even byte boundary
-			if ((lseek(temp_fd, 0, SEEK_CUR) % 2) == 1) {
-				write(temp_fd, "\n", sizeof(char));
-			}
+	assert(in_fd >= 0);
+	assert(out_fd >= 0);
+	assert(from >= 0);
+	assert(to >= 0);
+	assert(size >= 0);
 
-			// Write the header
-			write(temp_fd, &hdr, sizeof(struct ar_hdr));
+	done = 0;
+	while (done < size) {
+		size_t count = ((size - done) < COPY_SIZE) ? (size - done) : COPY_SIZE;
 
-			// Copy data to the temp file
-			if (size > 0) {
-				buf = (uint8_t *)malloc(size * sizeof(uint8_t));
-				block_read(fd, buf, lseek(fd, 0, SEEK_CUR), size);
-				block_write(temp_fd, buf, lseek(temp_fd, 0, SEEK_CUR), size);
-				free(buf);
-			}
+		if (block_read(in_fd, buf, from + done, count) == false) {
+			return false;
 		}
 
-		// Seek to even byte boundary
-		if ((lseek(fd, 0, SEEK_CUR) % 2) == 1) {
-			lseek(fd, 1, SEEK_CUR);
+		if (block_write(out_fd, buf, to + done, count) == false) {
+			return false;
 		}
-	}
 
-	// Clear archive
-	if (ftruncate(fd, 0) == -1) {
-		perror("Could not truncate archive");
-	}
-
-	if (fstat(temp_fd, &st) == -1) {
-		perror("Could not stat temp file");
+		done += count;
 	}
 
-	// Copy contents of temp file to archive
-	buf = (uint8_t *)malloc(st.st_size * sizeof(uint8_t));
-	block_read(temp_fd, buf, lseek(temp_fd, 0, SEEK_SET), st.st_size);
-	block_write(fd, buf, lseek(fd, 0, SEEK_SET), st.st_size);
-
-	// Close and remove the temp archive
-	close(temp_fd);
-	unlink(TEMP_AR_NAME);
-
 	return true;
 }
 
-bool ar_extract(int fd, const char *name) {
-	struct ar_hdr hdr;
-	struct utimbuf tbuf;
-	size_t size;
-	size_t written;
-	int extract_fd;
+bool ar_send_range(int in_fd, off_t from, int out_fd, off_t to, off_t size,
+		bool shared) {
+	off_t done;
 
-	assert(fd >= 0);
-	assert(name != NULL);
+	assert(in_fd >= 0);
+	assert(out_fd >= 0);
+	assert(in_fd != out_fd);
+	assert(from >= 0);
+	assert(to >= 0);
+	assert(size >= 0);
 
-	// Find the member
-	if (ar_seek(fd, name, &hdr) == false) {
-		printf("File %s not found in archive\n", name);
-		return false;
-	}
+	// Let the kernel copy, and possibly share, the data between files
+	done = 0;
+	while (done < size) {
+		off_t in = from + done;
+		off_t out = to + done;
+		size_t count = ((size - done) < IO_MAX) ? (size - done) : IO_MAX;
+		ssize_t n = copy_file_range(in_fd, &in, out_fd, &out, count, 0);
+
+		STATS_IO(STATS_COPY_RANGE, (n > 0) ? n : 0, (n > 0) ? n : 0);
+		if (n <= 0) {
+			break;
+		}
 
-	// Create a file to extract to
-	extract_fd = creat(name, DEFAULT_PERMS);
-	if (extract_fd == -1) {
-		perror("Could not open file for extraction");
-		return false;
+		done += n;
 	}
 
-	size = ar_member_size(&hdr);
-	written = 0;
+	// Not supported between these files, try sendfile() which writes at the
+	// output's file position
+	if ((done < size) && (shared == false) &&
+			(lseek(out_fd, to + done, SEEK_SET) != -1)) {
+		while (done < size) {
+			off_t in = from + done;
+			size_t count = ((size - done) < IO_MAX) ? (size - done) : IO_MAX;
+			ssize_t n = sendfile(out_fd, in_fd, &in, count);
+
+			STATS_IO(STATS_SENDFILE, (n > 0) ? n : 0, (n > 0) ? n : 0);
+			if (n <= 0) {
+				break;
+			}
 
-	// Write the data to the file block by block
-	while (written < size) {
-		char buf[BLOCK_SIZE];
-		size_t wr_size;
+			done += n;
+		}
+	}
 
-		wr_size = (size - written < BLOCK_SIZE) ? size - written : BLOCK_SIZE;
+	// The kernel's copies stop short at the end of the source, and mapping
+	// past it faults, so a source shorter than the range is reported here
+	if (done < size) {
+		struct stat st;
 
-		if (read(fd, buf, wr_size) == -1) {
+		if (fstat(in_fd, &st) == -1) {
 			perror("Read error");
-			close(extract_fd);
 			return false;
 		}
 
-		if (write(extract_fd, buf, wr_size) == -1) {
-			perror("Write error");
-			close(extract_fd);
+		if (st.st_size < from + size) {
+			fprintf(stderr, "Member data is truncated\n");
 			return false;
 		}
-
-		written += wr_size;
-	}
-	
-	if (close(extract_fd) == -1) {
-		perror("Could not close file");
-		close(extract_fd);
-		return false;
 	}
-	
-	// Set file modification time
-	tbuf.actime = ar_member_date(&hdr);
-	tbuf.modtime = ar_member_date(&hdr);
 
-	if (utime(name, &tbuf) == -1) {
-		perror("Unable set modification time");
-		close(extract_fd);
-		return false;
-	}
+	// Map the source and write straight out of the page cache
+	while (done < size) {
+		off_t in = from + done;
+		off_t base = in - (in % sysconf(_SC_PAGESIZE));
+		size_t len = ((size - done) < MAP_SIZE) ? (size - done) : MAP_SIZE;
+		uint8_t *map;
+		bool written;
+
+		map = (uint8_t *)mmap(NULL, len + (in - base), PROT_READ, MAP_SHARED,
+				in_fd, base);
+		if (map == MAP_FAILED) {
+			STATS_IO(STATS_MMAP, 0, 0);
+			break;
+		}
 
-	return true;
-}
+		// The write pulls the data in through the mapping
+		STATS_IO(STATS_MMAP, len, 0);
 
-void ar_print_concise(int fd) {
-	off_t ar_size;
+		written = block_write(out_fd, map + (in - base), to + done, len);
+		munmap(map, len + (in - base));
 
-	assert(fd >= 0);
+		if (written == false) {
+			return false;
+		}
 
-	ar_size = lseek(fd, 0, SEEK_END);
-	lseek(fd, SARMAG, SEEK_SET);
+		done += len;
+	}
 
-	// For each member
-	while (lseek(fd, 0, SEEK_CUR) < ar_size) {
-		struct ar_hdr hdr;
-		char name[SARFNAME + 1];
+	// Copy whatever is left through user space
+	return ar_copy_range(in_fd, from + done, out_fd, to + done, size - done);
+}
 
-		if (ar_load_hdr(fd, &hdr) == false) {
-			// Report error
-			fprintf(stderr, "Could not load ar_hdr (line %d)\n", __LINE__);
-			return;
-		}
+bool ar_move_range(int fd, off_t from, off_t to, off_t size) {
+	off_t done;
 
-		ar_member_name(&hdr, name);
-		printf("%s\n", name);
+	assert(fd >= 0);
+	assert(from > to);
+	assert(to >= 0);
+	assert(size >= 0);
 
-		// Skip past data
-		lseek(fd, ar_member_size(&hdr), SEEK_CUR);
+	// copy_file_range() refuses overlapping ranges within a file, so copy in
+	// pieces no larger than the distance being moved. Short moves are left to
+	// the buffered copy, which handles overlap when moving toward the front.
+	done = 0;
+	if (from - to >= COPY_SIZE) {
+		while (done < size) {
+			off_t in = from + done;
+			off_t out = to + done;
+			off_t count = ((size - done) < (from - to)) ? (size - done) : (from - to);
+			ssize_t n = copy_file_range(fd, &in, fd, &out,
+					(count < IO_MAX) ? count : IO_MAX, 0);
+
+			STATS_IO(STATS_COPY_RANGE, (n > 0) ? n : 0, (n > 0) ? n : 0);
+			if (n <= 0) {
+				break;
+			}
 
-		// If on an odd byte offset, seek ahead one byte
-		if ((lseek(fd, 0, SEEK_CUR) % 2) == 1) {
-			lseek(fd, 1, SEEK_CUR);
+			done += n;
 		}
 	}
+
+	return ar_copy_range(fd, from + done, fd, to + done, size - done);
 }
 
-void ar_print_verbose(int fd) {
-	off_t ar_size;
+bool ar_shift_range(int fd, off_t from, off_t to, off_t size) {
+	off_t step;
+	off_t left;
 
 	assert(fd >= 0);
-
-	ar_size = lseek(fd, 0, SEEK_END);
-	lseek(fd, SARMAG, SEEK_SET);
-
-	// For each member
-	while (lseek(fd, 0, SEEK_CUR) < ar_size) {
-		struct ar_hdr hdr;
-		struct tm *time;
-		char name[SARFNAME + 1];
-		char ftime[SFTIME];
-		char mode[SFMODE];
-		time_t mtime;
-
-		if (ar_load_hdr(fd, &hdr) == false) {
-			// Report error
-			fprintf(stderr, "Could not load ar_hdr (line %d)\n", __LINE__);
-			return;
+	assert(to > from);
+	assert(from >= 0);
+	assert(size >= 0);
+
+	// Pieces no larger than the distance don't overlap their destination,
+	// so copy_file_range() can take them. Short moves are buffered a piece
+	// at a time instead.
+	step = (to - from >= COPY_SIZE) ? (to - from) : COPY_SIZE;
+	left = size;
+	while (left > 0) {
+		off_t count = (left < step) ? left : step;
+		off_t done = 0;
+
+		left -= count;
+		if (to - from >= COPY_SIZE) {
+			while (done < count) {
+				off_t in = from + left + done;
+				off_t out = to + left + done;
+				ssize_t n = copy_file_range(fd, &in, fd, &out,
+						((count - done) < IO_MAX) ? (count - done) : IO_MAX, 0);
+
+				STATS_IO(STATS_COPY_RANGE, (n > 0) ? n : 0, (n > 0) ? n : 0);
+				if (n <= 0) {
+					break;
+				}
+
+				done += n;
+			}
 		}
 
-		ar_member_name(&hdr, name);
-		ar_mode_str(ar_member_mode(&hdr), mode);
-		
-		mtime = ar_member_date(&hdr);
-		time = localtime(&mtime);
-		strftime(ftime, SFTIME, "%b %d %H:%M %Y", time);
-		
-		printf("%s %6d/%-6d %10d %s %s\n",
-			mode,
-			ar_member_uid(&hdr),
-			ar_member_gid(&hdr),
-			ar_member_size(&hdr),
-			ftime,
-			name);
-
-		// Skip past data
-		lseek(fd, ar_member_size(&hdr), SEEK_CUR);
-
-		// If on an odd byte offset, seek ahead one byte
-		if ((lseek(fd, 0, SEEK_CUR) % 2) == 1) {
-			lseek(fd, 1, SEEK_CUR);
+		if (ar_copy_range(fd, from + left + done, fd, to + left + done,
+				count - done) == false) {
+			return false;
 		}
 	}
+
+	return true;
 }
 
-bool ar_check_global_hdr(int fd) {
-	char hdr[SARMAG];
-	int init_pos;
-	bool hdr_good;
+bool ar_hash_range(int fd, off_t from, off_t size, uint64_t *hash) {
+	struct hash_state state;
+	uint8_t *buf;
+	off_t done;
 
 	assert(fd >= 0);
+	assert(hash != NULL);
 
-	// Remember initial position
-   	init_pos = lseek(fd, 0, SEEK_CUR);
-
-	lseek(fd, 0, SEEK_SET);
-
-	if (read(fd, hdr, SARMAG) == -1) {
-		// Report error
-		fprintf(stderr, "Read error (line %d)\n", __LINE__);
-
+	buf = (uint8_t *)malloc(COPY_SIZE);
+	if (buf == NULL) {
+		perror(NULL);
 		return false;
 	}
 
-	// Verify the header is valid
-	hdr_good = (memcmp(hdr, ARMAG, SARMAG) == 0);
-
-	// Reset file position
-	lseek(fd, init_pos, SEEK_SET);
-
-	return hdr_good;
-}
-
-bool ar_write_global_hdr(int fd) {
-	assert(fd >= 0);
+	hash_init(&state);
+	for (done = 0; done < size; done += COPY_SIZE) {
+		size_t count = ((size - done) < COPY_SIZE) ? (size - done) : COPY_SIZE;
 
-	lseek(fd, 0, SEEK_SET);
+		if (block_read(fd, buf, from + done, count) == false) {
+			free(buf);
+			return false;
+		}
 
-	if (write(fd, ARMAG, SARMAG) == -1) {
-		fprintf(stderr, "Write error (line %d)\n", __LINE__);
-		return false;
+		hash_update(&state, buf, count);
 	}
 
+	*hash = hash_final(&state);
+	free(buf);
+
 	return true;
 }
 
-bool ar_load_hdr(int fd, struct ar_hdr *hdr) {
+bool ar_collapse_range(int fd, off_t offset, off_t len) {
+	struct stat st;
+
 	assert(fd >= 0);
-	assert(hdr);
+	assert(offset >= 0);
+	assert(len > 0);
 
-	if (read(fd, hdr, sizeof(struct ar_hdr)) == -1) {
-		fprintf(stderr, "Error reading header data\n");
+	// Collapsing only works on whole filesystem blocks
+	if (fstat(fd, &st) == -1) {
 		return false;
 	}
 
-	// Verify file header
-	if (memcmp(hdr->ar_fmag, ARFMAG, SARFMAG) != 0) {
-		// Magic number incorrect
-		fprintf(stderr, "Magic number mismatch\n");
+	if (((offset % st.st_blksize) != 0) || ((len % st.st_blksize) != 0)) {
 		return false;
 	}
 
-	return true;
+	return fallocate(fd, FALLOC_FL_COLLAPSE_RANGE, offset, len) == 0;
 }
 
-bool ar_seek(int fd, const char *name, struct ar_hdr *hdr) {
-	off_t size;
-
-	assert(fd >= 0);
-	assert(name != NULL);
+bool ar_clone_range(int in_fd, off_t from, int out_fd, off_t to, off_t size) {
+	struct file_clone_range clone;
+	struct stat st;
+	off_t head;
+	off_t body;
 
-	// Get file size
-	size = lseek(fd, 0, SEEK_END);
+	assert(in_fd >= 0);
+	assert(out_fd >= 0);
+	assert(from >= 0);
+	assert(to >= 0);
+	assert(size >= 0);
 
-	// Seek to end of global header
-	lseek(fd, SARMAG, SEEK_SET);
+	if (size == 0) {
+		return true;
+	}
 
-	// For each member
-	while (lseek(fd, 0, SEEK_CUR) < size) {
-		char member_name[SARFNAME + 1];
-		if (ar_load_hdr(fd, hdr) == false) {
-			return false;
-		}
+	// Blocks can only be shared if the range sits the same way in both files
+	if ((fstat(out_fd, &st) == -1) || ((from % st.st_blksize) !=
+			(to % st.st_blksize))) {
+		return ar_send_range(in_fd, from, out_fd, to, size, false);
+	}
 
-		// Did we find our file?
-		ar_member_name(hdr, member_name);
-		if (strcmp(name, member_name) == 0) {
-			// Yes
-			return true;
-		}
+	// Share the whole blocks in the middle, copy the pieces either side
+	head = (st.st_blksize - (from % st.st_blksize)) % st.st_blksize;
+	body = (size > head) ? (size - head) / st.st_blksize * st.st_blksize : 0;
+	if (body == 0) {
+		return ar_send_range(in_fd, from, out_fd, to, size, false);
+	}
 
-		// Seek to the next header
-		lseek(fd, ar_member_size(hdr), SEEK_CUR);
+	clone.src_fd = in_fd;
+	clone.src_offset = from + head;
+	clone.src_length = body;
+	clone.dest_offset = to + head;
+	STATS_IO(STATS_CLONE, 0, 0);
+	if (ioctl(out_fd, FICLONERANGE, &clone) == -1) {
+		return ar_send_range(in_fd, from, out_fd, to, size, false);
+	}
 
-		// If on an odd byte offset, seek ahead one byte
-		if ((lseek(fd, 0, SEEK_CUR) % 2) == 1) {
-			lseek(fd, 1, SEEK_CUR);
-		}
+	if ((head > 0) &&
+			(ar_send_range(in_fd, from, out_fd, to, head, false) == false)) {
+		return false;
 	}
 
-	return false;
-}
+	if (head + body < size) {
+		return ar_send_range(in_fd, from + head + body, out_fd,
+				to + head + body, size - head - body, false);
+	}
 
-void ar_mode_str(mode_t mode, char *str) {
-	assert(str != NULL);
-	
-	// Check each file permission
-	str[0] = (mode & S_IRUSR) ? 'r' : '-';
-	str[1] = (mode & S_IWUSR) ? 'w' : '-';
-	str[2] = (mode & S_IXUSR) ? 'x' : '-';
-	str[3] = (mode & S_IRGRP) ? 'r' : '-';
-	str[4] = (mode & S_IWGRP) ? 'w' : '-';
-	str[5] = (mode & S_IXGRP) ? 'x' : '-';
-	str[6] = (mode & S_IROTH) ? 'r' : '-';
-	str[7] = (mode & S_IWOTH) ? 'w' : '-';
-	str[8] = (mode & S_IXOTH) ? 'x' : '-';
-	str[9] = '\0';
+	return true;
 }
 
-void ar_member_name(struct ar_hdr *hdr, char *name) {
-	assert(hdr != NULL);
-
-	memset(name, '\0', SARFNAME + 1);
-	memcpy(name, hdr->ar_name, SARFNAME);
+bool block_read(int fd, uint8_t *buf, off_t from, size_t size) {
+	size_t done;
 
-	// Ensure that there are no trailing spaces or slashes
-	while ((name[strlen(name) - 1] == ' ') || (name[strlen(name) - 1] == '/')) {
-		name[strlen(name) - 1] = '\0';
-	}
-}
+	assert(fd >= 0);
+	assert(buf != NULL);
+	assert(from >= 0);
 
-time_t ar_member_date(struct ar_hdr *hdr) {
-	char str[SARFDATE + 1];
+	// Positional reads leave the file pointer alone, so threads can share fd
+	done = 0;
+	while (done < size) {
+		size_t count = ((size - done) < BLOCK_SIZE) ? (size - done) : BLOCK_SIZE;
+		ssize_t n = pread(fd, buf + done, count, from + done);
 
-	assert(hdr != NULL);
+		STATS_IO(STATS_READ, (n > 0) ? n : 0, 0);
+		if (n <= 0) {
+			perror("Read error");
+			return false;
+		}
 
-	memcpy(str, hdr->ar_date, SARFDATE);
-	str[SARFDATE] = '\0';
+		done += n;
+	}
 
-	return strtol(str, NULL, 10);
+	return true;
 }
 
-uid_t ar_member_uid(struct ar_hdr *hdr) {
-	char str[SARFUID + 1];
-
-	assert(hdr != NULL);
-
-	memcpy(str, hdr->ar_uid, SARFUID);
-	str[SARFUID] = '\0';
+bool block_write(int fd, uint8_t *buf, off_t to, size_t size) {
+	size_t done;
 
-	return strtol(str, NULL, 10);
-}
+	assert(fd >= 0);
+	assert(buf != NULL);
+	assert(to >= 0);
 
-gid_t ar_member_gid(struct ar_hdr *hdr) {
-	char str[SARFGID + 1];
+	done = 0;
+	while (done < size) {
+		size_t count = ((size - done) < BLOCK_SIZE) ? (size - done) : BLOCK_SIZE;
+		ssize_t n = pwrite(fd, buf + done, count, to + done);
 
-	assert(hdr != NULL);
+		STATS_IO(STATS_WRITE, 0, (n > 0) ? n : 0);
+		if (n == -1) {
+			perror("Write error");
+			return false;
+		}
 
-	memcpy(str, hdr->ar_gid, SARFGID);
-	str[SARFGID] = '\0';
+		done += n;
+	}
 
-	return strtol(str, NULL, 10);
+	return true;
 }
 
-mode_t ar_member_mode(struct ar_hdr *hdr) {
-	char str[SARFMODE + 1];
+ssize_t stream_read(int fd, uint8_t *buf, size_t size) {
+	size_t done;
 
-	assert(hdr != NULL);
+	assert(fd >= 0);
+	assert(buf != NULL);
 
-	memcpy(str, hdr->ar_mode, SARFMODE);
-	str[SARFMODE] = '\0';
+	done = 0;
+	while (done < size) {
+		ssize_t n = read(fd, buf + done, size - done);
 
-	return strtol(str, NULL, 8);
-}
+		STATS_IO(STATS_READ, (n > 0) ? n : 0, 0);
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
 
-off_t ar_member_size(struct ar_hdr *hdr) {
-	char str[SARFSIZE + 1];
+			perror("Read error");
+			return -1;
+		}
 
-	assert(hdr != NULL);
+		// End of file
+		if (n == 0) {
+			break;
+		}
 
-	memcpy(str, hdr->ar_size, SARFSIZE);
-	str[SARFSIZE] = '\0';
+		done += n;
+	}
 
-	return strtol(str, NULL, 10);
+	return done;
 }
 
-bool block_read(int fd, uint8_t *buf, off_t from, size_t size) {
+bool stream_write(int fd, const uint8_t *buf, size_t size) {
 	size_t done;
 
 	assert(fd >= 0);
 	assert(buf != NULL);
-	assert(from >= 0);
-	assert(size > 0);
-	assert(from + size <= lseek(fd, 0, SEEK_END));
 
 	done = 0;
-	lseek(fd, from, SEEK_SET);
 	while (done < size) {
-		size_t count = ((size - done) < BLOCK_SIZE) ? (size - done) : BLOCK_SIZE;
-		if (read(fd, buf + done, count) == -1) {
-			perror("Read error");
+		ssize_t n = write(fd, buf + done, size - done);
+
+		STATS_IO(STATS_WRITE, 0, (n > 0) ? n : 0);
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			perror("Write error");
 			return false;
 		}
 
-		done += count;
+		done += n;
 	}
 
 	return true;
 }
 
-bool block_write(int fd, uint8_t *buf, off_t to, size_t size) {
-	size_t done;
+bool stream_send(int in_fd, int out_fd, off_t size) {
+	uint8_t buf[COPY_SIZE];
+	off_t done;
 
-	assert(fd >= 0);
-	assert(buf != NULL);
-	assert(to >= 0);
-	assert(size > 0);
+	assert(in_fd >= 0);
+	assert(out_fd >= 0);
+	assert(size >= 0);
 
+	// Let the kernel feed the stream from the page cache
 	done = 0;
-	lseek(fd, to, SEEK_SET);
 	while (done < size) {
-		size_t count = ((size - done) < BLOCK_SIZE) ? (size - done) : BLOCK_SIZE;
-		if (write(fd, buf + done, count) == -1) {
-			perror("Write error");
+		off_t in = done;
+		size_t count = ((size - done) < IO_MAX) ? (size - done) : IO_MAX;
+		ssize_t n = sendfile(out_fd, in_fd, &in, count);
+
+		STATS_IO(STATS_SENDFILE, (n > 0) ? n : 0, (n > 0) ? n : 0);
+		if (n <= 0) {
+			break;
+		}
+
+		done += n;
+	}
+
+	while (done < size) {
+		size_t count = ((size - done) < COPY_SIZE) ? (size - done) : COPY_SIZE;
+
+		if ((block_read(in_fd, buf, done, count) == false) ||
+				(stream_write(out_fd, buf, count) == false)) {
 			return false;
 		}
 
@@ -856,4 +5929,3 @@ bool block_write(int fd, uint8_t *buf, off_t to, size_t size) {
 
 	return true;
 }
-
@@ -30,9 +30,49 @@
 #ifndef AR_H
 #define AR_H
 
+#include <sys/types.h>
 #include <ar.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <time.h>
+
+/**
+ * @brief Handle to an open archive.
+ *
+ * Holds the archive's file descriptor along with a table of its members that
+ * is built once when the archive is opened and kept current as members are
+ * appended and removed.
+ */
+struct archive;
+
+/**
+ * @brief A member of an archive, as found by ar_lookup or ar_iter_next.
+ *
+ * The name points into the archive's member table, so it stays valid until
+ * the archive is changed or closed.
+ */
+struct ar_entry {
+	const char *name;			///< Full name of the member
+	off_t size;					///< Size of the data once extracted
+	time_t date;				///< Modification time
+	uid_t uid;					///< Owner's user ID
+	gid_t gid;					///< Owning group's group ID
+	mode_t mode;				///< File mode
+	off_t data_offset;			///< Offset of the stored data in the archive,
+								///< -1 for a thin member
+	off_t stored_size;			///< Size of the data as stored
+	bool packed;				///< Whether the stored data is packed
+};
+
+/**
+ * @brief Position of a walk over an archive's members.
+ *
+ * Lives wherever the caller puts it, walking allocates nothing.
+ */
+struct ar_iter {
+	struct archive *ar;			///< Archive being walked
+	size_t next;				///< Index of the next member to look at
+};
 
 /**
  * @brief Opens and verifies an archive file, creating one if it does not exist.
@@ -45,87 +85,408 @@
  *
  * @param path Path to an existing archive or location for a new archive to be
  * created.
- * @return File descriptor of the open archive file.
- * @retval -1 An error occured while opening the archive.
+ * @return Handle to the open archive.
+ * @retval NULL An error occured while opening the archive.
  */
-int ar_open(const char *path);
+struct archive *ar_open(const char *path);
+
+/**
+ * @brief Opens an archive that can only be read once, front to back.
+ *
+ * For archives read from a pipe, such as standard input. Members are listed
+ * or extracted as they go past, with data that isn't wanted read and thrown
+ * away. Only one of ar_print_concise, ar_print_verbose or ar_extract_set can
+ * be used, and the archive can't be changed.
+ * 
+ * Preconditions: fd is a file descriptor open for reading
+ * 
+ * Postconditions: The archive's global header has been read from fd, fd is
+ * closed by ar_close
+ *
+ * @param fd File descriptor to read the archive from
+ * @return Handle to the open archive.
+ * @retval NULL An error occured while opening the archive.
+ */
+struct archive *ar_open_stream(int fd);
+
+/**
+ * @brief Starts a new archive written once, front to back.
+ *
+ * For writing an archive into a pipe, such as standard output, without an
+ * intermediate file. Only ar_append and ar_append_set can be used, and a
+ * symbol table is only written for the files passed to the first of them.
+ * 
+ * Preconditions: fd is a file descriptor open for writing
+ * 
+ * Postconditions: The archive's global header has been written to fd, fd is
+ * closed by ar_close
+ *
+ * @param fd File descriptor to write the archive to
+ * @return Handle to the new archive.
+ * @retval NULL An error occured while writing the archive.
+ */
+struct archive *ar_create_stream(int fd);
 
 /**
  * @brief Closes an open archive file.
  * 
- * Preconditions: fd is a valid file descriptor
+ * Preconditions: ar is a handle returned by ar_open
+ * 
+ * Postconditions: The archive is closed and ar has been freed
+ *
+ * @param ar Handle of an open archive.
+ */
+void ar_close(struct archive *ar);
+
+/**
+ * @brief Keeps a member index file next to the archive.
+ *
+ * The index file is named after the archive with ".idx" appended and holds
+ * the member table in a form that can be used without reading the archive's
+ * headers. ar_open uses it when it matches the archive's size and
+ * modification time. An index file that already exists is kept up to date
+ * whether or not this is called.
+ * 
+ * Preconditions: ar is a handle to a valid archive
+ * 
+ * Postconditions: The index file will be written when ar is closed
+ *
+ * @param ar Handle of an open archive
+ */
+void ar_keep_index(struct archive *ar);
+
+/**
+ * @brief Turns a new archive into a thin archive.
+ *
+ * A thin archive holds only the headers of its members, which refer to the
+ * files they were appended from by path, relative to the archive. Appending
+ * costs a header write whatever the size of the file, and extracting copies
+ * the referenced file. Archives that start with the thin magic number are
+ * opened as thin archives without calling this.
+ * 
+ * Preconditions: ar is a handle to a valid archive
+ * 
+ * Postconditions: If successful, the archive is thin
+ *
+ * @param ar Handle of an open archive
+ * @return true on success, false if the archive already has members and
+ * isn't thin
+ */
+bool ar_make_thin(struct archive *ar);
+
+/**
+ * @brief Stops appends from creating a symbol table.
+ *
+ * By default, appending members that are ELF objects gives the archive a GNU
+ * style symbol table, named "/", as its first member so linkers can find the
+ * member defining a symbol without reading every member. A symbol table that
+ * already exists is kept up to date whether or not this is called.
+ * 
+ * Preconditions: ar is a handle to a valid archive
+ * 
+ * Postconditions: Appends won't create a symbol table
+ *
+ * @param ar Handle of an open archive
+ */
+void ar_skip_symtab(struct archive *ar);
+
+/**
+ * @brief Makes appends skip files the archive already holds.
+ *
+ * A file is skipped when a member with the same name has the same size and
+ * the same hash of its contents. Files are only hashed when such a member
+ * exists, and members' hashes are kept in the index file once computed. Thin
+ * archives aren't affected.
+ * 
+ * Preconditions: ar is a handle to a valid archive
+ * 
+ * Postconditions: Appends leave out files whose contents are already stored
+ *
+ * @param ar Handle of an open archive
+ */
+void ar_skip_duplicates(struct archive *ar);
+
+/**
+ * @brief Makes appends pack members with zlib.
+ *
+ * A packed member's data starts with a small header giving its unpacked size
+ * and a hash of its contents, so tables of contents never have to unpack it.
+ * Files are packed in parallel, and stored as is if packing doesn't make them
+ * smaller. Extraction unpacks members wherever they were packed, whether or
+ * not this is called. Packed members can't be linked against, so they aren't
+ * in the symbol table, and thin archives aren't affected.
+ * 
+ * Preconditions: ar is a handle to a valid archive, level is between 0 and 9
+ * 
+ * Postconditions: Later appends pack members at the given level, or store
+ * them as is if it is 0
+ *
+ * @param ar Handle of an open archive
+ * @param level zlib compression level
+ */
+void ar_set_compression(struct archive *ar, int level);
+
+/**
+ * @brief Sets the number of threads used for operations that can run in
+ * parallel.
+ * 
+ * Preconditions: ar is a handle to a valid archive
  * 
- * Postconditions: fd is closed
+ * Postconditions: Later operations on ar use up to jobs threads
  *
- * @param fd File descriptor of an open archive.
+ * @param ar Handle of an open archive
+ * @param jobs Number of threads, 1 runs everything on the calling thread
  */
-void ar_close(int fd);
+void ar_set_jobs(struct archive *ar, unsigned int jobs);
+
+/**
+ * @brief Switches bulk appends and extractions to an io_uring backend.
+ *
+ * Files are then opened, copied and closed by chains of requests submitted
+ * together, with up to depth files in flight, instead of one system call at a
+ * time. If the kernel does not support io_uring, the archive keeps using plain
+ * system calls.
+ * 
+ * Preconditions: ar is a handle to a valid archive, depth is greater than zero
+ * 
+ * Postconditions: If successful, ar_append_set and ar_extract_set use the ring
+ *
+ * @param ar Handle of an open archive
+ * @param depth Number of files to keep in flight
+ * @return true if the backend is in use, false otherwise
+ */
+bool ar_use_uring(struct archive *ar, unsigned int depth);
 
 /**
  * @brief Appends a file to an archive.
  * 
- * Preconditions: fd is an file descriptor for a valid archive, path is not
+ * Preconditions: ar is a handle to a valid archive, path is not
  * NULL, path refers to an existing file, file referred to by path is readable
  * 
  * Postconditions: The file has been appended to the archive
  *
- * @param fd File descriptor of an open archive
+ * @param ar Handle of an open archive
  * @param path Path to the file to be appended to the archive
  * @return true on success, false otherwise
  */
-bool ar_append(int fd, const char *path);
+bool ar_append(struct archive *ar, const char *path);
+
+/**
+ * @brief Appends a set of files to an archive.
+ *
+ * Every file is stat'ed and given its place in the archive before anything is
+ * written, and the archive is grown to its final size at once. Member data is
+ * then copied in concurrently if more than one job has been set with
+ * ar_set_jobs. Files that cannot be stat'ed are reported and skipped, if any
+ * other file fails the archive is left as it was.
+ * 
+ * Preconditions: ar is a handle to a valid archive, paths is an array of count
+ * paths that are not NULL, each path refers to a readable file that will not
+ * change size until the append is done
+ * 
+ * Postconditions: The files have been appended to the archive in order
+ *
+ * @param ar Handle of an open archive
+ * @param paths Paths to the files to be appended to the archive
+ * @param count Number of paths
+ * @return true if every file was appended, false otherwise
+ */
+bool ar_append_set(struct archive *ar, const char **paths, size_t count);
 
 /**
  * @brief Removes a member from an archive.
  * 
- * Preconditions: fd is an file descriptor for a valid archive, name is not
+ * Preconditions: ar is a handle to a valid archive, name is not
  * NULL, name refers to a member of the archive
  * 
  * Postconditions: The member has been removed from the archive
  *
- * @param fd File descriptor of an open archive
+ * @param ar Handle of an open archive
  * @param name Name of the member to be removed from the archive
  * @return true on success, false otherwise
  */
-bool ar_remove(int fd, const char *name);
+bool ar_remove(struct archive *ar, const char *name);
+
+/**
+ * @brief Removes a set of members from an archive in a single pass.
+ *
+ * The archive is rewritten once no matter how many names are given. Data is
+ * streamed through a fixed size buffer, so memory use does not depend on the
+ * size of the archive or of any member.
+ * 
+ * Preconditions: ar is a handle to a valid archive, names is an array of count
+ * names that are not NULL
+ * 
+ * Postconditions: Every member with one of the given names has been removed
+ * from the archive
+ *
+ * @param ar Handle of an open archive
+ * @param names Names of the members to be removed from the archive
+ * @param count Number of names
+ * @return true if every name was found and removed, false otherwise
+ */
+bool ar_remove_set(struct archive *ar, const char **names, size_t count);
+
+/**
+ * @brief Replaces members with the files of the same name in a single pass.
+ *
+ * A member is only rewritten when its file's modification time or size
+ * differs from the member's header, or with newer set, only when the file is
+ * newer than the member. Changed members keep their place in the archive and
+ * the members behind them are moved at most once, however many change. Files
+ * that aren't members yet are appended.
+ * 
+ * Preconditions: ar is a handle to a valid archive, paths is an array of count
+ * paths that are not NULL
+ * 
+ * Postconditions: Every member named by a path holds the file's current
+ * contents, or one that is no older with newer set
+ *
+ * @param ar Handle of an open archive
+ * @param paths Paths of the files
+ * @param count Number of paths
+ * @param newer Whether to only replace members older than their files
+ * @return true on success, false otherwise
+ */
+bool ar_replace_set(struct archive *ar, const char **paths, size_t count,
+		bool newer);
+
+/**
+ * @brief Removes, replaces and appends members in a single rewrite.
+ *
+ * Every member carrying a removed name is dropped first, so a replacing file
+ * named like one is appended. Replacements then behave as for ar_replace_set
+ * and added files are appended as they are, after any new replacing files.
+ * The members behind the first one removed or replaced are moved at most
+ * once for the lot.
+ * 
+ * Preconditions: ar is a handle to a valid archive, removed, replaced and
+ * added are arrays of nremoved, nreplaced and nadded strings that are not
+ * NULL
+ * 
+ * Postconditions: The archive holds the result of the three changes
+ *
+ * @param ar Handle of an open archive
+ * @param removed Names of the members to remove
+ * @param nremoved Number of names
+ * @param replaced Paths of the files replacing members
+ * @param nreplaced Number of replacing files
+ * @param added Paths of the files to append
+ * @param nadded Number of files to append
+ * @return true if every name was found and every change made, false
+ * otherwise
+ */
+bool ar_apply_set(struct archive *ar, const char **removed, size_t nremoved,
+		const char **replaced, size_t nreplaced, const char **added,
+		size_t nadded);
 
 /**
  * @brief Extracts a member from an archive
  * 
- * Preconditions: fd is an file descriptor for a valid archive, name is not
+ * Preconditions: ar is a handle to a valid archive, name is not
  * NULL, name refers to a member of the archive, a file with path name is
  * writable
  * 
  * Postconditions: The member has been extracted from the archive
  *
- * @param fd File descriptor of an open archive
+ * @param ar Handle of an open archive
  * @param name Name of the member to be extracted from the archive
  * @return true on success, false otherwise
  */
-bool ar_extract(int fd, const char *name);
+bool ar_extract(struct archive *ar, const char *name);
+
+/**
+ * @brief Extracts a set of members from an archive in a single pass
+ *
+ * Members are read in the order they appear in the archive rather than the
+ * order they are named, so the archive is read front to back exactly once.
+ * Names that do not refer to a member are reported once the pass is done. If
+ * more than one job has been set with ar_set_jobs, members are extracted
+ * concurrently.
+ * 
+ * Preconditions: ar is a handle to a valid archive, names is an array of count
+ * names that are not NULL, a file with each name is writable
+ * 
+ * Postconditions: Each named member has been extracted from the archive
+ *
+ * @param ar Handle of an open archive
+ * @param names Names of the members to be extracted from the archive
+ * @param count Number of names
+ * @return true if every member was extracted, false otherwise
+ */
+bool ar_extract_set(struct archive *ar, const char **names, size_t count);
 
 /**
  * @brief Prints the names of each member in the archive to stdout
  * 
- * Preconditions: fd is an file descriptor for a valid archive
+ * Preconditions: ar is a handle to a valid archive
  * 
  * Postconditions: 
  *
- * @param fd File descriptor to an open archive
+ * @param ar Handle of an open archive
  */
-void ar_print_concise(int fd);
+void ar_print_concise(struct archive *ar);
 
 /**
  * @brief Prints formatted header data of each member of the archive to stdout
  * 
- * Preconditions: fd is an file descriptor for a valid archive
+ * Preconditions: ar is a handle to a valid archive
  * 
  * Postconditions: 
  *
- * @param fd File descriptor of an open archive
+ * @param ar Handle of an open archive
  */
-void ar_print_verbose(int fd);
+void ar_print_verbose(struct archive *ar);
 
 
-#endif // AR_H
+/**
+ * @brief Starts a walk over an archive's members in archive order.
+ * 
+ * A stream archive's members are read in first, which uses it up.
+ * 
+ * Preconditions: iter is not NULL, ar is a handle to a valid archive
+ * 
+ * Postconditions: ar_iter_next returns the first member
+ *
+ * @param iter Walk to start
+ * @param ar Handle of an open archive
+ * @return true on success, false if a stream's members couldn't be read
+ */
+bool ar_iter_init(struct ar_iter *iter, struct archive *ar);
+
+/**
+ * @brief Steps a walk to the next member.
+ * 
+ * The symbol table and long name table aren't members in their own right,
+ * so they are passed over.
+ * 
+ * Preconditions: iter has been started with ar_iter_init and its archive
+ * hasn't been changed since, entry is not NULL
+ * 
+ * Postconditions: entry describes the member, if there was one
+ *
+ * @param iter Walk to step
+ * @param entry Location to describe the member in
+ * @return true if there was another member, false at the end
+ */
+bool ar_iter_next(struct ar_iter *iter, struct ar_entry *entry);
 
+/**
+ * @brief Finds a member by name.
+ * 
+ * Lookups go through the member table's hash, so they don't scan the
+ * archive. Where several members share the name, the first is found.
+ * 
+ * Preconditions: ar is a handle to a valid archive, name is not NULL, entry
+ * is not NULL
+ * 
+ * Postconditions: entry describes the member, if it was found
+ *
+ * @param ar Handle of an open archive
+ * @param name Full name of the member
+ * @param entry Location to describe the member in
+ * @return true if the member was found, false otherwise
+ */
+bool ar_lookup(struct archive *ar, const char *name, struct ar_entry *entry);
+
+#endif // AR_H
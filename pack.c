@@ -0,0 +1,372 @@
+/**
+ * @file pack.c
+ * @author Dan Albert
+ * @date Created 10/16/2026
+ * @date Last updated 10/16/2026
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Implements the compressed form archive members may be stored in.
+ * 
+ */
+#define _GNU_SOURCE 1
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "hash.h"
+#include "pack.h"
+#include "stats.h"
+
+/// Size of the buffers data passes through zlib in
+#define PACK_CHUNK (256 * 1024)
+
+/**
+ * @brief Reads a little endian 64 bit number.
+ * 
+ * Preconditions: data holds at least 8 bytes
+ * 
+ * Postconditions:
+ *
+ * @param data Bytes to read
+ * @return The number
+ */
+uint64_t pack_get64(const uint8_t *data);
+
+/**
+ * @brief Writes a little endian 64 bit number.
+ * 
+ * Preconditions: data has room for 8 bytes
+ * 
+ * Postconditions: data holds the number
+ *
+ * @param data Location to write to
+ * @param value Number to write
+ */
+void pack_put64(uint8_t *data, uint64_t value);
+
+/**
+ * @brief Reads exactly size bytes, positioned or from the current position.
+ * 
+ * Preconditions: fd is readable, buf has room for size bytes
+ * 
+ * Postconditions: buf holds the bytes
+ *
+ * @param fd File to read
+ * @param buf Location to store the bytes in
+ * @param from Offset to read from, -1 for the current position
+ * @param size Number of bytes to read
+ * @return true on success, false on an error or the end of the file
+ */
+bool pack_read(int fd, uint8_t *buf, off_t from, size_t size);
+
+/**
+ * @brief Writes exactly size bytes, positioned or at the current position.
+ * 
+ * Preconditions: fd is writable, buf holds size bytes
+ * 
+ * Postconditions: The bytes have been written
+ *
+ * @param fd File to write
+ * @param buf Bytes to write
+ * @param to Offset to write at, -1 for the current position
+ * @param size Number of bytes to write
+ * @return true on success, false otherwise
+ */
+bool pack_write(int fd, const uint8_t *buf, off_t to, size_t size);
+
+bool pack_hdr_decode(const uint8_t *data, size_t len, off_t *unpacked,
+		uint64_t *hash) {
+	assert(data != NULL);
+	assert(unpacked != NULL);
+	assert(hash != NULL);
+
+	if ((len < PACK_HDR_SIZE) || (memcmp(data, PACKMAG, SPACKMAG) != 0) ||
+			(pack_get64(data + SPACKMAG) > INT64_MAX)) {
+		return false;
+	}
+
+	*unpacked = pack_get64(data + SPACKMAG);
+	*hash = pack_get64(data + SPACKMAG + 8);
+
+	return true;
+}
+
+bool pack_file(int in_fd, off_t size, int out_fd, int level, off_t *packed,
+		uint64_t *hash) {
+	struct hash_state state;
+	uint8_t hdr[PACK_HDR_SIZE];
+	uint8_t *in;
+	uint8_t *out;
+	z_stream zs;
+	off_t done;
+	off_t pos;
+	int status;
+	int flush;
+	bool ok;
+
+	assert(in_fd >= 0);
+	assert(out_fd >= 0);
+	assert(packed != NULL);
+	assert(hash != NULL);
+
+	in = (uint8_t *)malloc(PACK_CHUNK);
+	out = (uint8_t *)malloc(PACK_CHUNK);
+	memset(&zs, 0, sizeof(zs));
+	if ((in == NULL) || (out == NULL) || (deflateInit(&zs, level) != Z_OK)) {
+		fprintf(stderr, "Could not start compression\n");
+		free(in);
+		free(out);
+		return false;
+	}
+
+	hash_init(&state);
+	done = 0;
+	pos = PACK_HDR_SIZE;
+	ok = true;
+	do {
+		size_t count = ((size - done) < PACK_CHUNK) ? (size - done) : PACK_CHUNK;
+
+		if ((count > 0) && (pack_read(in_fd, in, done, count) == false)) {
+			ok = false;
+			break;
+		}
+
+		hash_update(&state, in, count);
+		done += count;
+
+		zs.next_in = in;
+		zs.avail_in = count;
+		flush = (done == size) ? Z_FINISH : Z_NO_FLUSH;
+
+		// Drain everything zlib has for this piece of input
+		do {
+			size_t have;
+
+			zs.next_out = out;
+			zs.avail_out = PACK_CHUNK;
+			status = deflate(&zs, flush);
+
+			// Running out of work is fine, being unable to take input isn't
+			if ((status == Z_STREAM_ERROR) || ((status == Z_BUF_ERROR) &&
+					(zs.avail_in > 0))) {
+				fprintf(stderr, "Compression failed\n");
+				ok = false;
+				break;
+			}
+
+			have = PACK_CHUNK - zs.avail_out;
+			if ((have > 0) && (pack_write(out_fd, out, pos, have) == false)) {
+				ok = false;
+				break;
+			}
+
+			pos += have;
+		} while (zs.avail_out == 0);
+
+		// All the input has gone in, so the stream must have ended
+		if (ok && (flush == Z_FINISH) && (status != Z_STREAM_END)) {
+			fprintf(stderr, "Compression failed\n");
+			ok = false;
+		}
+
+		// Not worth going on if it won't come out smaller
+		if (pos >= size) {
+			break;
+		}
+	} while (ok && (flush != Z_FINISH));
+
+	deflateEnd(&zs);
+	free(in);
+	free(out);
+
+	if (ok && (pos < size)) {
+		*hash = hash_final(&state);
+
+		memcpy(hdr, PACKMAG, SPACKMAG);
+		pack_put64(hdr + SPACKMAG, size);
+		pack_put64(hdr + SPACKMAG + 8, *hash);
+		ok = pack_write(out_fd, hdr, 0, PACK_HDR_SIZE);
+	}
+
+	*packed = pos;
+
+	return ok;
+}
+
+bool pack_expand(int in_fd, off_t from, off_t size, int out_fd,
+		off_t *unpacked, uint64_t *hash) {
+	struct hash_state state;
+	uint8_t *in;
+	uint8_t *out;
+	z_stream zs;
+	off_t done;
+	int status;
+	bool ok;
+
+	assert(in_fd >= 0);
+	assert(out_fd >= 0);
+	assert(unpacked != NULL);
+	assert(hash != NULL);
+
+	in = (uint8_t *)malloc(PACK_CHUNK);
+	out = (uint8_t *)malloc(PACK_CHUNK);
+	memset(&zs, 0, sizeof(zs));
+	if ((in == NULL) || (out == NULL) || (inflateInit(&zs) != Z_OK)) {
+		fprintf(stderr, "Could not start decompression\n");
+		free(in);
+		free(out);
+		return false;
+	}
+
+	hash_init(&state);
+	*unpacked = 0;
+	done = 0;
+	status = Z_OK;
+	ok = true;
+	while (ok && (status != Z_STREAM_END) && (done < size)) {
+		size_t count = ((size - done) < PACK_CHUNK) ? (size - done) : PACK_CHUNK;
+
+		if (pack_read(in_fd, in, (from < 0) ? -1 : from + done, count) ==
+				false) {
+			ok = false;
+			break;
+		}
+
+		done += count;
+		zs.next_in = in;
+		zs.avail_in = count;
+
+		// Write out everything this piece of input expands to
+		do {
+			size_t have;
+
+			zs.next_out = out;
+			zs.avail_out = PACK_CHUNK;
+			status = inflate(&zs, Z_NO_FLUSH);
+			if ((status != Z_OK) && (status != Z_STREAM_END) &&
+					(status != Z_BUF_ERROR)) {
+				ok = false;
+				break;
+			}
+
+			have = PACK_CHUNK - zs.avail_out;
+			hash_update(&state, out, have);
+			*unpacked += have;
+			if ((have > 0) && (pack_write(out_fd, out, -1, have) == false)) {
+				ok = false;
+				break;
+			}
+		} while ((zs.avail_out == 0) && (status != Z_STREAM_END));
+	}
+
+	// A stream that stops short is damaged
+	if (status != Z_STREAM_END) {
+		ok = false;
+	}
+
+	// Whatever follows the stream still has to be read from a pipe
+	while (ok && (from < 0) && (done < size)) {
+		size_t count = ((size - done) < PACK_CHUNK) ? (size - done) : PACK_CHUNK;
+
+		ok = pack_read(in_fd, in, -1, count);
+		done += count;
+	}
+
+	inflateEnd(&zs);
+	free(in);
+	free(out);
+
+	*hash = hash_final(&state);
+
+	return ok;
+}
+
+uint64_t pack_get64(const uint8_t *data) {
+	uint64_t value = 0;
+	int i;
+
+	assert(data != NULL);
+
+	for (i = 7; i >= 0; i--) {
+		value = (value << 8) | data[i];
+	}
+
+	return value;
+}
+
+void pack_put64(uint8_t *data, uint64_t value) {
+	int i;
+
+	assert(data != NULL);
+
+	for (i = 0; i < 8; i++) {
+		data[i] = (uint8_t)(value >> (8 * i));
+	}
+}
+
+bool pack_read(int fd, uint8_t *buf, off_t from, size_t size) {
+	size_t done;
+
+	assert(fd >= 0);
+	assert(buf != NULL);
+
+	done = 0;
+	while (done < size) {
+		ssize_t n = (from < 0) ? read(fd, buf + done, size - done) :
+				pread(fd, buf + done, size - done, from + done);
+
+		STATS_IO(STATS_READ, (n > 0) ? n : 0, 0);
+		if (n <= 0) {
+			return false;
+		}
+
+		done += n;
+	}
+
+	return true;
+}
+
+bool pack_write(int fd, const uint8_t *buf, off_t to, size_t size) {
+	size_t done;
+
+	assert(fd >= 0);
+	assert(buf != NULL);
+
+	done = 0;
+	while (done < size) {
+		ssize_t n = (to < 0) ? write(fd, buf + done, size - done) :
+				pwrite(fd, buf + done, size - done, to + done);
+
+		STATS_IO(STATS_WRITE, 0, (n > 0) ? n : 0);
+		if (n <= 0) {
+			perror("Write error");
+			return false;
+		}
+
+		done += n;
+	}
+
+	return true;
+}
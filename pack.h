@@ -0,0 +1,117 @@
+/**
+ * @file pack.h
+ * @author Dan Albert
+ * @date Created 10/16/2026
+ * @date Last updated 10/16/2026
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Defines the compressed form archive members may be stored in.
+ * 
+ */
+#ifndef PACK_H
+#define PACK_H
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Magic number that starts a packed member's data
+#define PACKMAG "\x89MYARZ\r\n"
+
+/// Bit set in a packed member's header mode, above every bit a file mode uses.
+/// Only members carrying it are checked for PACKMAG, so a plain file that
+/// happens to start with it is stored and extracted as is.
+#define PACK_MODE 0200000
+
+/// Size of the packed member magic number
+#define SPACKMAG 8
+
+/// Size of the header ahead of a packed member's zlib stream, the magic
+/// number then the unpacked size and its hash as little endian 64 bit numbers
+#define PACK_HDR_SIZE 24
+
+/**
+ * @brief Reads the header of a packed member.
+ * 
+ * Preconditions: data holds len bytes, unpacked is not NULL, hash is not NULL
+ * 
+ * Postconditions: If data starts with a packed member header, unpacked and
+ * hash hold its values
+ *
+ * @param data Start of the member's data
+ * @param len Number of bytes available, at most the member's size
+ * @param unpacked Location to store the unpacked size in
+ * @param hash Location to store the hash of the unpacked data in
+ * @return true if the member is packed, false otherwise
+ */
+bool pack_hdr_decode(const uint8_t *data, size_t len, off_t *unpacked,
+		uint64_t *hash);
+
+/**
+ * @brief Packs a file with zlib.
+ * 
+ * The packed member, header included, is written to the start of out_fd.
+ * Packing stops early once it can't come out smaller than the file, in which
+ * case the file is better stored as is.
+ * 
+ * Preconditions: in_fd holds at least size bytes, out_fd is writable, level
+ * is between 1 and 9, packed is not NULL, hash is not NULL
+ * 
+ * Postconditions: If packed is less than size, out_fd holds the packed
+ * member, packed bytes long, and hash holds the hash of the file
+ *
+ * @param in_fd File to pack
+ * @param size Size of the file
+ * @param out_fd File to write the packed member to
+ * @param level zlib compression level
+ * @param packed Location to store the packed member's size in
+ * @param hash Location to store the hash of the file in
+ * @return true on success, false on a read or write error
+ */
+bool pack_file(int in_fd, off_t size, int out_fd, int level, off_t *packed,
+		uint64_t *hash);
+
+/**
+ * @brief Unpacks the zlib stream of a packed member.
+ * 
+ * Preconditions: in_fd is readable, out_fd is writable, unpacked is not
+ * NULL, hash is not NULL
+ * 
+ * Postconditions: The unpacked data has been written to out_fd at its
+ * current position
+ *
+ * @param in_fd File holding the stream
+ * @param from Offset of the stream, -1 to read from the current position of
+ * a file that can't seek
+ * @param size Size of the stream
+ * @param out_fd File to write the data to
+ * @param unpacked Location to store the size of the data in
+ * @param hash Location to store the hash of the data in
+ * @return true on success, false if the stream is damaged or can't be
+ * read or written
+ */
+bool pack_expand(int in_fd, off_t from, off_t size, int out_fd,
+		off_t *unpacked, uint64_t *hash);
+
+#endif // PACK_H
+
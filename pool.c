@@ -0,0 +1,252 @@
+/**
+ * @file pool.c
+ * @author Dan Albert
+ * @date Created 10/16/2026
+ * @date Last updated 10/16/2026
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Implements a work-stealing thread pool for running independent tasks.
+ * 
+ */
+#define _GNU_SOURCE 1
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "pool.h"
+
+/**
+ * @brief Share of the tasks owned by one thread.
+ */
+struct pool_queue {
+	pthread_mutex_t lock;		///< Guards head and tail
+	size_t head;				///< Next task the owner will run
+	size_t tail;				///< One past the last task in the share
+};
+
+/**
+ * @brief State shared by every thread in a pool.
+ */
+struct pool {
+	struct pool_queue *queues;	///< One queue per thread
+	unsigned int jobs;			///< Number of threads
+	pool_task_fn fn;			///< Function run for each task
+	void *ctx;					///< Context pointer passed to fn
+};
+
+/**
+ * @brief State of a single thread in a pool.
+ */
+struct pool_worker {
+	struct pool *pool;			///< Pool the thread belongs to
+	unsigned int id;			///< Index of the thread's own queue
+	pthread_t thread;			///< Thread handle
+	bool ok;					///< Whether every task the thread ran succeeded
+};
+
+/**
+ * @brief Takes the next task from the front of a thread's own queue.
+ *
+ * Preconditions: queue is not NULL, task is not NULL
+ *
+ * Postconditions: If a task was taken, it has been removed from the queue
+ *
+ * @param queue Queue to take from
+ * @param task Location to store the task index in
+ * @return true if a task was taken, false if the queue is empty
+ */
+bool pool_take(struct pool_queue *queue, size_t *task);
+
+/**
+ * @brief Takes a task from the back of another thread's queue.
+ *
+ * Preconditions: queue is not NULL, task is not NULL
+ *
+ * Postconditions: If a task was taken, it has been removed from the queue
+ *
+ * @param queue Queue to steal from
+ * @param task Location to store the task index in
+ * @return true if a task was taken, false if the queue is empty
+ */
+bool pool_steal(struct pool_queue *queue, size_t *task);
+
+/**
+ * @brief Thread entry point, runs tasks until every queue is empty.
+ *
+ * Preconditions: arg points to a pool_worker
+ *
+ * Postconditions: The worker's ok flag reflects the tasks it ran
+ *
+ * @param arg Pointer to the thread's pool_worker
+ * @return NULL
+ */
+void *pool_work(void *arg);
+
+bool pool_run(size_t count, unsigned int jobs, pool_task_fn fn, void *ctx) {
+	struct pool_worker *workers;
+	struct pool pool;
+	unsigned int started;
+	unsigned int i;
+	bool ok;
+
+	assert(fn != NULL);
+
+	if (jobs > count) {
+		jobs = count;
+	}
+
+	// Not worth a thread
+	if (jobs <= 1) {
+		size_t task;
+
+		ok = true;
+		for (task = 0; task < count; task++) {
+			if (fn(ctx, task) == false) {
+				ok = false;
+			}
+		}
+
+		return ok;
+	}
+
+	pool.queues = (struct pool_queue *)malloc(jobs * sizeof(struct pool_queue));
+	workers = (struct pool_worker *)malloc(jobs * sizeof(struct pool_worker));
+	if ((pool.queues == NULL) || (workers == NULL)) {
+		perror(NULL);
+		free(pool.queues);
+		free(workers);
+		return false;
+	}
+
+	pool.jobs = jobs;
+	pool.fn = fn;
+	pool.ctx = ctx;
+
+	// Hand each thread a contiguous share of the tasks
+	for (i = 0; i < jobs; i++) {
+		pthread_mutex_init(&pool.queues[i].lock, NULL);
+		pool.queues[i].head = count * i / jobs;
+		pool.queues[i].tail = count * (i + 1) / jobs;
+
+		workers[i].pool = &pool;
+		workers[i].id = i;
+		workers[i].ok = true;
+	}
+
+	// Whatever can't be given a thread is picked up by the others
+	for (started = 0; started < jobs; started++) {
+		if (pthread_create(&workers[started].thread, NULL, pool_work,
+				&workers[started]) != 0) {
+			break;
+		}
+	}
+
+	if (started == 0) {
+		pool_work(&workers[0]);
+	}
+
+	ok = true;
+	for (i = 0; i < jobs; i++) {
+		if (i < started) {
+			pthread_join(workers[i].thread, NULL);
+		}
+
+		if (workers[i].ok == false) {
+			ok = false;
+		}
+
+		pthread_mutex_destroy(&pool.queues[i].lock);
+	}
+
+	free(pool.queues);
+	free(workers);
+
+	return ok;
+}
+
+bool pool_take(struct pool_queue *queue, size_t *task) {
+	bool taken;
+
+	assert(queue != NULL);
+	assert(task != NULL);
+
+	pthread_mutex_lock(&queue->lock);
+	taken = (queue->head < queue->tail);
+	if (taken) {
+		*task = queue->head++;
+	}
+	pthread_mutex_unlock(&queue->lock);
+
+	return taken;
+}
+
+bool pool_steal(struct pool_queue *queue, size_t *task) {
+	bool taken;
+
+	assert(queue != NULL);
+	assert(task != NULL);
+
+	pthread_mutex_lock(&queue->lock);
+	taken = (queue->head < queue->tail);
+	if (taken) {
+		*task = --queue->tail;
+	}
+	pthread_mutex_unlock(&queue->lock);
+
+	return taken;
+}
+
+void *pool_work(void *arg) {
+	struct pool_worker *worker = (struct pool_worker *)arg;
+	struct pool *pool;
+	size_t task;
+
+	assert(worker != NULL);
+
+	pool = worker->pool;
+
+	for (;;) {
+		unsigned int victim;
+
+		// Work through our own share first
+		if (pool_take(&pool->queues[worker->id], &task) == false) {
+			// Then help whoever still has work
+			for (victim = 1; victim < pool->jobs; victim++) {
+				if (pool_steal(&pool->queues[(worker->id + victim) % pool->jobs],
+						&task)) {
+					break;
+				}
+			}
+
+			if (victim == pool->jobs) {
+				break;
+			}
+		}
+
+		if (pool->fn(pool->ctx, task) == false) {
+			worker->ok = false;
+		}
+	}
+
+	return NULL;
+}
@@ -0,0 +1,67 @@
+/**
+ * @file pool.h
+ * @author Dan Albert
+ * @date Created 10/16/2026
+ * @date Last updated 10/16/2026
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Defines a work-stealing thread pool for running independent tasks.
+ * 
+ */
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief Function run once for each task in a pool.
+ *
+ * @param ctx Context pointer passed to pool_run
+ * @param task Index of the task to run
+ * @return true on success, false otherwise
+ */
+typedef bool (*pool_task_fn)(void *ctx, size_t task);
+
+/**
+ * @brief Runs tasks 0 through count - 1 on a pool of threads.
+ *
+ * Each thread starts with a contiguous share of the tasks and works through it
+ * in order. A thread that runs out steals tasks from the far end of another
+ * thread's share, so neighbouring tasks tend to run on the same thread.
+ * 
+ * Preconditions: fn is not NULL, fn is safe to call from several threads at
+ * once for different tasks
+ * 
+ * Postconditions: fn has been called exactly once for each task
+ *
+ * @param count Number of tasks
+ * @param jobs Number of threads to use, tasks run on the calling thread if
+ * this is 1 or less
+ * @param fn Function to run for each task
+ * @param ctx Context pointer passed to fn
+ * @return true if every task succeeded, false otherwise
+ */
+bool pool_run(size_t count, unsigned int jobs, pool_task_fn fn, void *ctx);
+
+#endif // POOL_H
+
@@ -0,0 +1,195 @@
+/**
+ * @file stats.c
+ * @author Dan Albert
+ * @date Created 10/16/2026
+ * @date Last updated 10/16/2026
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ * @section DESCRIPTION
+ *
+ * Implements counters of the I/O done on archives and the time spent in each
+ * phase of an operation.
+ *
+ */
+#define _GNU_SOURCE 1
+
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+#include "stats.h"
+
+struct stats *stats_on = NULL;
+
+/// Names of the kinds of system call, as printed
+static const char *const call_names[STATS_NCALLS] = {
+	"read", "write", "copy_file_range", "sendfile", "splice", "clone", "mmap",
+	"open", "fsync", "io_uring_enter"
+};
+
+/// Names of the phases, as printed
+static const char *const phase_names[STATS_NPHASES] = {
+	"other", "open", "scan", "copy", "sync"
+};
+
+/**
+ * @brief Reads a monotonic clock.
+ *
+ * Preconditions:
+ *
+ * Postconditions:
+ *
+ * @return Current time in seconds
+ */
+double stats_now(void);
+
+void stats_start(struct stats *stats) {
+	assert(stats != NULL);
+	assert(stats_on == NULL);
+
+	memset(stats, 0, sizeof(struct stats));
+	stats->phase = STATS_PHASE_OTHER;
+	stats->started = stats_now();
+	stats->since = stats->started;
+	stats_on = stats;
+}
+
+void stats_stop(void) {
+	struct stats *stats = stats_on;
+	double now;
+
+	assert(stats != NULL);
+
+	now = stats_now();
+	stats->seconds[stats->phase] += now - stats->since;
+	stats->total = now - stats->started;
+	stats_on = NULL;
+}
+
+void stats_io(int call, uint64_t read, uint64_t written) {
+	assert(stats_on != NULL);
+	assert((call >= 0) && (call < STATS_NCALLS));
+
+	// Worker threads count their own I/O, exact totals are all that matter
+	__atomic_fetch_add(&stats_on->calls[call], 1, __ATOMIC_RELAXED);
+	stats_bytes(read, written);
+}
+
+void stats_bytes(uint64_t read, uint64_t written) {
+	assert(stats_on != NULL);
+
+	if (read > 0) {
+		__atomic_fetch_add(&stats_on->bytes_read, read, __ATOMIC_RELAXED);
+	}
+
+	if (written > 0) {
+		__atomic_fetch_add(&stats_on->bytes_written, written,
+				__ATOMIC_RELAXED);
+	}
+}
+
+void stats_headers(uint64_t count) {
+	assert(stats_on != NULL);
+
+	__atomic_fetch_add(&stats_on->headers, count, __ATOMIC_RELAXED);
+}
+
+int stats_phase(int phase) {
+	struct stats *stats = stats_on;
+	double now;
+	int prev;
+
+	assert(stats != NULL);
+	assert((phase >= 0) && (phase < STATS_NPHASES));
+
+	now = stats_now();
+	prev = stats->phase;
+	stats->seconds[prev] += now - stats->since;
+	stats->phase = phase;
+	stats->since = now;
+
+	return prev;
+}
+
+void stats_print(const struct stats *stats, FILE *out, bool json) {
+	uint64_t calls;
+	int i;
+
+	assert(stats != NULL);
+	assert(out != NULL);
+
+	calls = 0;
+	for (i = 0; i < STATS_NCALLS; i++) {
+		calls += stats->calls[i];
+	}
+
+	if (json) {
+		fprintf(out, "{\"seconds\":%.6f,\"phases\":{", stats->total);
+		for (i = 0; i < STATS_NPHASES; i++) {
+			fprintf(out, "%s\"%s\":%.6f", (i > 0) ? "," : "", phase_names[i],
+					stats->seconds[i]);
+		}
+
+		fprintf(out, "},\"calls\":{");
+		for (i = 0; i < STATS_NCALLS; i++) {
+			fprintf(out, "%s\"%s\":%llu", (i > 0) ? "," : "", call_names[i],
+					(unsigned long long)stats->calls[i]);
+		}
+
+		fprintf(out, "},\"bytes_read\":%llu,\"bytes_written\":%llu,"
+				"\"headers\":%llu}\n", (unsigned long long)stats->bytes_read,
+				(unsigned long long)stats->bytes_written,
+				(unsigned long long)stats->headers);
+		return;
+	}
+
+	fprintf(out, "%-16s %12s %7s\n", "phase", "seconds", "share");
+	for (i = 0; i < STATS_NPHASES; i++) {
+		fprintf(out, "%-16s %12.6f %6.1f%%\n", phase_names[i],
+				stats->seconds[i], (stats->total > 0) ?
+				stats->seconds[i] * 100 / stats->total : 0.0);
+	}
+
+	fprintf(out, "%-16s %12.6f\n", "total", stats->total);
+
+	fprintf(out, "\n%-16s %12s\n", "call", "count");
+	for (i = 0; i < STATS_NCALLS; i++) {
+		if (stats->calls[i] > 0) {
+			fprintf(out, "%-16s %12llu\n", call_names[i],
+					(unsigned long long)stats->calls[i]);
+		}
+	}
+
+	fprintf(out, "%-16s %12llu\n", "total", (unsigned long long)calls);
+
+	fprintf(out, "\n%-16s %12llu\n", "bytes read",
+			(unsigned long long)stats->bytes_read);
+	fprintf(out, "%-16s %12llu\n", "bytes written",
+			(unsigned long long)stats->bytes_written);
+	fprintf(out, "%-16s %12llu\n", "headers parsed",
+			(unsigned long long)stats->headers);
+}
+
+double stats_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,237 @@
+/**
+ * @file stats.h
+ * @author Dan Albert
+ * @date Created 10/16/2026
+ * @date Last updated 10/16/2026
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ * @section DESCRIPTION
+ *
+ * Defines counters of the I/O done on archives and the time spent in each
+ * phase of an operation.
+ *
+ */
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/// read(), pread() and reads through a mapping
+#define STATS_READ			0
+
+/// write(), pwrite() and pwritev()
+#define STATS_WRITE			1
+
+/// copy_file_range()
+#define STATS_COPY_RANGE	2
+
+/// sendfile()
+#define STATS_SENDFILE		3
+
+/// splice()
+#define STATS_SPLICE		4
+
+/// FICLONERANGE ioctl()
+#define STATS_CLONE			5
+
+/// mmap()
+#define STATS_MMAP			6
+
+/// open(), openat() and creat()
+#define STATS_OPEN			7
+
+/// fsync()
+#define STATS_FSYNC			8
+
+/// io_uring_enter()
+#define STATS_URING			9
+
+/// Number of kinds of system call counted
+#define STATS_NCALLS		10
+
+/// Time not spent in any other phase, such as planning and printing
+#define STATS_PHASE_OTHER	0
+
+/// Opening the archive and checking its global header
+#define STATS_PHASE_OPEN	1
+
+/// Walking member headers
+#define STATS_PHASE_SCAN	2
+
+/// Copying member data
+#define STATS_PHASE_COPY	3
+
+/// Syncing, renaming into place and closing
+#define STATS_PHASE_SYNC	4
+
+/// Number of phases timed
+#define STATS_NPHASES		5
+
+/**
+ * @brief Counters collected while the program runs.
+ *
+ * Calls and bytes are counted from any thread. Phases are only switched by
+ * the thread driving the operation, so time is split between them by wall
+ * clock and the phases add up to the total.
+ */
+struct stats {
+	uint64_t calls[STATS_NCALLS];	///< System calls made, by kind
+	uint64_t bytes_read;			///< Bytes read, or copied by the kernel
+	uint64_t bytes_written;			///< Bytes written, or copied by the kernel
+	uint64_t headers;				///< Member headers decoded from archives
+	double seconds[STATS_NPHASES];	///< Time spent in each phase
+	double total;					///< Time from stats_start to stats_stop
+	int phase;						///< Phase being timed
+	double since;					///< When the phase was entered
+	double started;					///< When stats_start was called
+};
+
+/**
+ * @brief Counters being collected into, NULL when they aren't wanted.
+ *
+ * Every counting site tests this first, so collection costs a predictable
+ * branch when it is off.
+ */
+extern struct stats *stats_on;
+
+/// Counts a system call that moved read bytes in and written bytes out
+#define STATS_IO(call, read, written) do { \
+	if (stats_on != NULL) { \
+		stats_io((call), (read), (written)); \
+	} \
+} while (0)
+
+/// Counts bytes moved without a system call of their own
+#define STATS_BYTES(read, written) do { \
+	if (stats_on != NULL) { \
+		stats_bytes((read), (written)); \
+	} \
+} while (0)
+
+/// Counts member headers decoded
+#define STATS_HEADERS(count) do { \
+	if (stats_on != NULL) { \
+		stats_headers(count); \
+	} \
+} while (0)
+
+/// Starts timing a phase, evaluating to the phase to return to
+#define STATS_ENTER(phase) \
+	((stats_on != NULL) ? stats_phase(phase) : STATS_PHASE_OTHER)
+
+/// Returns to the phase STATS_ENTER was called from
+#define STATS_LEAVE(prev) do { \
+	if (stats_on != NULL) { \
+		stats_phase(prev); \
+	} \
+} while (0)
+
+/**
+ * @brief Starts collecting counters.
+ *
+ * Preconditions: stats is not NULL, no counters are being collected
+ *
+ * Postconditions: stats has been zeroed and is being collected into, time
+ * is charged to STATS_PHASE_OTHER
+ *
+ * @param stats Counters to collect into
+ */
+void stats_start(struct stats *stats);
+
+/**
+ * @brief Stops collecting counters.
+ *
+ * Preconditions: stats_start has been called
+ *
+ * Postconditions: The counters are complete and no longer collected
+ */
+void stats_stop(void);
+
+/**
+ * @brief Counts a system call. Safe to call from several threads at once.
+ *
+ * Preconditions: Counters are being collected, call is one of STATS_READ
+ * through STATS_URING
+ *
+ * Postconditions: The call and its bytes have been counted
+ *
+ * @param call Kind of system call
+ * @param read Number of bytes it read
+ * @param written Number of bytes it wrote
+ */
+void stats_io(int call, uint64_t read, uint64_t written);
+
+/**
+ * @brief Counts bytes moved without a system call of their own, such as by
+ * an io_uring request. Safe to call from several threads at once.
+ *
+ * Preconditions: Counters are being collected
+ *
+ * Postconditions: The bytes have been counted
+ *
+ * @param read Number of bytes read
+ * @param written Number of bytes written
+ */
+void stats_bytes(uint64_t read, uint64_t written);
+
+/**
+ * @brief Counts member headers decoded. Safe to call from several threads
+ * at once.
+ *
+ * Preconditions: Counters are being collected
+ *
+ * Postconditions: The headers have been counted
+ *
+ * @param count Number of headers
+ */
+void stats_headers(uint64_t count);
+
+/**
+ * @brief Charges the time since the last switch to the current phase and
+ * switches to another.
+ *
+ * Preconditions: Counters are being collected, phase is one of
+ * STATS_PHASE_OTHER through STATS_PHASE_SYNC, called from the thread that
+ * called stats_start
+ *
+ * Postconditions: Time is charged to phase
+ *
+ * @param phase Phase to switch to
+ * @return Phase switched from
+ */
+int stats_phase(int phase);
+
+/**
+ * @brief Prints collected counters.
+ *
+ * Preconditions: stats has been collected into and stats_stop called, out is
+ * not NULL
+ *
+ * Postconditions: A table, or a single line of JSON, has been written to out
+ *
+ * @param stats Counters to print
+ * @param out Stream to print to
+ * @param json true to print JSON, false to print a table
+ */
+void stats_print(const struct stats *stats, FILE *out, bool json);
+
+#endif // STATS_H
@@ -0,0 +1,1454 @@
+/**
+ * @file check.c
+ * @author Dan Albert
+ * @date Created 10/16/2026
+ * @date Last updated 10/16/2026
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ * @section DESCRIPTION
+ *
+ * Runs myar over archives built for the cases it has got wrong before and
+ * checks what it lists, extracts and leaves behind. Each case runs in a
+ * directory of its own, which is removed afterwards.
+ *
+ */
+#define _GNU_SOURCE 1
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/// Most arguments passed to one run of myar
+#define MAX_ARGS 16
+
+/// Size of the member written past 4 GiB, the largest header size is 10 digits
+#define LARGE_SIZE (5LL << 30)
+
+/// Longest output of one run that is compared
+#define OUT_MAX 16384
+
+/// Offset of the byte order marker in a member index file
+#define INDEX_BYTE_ORDER_AT 12
+
+/**
+ * @brief A case to check.
+ */
+struct check_case {
+	const char *name;			///< Name the case is reported by
+	bool (*run)(const char *dir);	///< Runs the case in an empty directory
+};
+
+/// Path of the myar binary
+static const char *myar = NULL;
+
+/// Directory myar was built in, where the object files it was built from are
+static char *objdir = NULL;
+
+/**
+ * @brief Checks a member larger than 4 GiB and a member stored past it.
+ *
+ * The large member is a hole, so the archive costs no disk space and it is
+ * never extracted. Listing, extracting through the index and deleting the
+ * large member all have to find the member behind it by its 64 bit offset.
+ *
+ * Preconditions: dir is an empty directory
+ *
+ * Postconditions: dir holds the files the case made
+ *
+ * @param dir Directory to run in
+ * @return true if the case passed, false otherwise
+ */
+bool check_large(const char *dir);
+
+/**
+ * @brief Checks extracting members with long names through io_uring.
+ *
+ * The archive is written by hand in the GNU format, where a long name is
+ * stored in the name table and the member header only holds its offset.
+ * Without io_uring myar falls back to system calls, and the case still
+ * passes.
+ *
+ * Preconditions: dir is an empty directory
+ *
+ * Postconditions: dir holds the files the case made
+ *
+ * @param dir Directory to run in
+ * @return true if the case passed, false otherwise
+ */
+bool check_uring_names(const char *dir);
+
+/**
+ * @brief Checks an archive whose long name table is empty.
+ *
+ * Listing, appending to and deleting from it have to treat the table as
+ * holding no names.
+ *
+ * Preconditions: dir is an empty directory
+ *
+ * Postconditions: dir holds the files the case made
+ *
+ * @param dir Directory to run in
+ * @return true if the case passed, false otherwise
+ */
+bool check_empty_names(const char *dir);
+
+/**
+ * @brief Checks an archive whose symbol table is empty.
+ *
+ * Appending an object to it and deleting from it have to treat the table as
+ * listing no symbols, and leave the same index GNU ar makes for the members.
+ *
+ * Preconditions: dir is an empty directory
+ *
+ * Postconditions: dir holds the files the case made
+ *
+ * @param dir Directory to run in
+ * @return true if the case passed, false otherwise
+ */
+bool check_empty_symtab(const char *dir);
+
+/**
+ * @brief Checks that only members marked as packed are unpacked.
+ *
+ * A plain file that starts like a packed member is stored next to a member
+ * that really is packed, and both have to come back as they went in.
+ *
+ * Preconditions: dir is an empty directory
+ *
+ * Postconditions: dir holds the files the case made
+ *
+ * @param dir Directory to run in
+ * @return true if the case passed, false otherwise
+ */
+bool check_pack_marker(const char *dir);
+
+/**
+ * @brief Checks that changing an archive through a symbolic link changes the
+ * archive and keeps the link.
+ *
+ * Preconditions: dir is an empty directory
+ *
+ * Postconditions: dir holds the files the case made
+ *
+ * @param dir Directory to run in
+ * @return true if the case passed, false otherwise
+ */
+bool check_symlink(const char *dir);
+
+/**
+ * @brief Checks deleting members in place from an archive with two links.
+ *
+ * An archive with another link can't be replaced by a rename, so the gaps
+ * are closed inside the file. The first gap is exactly one 4 KiB block at a
+ * block boundary, so it is collapsed where the filesystem allows, the second
+ * is only a few bytes and is copied over. GNU ar has to read back what is
+ * left.
+ *
+ * Preconditions: dir is an empty directory
+ *
+ * Postconditions: dir holds the files the case made
+ *
+ * @param dir Directory to run in
+ * @return true if the case passed, false otherwise
+ */
+bool check_in_place(const char *dir);
+
+/**
+ * @brief Checks that an archive written to standard output is the same as
+ * one appended to a file.
+ *
+ * The members include objects, so both have a symbol table, which has to be
+ * given the same room.
+ *
+ * Preconditions: dir is an empty directory
+ *
+ * Postconditions: dir holds the files the case made
+ *
+ * @param dir Directory to run in
+ * @return true if the case passed, false otherwise
+ */
+bool check_stream_create(const char *dir);
+
+/**
+ * @brief Checks replacing members in place so that the runs between them
+ * move both ways.
+ *
+ * Growing two members pushes the runs behind them toward the back, the first
+ * onto the old place of the second, and shrinking a later one pulls the last
+ * run toward the front. The archive has a second link so it is written in
+ * place, and GNU ar has to list and extract every member as it should be.
+ *
+ * Preconditions: dir is an empty directory
+ *
+ * Postconditions: dir holds the files the case made
+ *
+ * @param dir Directory to run in
+ * @return true if the case passed, false otherwise
+ */
+bool check_replace_runs(const char *dir);
+
+/**
+ * @brief Checks that a script makes changes in order when a command names a
+ * member with a change still pending.
+ *
+ * More names are held back than the pending table first has room for, then
+ * a member is deleted, appended again and extracted, each waiting for the
+ * change before it. GNU ar making the same changes one at a time has to end
+ * up with the same members holding the same contents.
+ *
+ * Preconditions: dir is an empty directory
+ *
+ * Postconditions: dir holds the files the case made
+ *
+ * @param dir Directory to run in
+ * @return true if the case passed, false otherwise
+ */
+bool check_script_flush(const char *dir);
+
+/**
+ * @brief Checks that -k skips only files stored with the same name and
+ * contents.
+ *
+ * One file is unchanged, one changed without changing size and one is new.
+ * The archive has to list and hold what GNU ar gives when only the last two
+ * are appended, and appending all three again has to leave it alone.
+ *
+ * Preconditions: dir is an empty directory
+ *
+ * Postconditions: dir holds the files the case made
+ *
+ * @param dir Directory to run in
+ * @return true if the case passed, false otherwise
+ */
+bool check_dedup(const char *dir);
+
+/**
+ * @brief Checks that the member index is used while it matches the archive
+ * and rebuilt when it doesn't.
+ *
+ * GNU ar changes the archive behind the index's back, and then the index is
+ * given the other byte order, which alone has to make myar rebuild it. Each
+ * time myar has to list and extract what GNU ar does.
+ *
+ * Preconditions: dir is an empty directory
+ *
+ * Postconditions: dir holds the files the case made
+ *
+ * @param dir Directory to run in
+ * @return true if the case passed, false otherwise
+ */
+bool check_index_stale(const char *dir);
+
+/**
+ * @brief Lists an archive with myar through its index and compares the list
+ * and the extracted members with GNU ar's.
+ *
+ * Preconditions: dir and archive are not NULL
+ *
+ * Postconditions: dir holds the lists, and the members each extracted in a
+ * directory of its own
+ *
+ * @param dir Directory to run in
+ * @param archive Path of the archive, from dir
+ * @return true if myar and GNU ar agree, false otherwise
+ */
+bool check_index_agrees(const char *dir, const char *archive);
+
+/**
+ * @brief Checks that deleting members moves the symbols of the members
+ * behind them.
+ *
+ * Members are deleted from in front of objects, once by a rewrite and once in
+ * place through a second link. nm has to list the same symbol index, and GNU
+ * ar the same members and contents, as for an archive GNU ar made the same
+ * deletions from.
+ *
+ * Preconditions: dir is an empty directory
+ *
+ * Postconditions: dir holds the files the case made
+ *
+ * @param dir Directory to run in
+ * @return true if the case passed, false otherwise
+ */
+bool check_symtab_delete(const char *dir);
+
+/**
+ * @brief Runs myar with standard output sent to a file.
+ *
+ * Preconditions: dir and out are not NULL, the arguments after out are
+ * strings ending with NULL, at most MAX_ARGS of them
+ *
+ * Postconditions: out holds what myar printed
+ *
+ * @param dir Directory to run in
+ * @param out Path of the file to send standard output to, from dir
+ * @return true if myar exited with status 0, false otherwise
+ */
+bool check_myar(const char *dir, const char *out, ...);
+
+/**
+ * @brief Runs another program, such as ar or nm, to compare myar with.
+ *
+ * Preconditions: dir, out and prog are not NULL, the arguments after prog
+ * are strings ending with NULL, at most MAX_ARGS of them
+ *
+ * Postconditions: out holds what the program printed
+ *
+ * @param dir Directory to run in
+ * @param out Path of the file to send standard output to, from dir
+ * @param prog Program to run, found through PATH
+ * @return true if the program exited with status 0, false otherwise
+ */
+bool check_tool(const char *dir, const char *out, const char *prog, ...);
+
+/**
+ * @brief Runs a program with standard output sent to a file.
+ *
+ * Preconditions: dir and out are not NULL, argv is a NULL terminated
+ * argument vector
+ *
+ * Postconditions: out holds what the program printed
+ *
+ * @param dir Directory to run in
+ * @param out Path of the file to send standard output to, from dir
+ * @param argv Program and arguments
+ * @return true if the program exited with status 0, false otherwise
+ */
+bool check_exec(const char *dir, const char *out, char **argv);
+
+/**
+ * @brief Lists the symbol index of an archive through nm, sorted.
+ *
+ * nm complains about every member that isn't an object, so what it prints to
+ * standard error is dropped.
+ *
+ * Preconditions: dir, archive and out are not NULL
+ *
+ * Postconditions: out holds one line for each symbol the index lists
+ *
+ * @param dir Directory to run in
+ * @param archive Path of the archive, from dir
+ * @param out Path of the file to list to, from dir
+ * @return true on success, false otherwise
+ */
+bool check_index(const char *dir, const char *archive, const char *out);
+
+/**
+ * @brief Copies an object file myar was built from into a case's directory.
+ *
+ * Preconditions: dir and name are not NULL
+ *
+ * Postconditions: dir holds a copy of the object under the same name
+ *
+ * @param dir Directory to copy to
+ * @param name Name of the object file
+ * @return true on success, false otherwise
+ */
+bool check_object(const char *dir, const char *name);
+
+/**
+ * @brief Fills a buffer with a line of one character.
+ *
+ * Preconditions: buf is not NULL, size is at least 2
+ *
+ * Postconditions: buf holds size - 2 copies of c, a newline and a null
+ *
+ * @param buf Buffer to fill
+ * @param size Size of the buffer
+ * @param c Character to fill it with
+ */
+void check_fill(char *buf, size_t size, char c);
+
+/**
+ * @brief Writes a file.
+ *
+ * Preconditions: dir, name and data are not NULL
+ *
+ * Postconditions: The file holds data
+ *
+ * @param dir Directory of the file
+ * @param name Name of the file
+ * @param data Contents of the file
+ * @return true on success, false otherwise
+ */
+bool check_write(const char *dir, const char *name, const char *data);
+
+/**
+ * @brief Reads a file into a buffer, null terminated.
+ *
+ * Preconditions: dir, name and buf are not NULL, buf holds OUT_MAX bytes
+ *
+ * Postconditions: buf holds the start of the file
+ *
+ * @param dir Directory of the file
+ * @param name Name of the file
+ * @param buf Buffer to read into
+ * @return true on success, false otherwise
+ */
+bool check_read(const char *dir, const char *name, char *buf);
+
+/**
+ * @brief Compares a file with what it should hold.
+ *
+ * Preconditions: dir, name and expect are not NULL
+ *
+ * Postconditions: A difference has been reported
+ *
+ * @param dir Directory of the file
+ * @param name Name of the file
+ * @param expect What the file should hold
+ * @return true if the file holds exactly expect, false otherwise
+ */
+bool check_text(const char *dir, const char *name, const char *expect);
+
+/**
+ * @brief Compares two files.
+ *
+ * Preconditions: dir, name and expect are not NULL
+ *
+ * Postconditions: A difference has been reported
+ *
+ * @param dir Directory of the files
+ * @param name Name of the file to check
+ * @param expect Name of the file holding what it should hold
+ * @return true if the files hold the same text, false otherwise
+ */
+bool check_same(const char *dir, const char *name, const char *expect);
+
+/**
+ * @brief Removes one file or directory for nftw().
+ *
+ * Preconditions: Called by nftw() with FTW_DEPTH
+ *
+ * Postconditions: path has been removed
+ *
+ * @param path Path of the file or directory
+ * @param st Status of the file, unused
+ * @param type Type of the entry
+ * @param ftw Position in the walk, unused
+ * @return 0 to keep walking
+ */
+int check_unlink(const char *path, const struct stat *st, int type,
+		struct FTW *ftw);
+
+/// Cases, run in order
+static const struct check_case cases[] = {
+	{ "large", check_large },
+	{ "uring-names", check_uring_names },
+	{ "empty-names", check_empty_names },
+	{ "empty-symtab", check_empty_symtab },
+	{ "pack-marker", check_pack_marker },
+	{ "symlink", check_symlink },
+	{ "in-place", check_in_place },
+	{ "stream-create", check_stream_create },
+	{ "replace-runs", check_replace_runs },
+	{ "script-flush", check_script_flush },
+	{ "dedup", check_dedup },
+	{ "index-stale", check_index_stale },
+	{ "symtab-delete", check_symtab_delete },
+};
+
+int main(int argc, char **argv) {
+	const char *parent;
+	char work[PATH_MAX];
+	char dir[PATH_MAX + 32];
+	size_t i;
+	bool ok = true;
+
+	if (argc != 2) {
+		fprintf(stderr, "Usage: check myar\n");
+		return 1;
+	}
+
+	myar = realpath(argv[1], NULL);
+	if (myar == NULL) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	objdir = strndup(myar, strrchr(myar, '/') - myar);
+	if (objdir == NULL) {
+		perror(NULL);
+		return 1;
+	}
+
+	parent = getenv("TMPDIR");
+	if (parent == NULL) {
+		parent = "/tmp";
+	}
+
+	snprintf(work, sizeof(work), "%s/myar-check.XXXXXX", parent);
+	if (mkdtemp(work) == NULL) {
+		perror(work);
+		return 1;
+	}
+
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		bool passed;
+
+		snprintf(dir, sizeof(dir), "%s/%s", work, cases[i].name);
+		if (mkdir(dir, 0777) == -1) {
+			perror(dir);
+			ok = false;
+			break;
+		}
+
+		passed = cases[i].run(dir);
+		printf("%-16s %s\n", cases[i].name, passed ? "ok" : "FAILED");
+		fflush(stdout);
+		ok = ok && passed;
+	}
+
+	nftw(work, check_unlink, 16, FTW_DEPTH | FTW_PHYS);
+	free((char *)myar);
+	free(objdir);
+
+	return ok ? 0 : 1;
+}
+
+bool check_large(const char *dir) {
+	char path[PATH_MAX];
+	char hdr[62];
+	char buf[OUT_MAX];
+	char size[32];
+	struct stat st;
+	off_t pad;
+	int fd;
+
+	assert(dir != NULL);
+
+	if ((check_write(dir, "head.txt", "head\n") == false) ||
+			(check_write(dir, "tail.txt", "behind the large member\n") ==
+			false) || (check_myar(dir, "/dev/null", "-q", "big.a", "head.txt",
+			NULL) == false)) {
+		return false;
+	}
+
+	// Appending the large member through myar would write every block of it,
+	// the header goes on by hand after the padding of the member before it
+	snprintf(hdr, sizeof(hdr), "\n%-16s%-12s%-6s%-6s%-8s%-10lld`\n",
+			"big.bin/", "0", "0", "0", "100644", (long long)LARGE_SIZE);
+	snprintf(path, sizeof(path), "%s/big.a", dir);
+	fd = open(path, O_WRONLY | O_APPEND);
+	if ((fd == -1) || (fstat(fd, &st) == -1)) {
+		perror(path);
+		if (fd != -1) {
+			close(fd);
+		}
+
+		return false;
+	}
+
+	pad = st.st_size % 2;
+	if ((write(fd, hdr + 1 - pad, 60 + pad) != (ssize_t)(60 + pad)) ||
+			(ftruncate(fd, st.st_size + pad + 60 + LARGE_SIZE) == -1)) {
+		perror(path);
+		close(fd);
+		return false;
+	}
+
+	close(fd);
+
+	if (check_myar(dir, "/dev/null", "-q", "big.a", "tail.txt", NULL) == false) {
+		return false;
+	}
+
+	if ((check_myar(dir, "list", "-t", "big.a", NULL) == false) ||
+			(check_text(dir, "list", "head.txt\nbig.bin\ntail.txt\n") ==
+			false)) {
+		return false;
+	}
+
+	snprintf(size, sizeof(size), " %lld ", (long long)LARGE_SIZE);
+	if ((check_myar(dir, "list", "-v", "big.a", NULL) == false) ||
+			(check_read(dir, "list", buf) == false)) {
+		return false;
+	}
+
+	if (strstr(buf, size) == NULL) {
+		fprintf(stderr, "large: -v doesn't list a size of%s:\n%s", size, buf);
+		return false;
+	}
+
+	// Once building the index and once reading the member's offset from it
+	snprintf(path, sizeof(path), "%s/tail.txt", dir);
+	if ((unlink(path) == -1) || (check_myar(dir, "/dev/null", "-i", "-x", "big.a",
+			"tail.txt", NULL) == false) || (check_text(dir, "tail.txt",
+			"behind the large member\n") == false)) {
+		return false;
+	}
+
+	if ((unlink(path) == -1) || (check_myar(dir, "/dev/null", "-i", "-x",
+			"big.a", "tail.txt", NULL) == false) || (check_text(dir,
+			"tail.txt", "behind the large member\n") == false)) {
+		return false;
+	}
+
+	if ((check_myar(dir, "/dev/null", "-d", "big.a", "big.bin", NULL) ==
+			false) || (check_myar(dir, "list", "-t", "big.a", NULL) == false) ||
+			(check_text(dir, "list", "head.txt\ntail.txt\n") == false)) {
+		return false;
+	}
+
+	snprintf(path, sizeof(path), "%s/big.a", dir);
+	if (stat(path, &st) == -1) {
+		perror(path);
+		return false;
+	}
+
+	if (st.st_size >= LARGE_SIZE) {
+		fprintf(stderr, "large: deleting the large member left %lld bytes\n",
+				(long long)st.st_size);
+		return false;
+	}
+
+	snprintf(path, sizeof(path), "%s/tail.txt", dir);
+	return (unlink(path) == 0) && check_myar(dir, "/dev/null", "-x", "big.a",
+			"tail.txt", NULL) && check_text(dir, "tail.txt",
+			"behind the large member\n");
+}
+
+bool check_uring_names(const char *dir) {
+	char out[PATH_MAX];
+
+	assert(dir != NULL);
+
+	// The name table, then members with a long, a short and a long name
+	if (check_write(dir, "names.a", "!<arch>\n"
+			"//                                              61        `\n"
+			"a_rather_long_member_name.txt/\n"
+			"another_long_member_name.txt/\n\n"
+			"/0              0           0     0     100644  5         `\n"
+			"long\n\n"
+			"short.txt/      0           0     0     100644  6         `\n"
+			"short\n"
+			"/31             0           0     0     100644  7         `\n"
+			"longer\n\n") == false) {
+		return false;
+	}
+
+	snprintf(out, sizeof(out), "%s/out", dir);
+	if (mkdir(out, 0777) == -1) {
+		perror(out);
+		return false;
+	}
+
+	return check_myar(out, "/dev/null", "-R", "8", "-x", "../names.a",
+			"a_rather_long_member_name.txt", "short.txt",
+			"another_long_member_name.txt", NULL) &&
+			check_text(out, "a_rather_long_member_name.txt", "long\n") &&
+			check_text(out, "short.txt", "short\n") &&
+			check_text(out, "another_long_member_name.txt", "longer\n");
+}
+
+bool check_empty_names(const char *dir) {
+	static const char archive[] = "!<arch>\n"
+			"//                                              0         `\n"
+			"one/            0           0     0     100644  4         `\n"
+			"one\n";
+
+	assert(dir != NULL);
+
+	if ((check_write(dir, "names.a", archive) == false) ||
+			(check_write(dir, "two", "two\n") == false)) {
+		return false;
+	}
+
+	if ((check_myar(dir, "list", "-t", "names.a", NULL) == false) ||
+			(check_text(dir, "list", "one\n") == false) ||
+			(check_myar(dir, "/dev/null", "-q", "names.a", "two", NULL) ==
+			false) || (check_myar(dir, "list", "-t", "names.a", NULL) ==
+			false) || (check_text(dir, "list", "one\ntwo\n") == false)) {
+		return false;
+	}
+
+	return check_myar(dir, "/dev/null", "-d", "names.a", "one", NULL) &&
+			check_myar(dir, "list", "-t", "names.a", NULL) &&
+			check_text(dir, "list", "two\n");
+}
+
+bool check_empty_symtab(const char *dir) {
+	static const char archive[] = "!<arch>\n"
+			"/               0           0     0     0       0         `\n"
+			"one/            0           0     0     100644  4         `\n"
+			"one\n";
+
+	assert(dir != NULL);
+
+	if ((check_write(dir, "sym.a", archive) == false) ||
+			(check_write(dir, "one", "one\n") == false) ||
+			(check_object(dir, "hash.o") == false)) {
+		return false;
+	}
+
+	if ((check_myar(dir, "list", "-t", "sym.a", NULL) == false) ||
+			(check_text(dir, "list", "one\n") == false)) {
+		return false;
+	}
+
+	if ((check_myar(dir, "/dev/null", "-q", "sym.a", "hash.o", NULL) ==
+			false) || (check_tool(dir, "/dev/null", "ar", "rcs", "ref.a", "one",
+			"hash.o", NULL) == false) || (check_index(dir, "sym.a", "got") ==
+			false) || (check_index(dir, "ref.a", "expect") == false) ||
+			(check_same(dir, "got", "expect") == false)) {
+		return false;
+	}
+
+	return check_myar(dir, "/dev/null", "-d", "sym.a", "one", NULL) &&
+			check_tool(dir, "/dev/null", "ar", "d", "ref.a", "one", NULL) &&
+			check_index(dir, "sym.a", "got") &&
+			check_index(dir, "ref.a", "expect") &&
+			check_same(dir, "got", "expect");
+}
+
+bool check_pack_marker(const char *dir) {
+	// The packed member magic number, then a plausible size and hash
+	static const char raw[] = "\x89MYARZ\r\n\x10\x10\x10\x10\x10\x10\x10"
+			"\x10hhhhhhhhbut the rest of a plain file\n";
+	static const char line[] = "packed members still unpack\n";
+	char text[OUT_MAX];
+	char out[PATH_MAX];
+	size_t i;
+
+	assert(dir != NULL);
+
+	text[0] = '\0';
+	for (i = 0; i < 64; i++) {
+		strcat(text, line);
+	}
+
+	if ((check_write(dir, "raw.bin", raw) == false) ||
+			(check_write(dir, "packed.txt", text) == false) ||
+			(check_myar(dir, "/dev/null", "-q", "pack.a", "raw.bin", NULL) ==
+			false) || (check_myar(dir, "/dev/null", "-z", "9", "-q", "pack.a",
+			"packed.txt", NULL) == false)) {
+		return false;
+	}
+
+	snprintf(out, sizeof(out), "%s/out", dir);
+	if (mkdir(out, 0777) == -1) {
+		perror(out);
+		return false;
+	}
+
+	return check_myar(out, "/dev/null", "-x", "../pack.a", "raw.bin",
+			"packed.txt", NULL) && check_text(out, "raw.bin", raw) &&
+			check_text(out, "packed.txt", text);
+}
+
+bool check_symlink(const char *dir) {
+	char path[PATH_MAX];
+	struct stat st;
+
+	assert(dir != NULL);
+
+	if ((check_write(dir, "one", "one\n") == false) ||
+			(check_write(dir, "two", "two\n") == false) ||
+			(check_myar(dir, "/dev/null", "-q", "real.a", "one", "two",
+			NULL) == false)) {
+		return false;
+	}
+
+	snprintf(path, sizeof(path), "%s/link.a", dir);
+	if (symlink("real.a", path) == -1) {
+		perror(path);
+		return false;
+	}
+
+	if ((check_myar(dir, "/dev/null", "-d", "link.a", "one", NULL) ==
+			false) || (check_myar(dir, "list", "-t", "real.a", NULL) ==
+			false) || (check_text(dir, "list", "two\n") == false)) {
+		return false;
+	}
+
+	if ((lstat(path, &st) == -1) || (S_ISLNK(st.st_mode) == false)) {
+		fprintf(stderr, "symlink: %s is no longer a link\n", path);
+		return false;
+	}
+
+	return true;
+}
+
+bool check_in_place(const char *dir) {
+	char one[4029];
+	char two[4037];
+	char path[PATH_MAX];
+	char link_path[PATH_MAX];
+	struct stat st;
+
+	assert(dir != NULL);
+
+	// Headers are 60 bytes, so the second member fills the second 4 KiB block
+	memset(one, 'a', sizeof(one) - 2);
+	one[sizeof(one) - 2] = '\n';
+	one[sizeof(one) - 1] = '\0';
+	memset(two, 'b', sizeof(two) - 2);
+	two[sizeof(two) - 2] = '\n';
+	two[sizeof(two) - 1] = '\0';
+
+	if ((check_write(dir, "one", one) == false) ||
+			(check_write(dir, "two", two) == false) ||
+			(check_write(dir, "three", "three\n") == false) ||
+			(check_write(dir, "four", "four\n") == false) ||
+			(check_myar(dir, "/dev/null", "-q", "keep.a", "one", "two",
+			"three", "four", NULL) == false)) {
+		return false;
+	}
+
+	snprintf(path, sizeof(path), "%s/keep.a", dir);
+	snprintf(link_path, sizeof(link_path), "%s/link.a", dir);
+	if (link(path, link_path) == -1) {
+		perror(link_path);
+		return false;
+	}
+
+	if ((check_myar(dir, "/dev/null", "-d", "link.a", "two", NULL) ==
+			false) || (check_tool(dir, "list", "ar", "t", "keep.a", NULL) ==
+			false) || (check_text(dir, "list", "one\nthree\nfour\n") ==
+			false)) {
+		return false;
+	}
+
+	if ((check_myar(dir, "/dev/null", "-d", "link.a", "three", NULL) ==
+			false) || (check_tool(dir, "list", "ar", "t", "keep.a", NULL) ==
+			false) || (check_text(dir, "list", "one\nfour\n") == false)) {
+		return false;
+	}
+
+	if ((stat(path, &st) == -1) || (st.st_nlink != 2)) {
+		fprintf(stderr, "in-place: %s lost its second link\n", path);
+		return false;
+	}
+
+	snprintf(path, sizeof(path), "%s/out", dir);
+	if (mkdir(path, 0777) == -1) {
+		perror(path);
+		return false;
+	}
+
+	return check_tool(path, "/dev/null", "ar", "x", "../keep.a", NULL) &&
+			check_text(path, "one", one) && check_text(path, "four", "four\n");
+}
+
+bool check_stream_create(const char *dir) {
+	assert(dir != NULL);
+
+	if ((check_object(dir, "hash.o") == false) ||
+			(check_object(dir, "pool.o") == false) ||
+			(check_write(dir, "notes", "not an object\n") == false)) {
+		return false;
+	}
+
+	return check_myar(dir, "/dev/null", "-q", "file.a", "hash.o", "notes",
+			"pool.o", NULL) && check_myar(dir, "stream.a", "-q", "-", "hash.o",
+			"notes", "pool.o", NULL) && check_tool(dir, "/dev/null", "cmp",
+			"file.a", "stream.a", NULL);
+}
+
+bool check_replace_runs(const char *dir) {
+	// Size of each member's line before and after, 0 if it isn't replaced
+	static const size_t sizes[][2] = {
+		{ 64, 0 }, { 64, 1024 }, { 3072, 0 }, { 64, 128 }, { 3072, 0 },
+		{ 3072, 128 }, { 3072, 0 }
+	};
+	static const char *const names[] = { "a", "b", "c", "d", "e", "f", "g" };
+	char data[7][3072];
+	char path[PATH_MAX];
+	char link_path[PATH_MAX];
+	struct stat st;
+	size_t i;
+
+	assert(dir != NULL);
+
+	for (i = 0; i < 7; i++) {
+		check_fill(data[i], sizes[i][0], 'a' + i);
+		if (check_write(dir, names[i], data[i]) == false) {
+			return false;
+		}
+	}
+
+	if (check_myar(dir, "/dev/null", "-q", "keep.a", "a", "b", "c", "d", "e",
+			"f", "g", NULL) == false) {
+		return false;
+	}
+
+	snprintf(path, sizeof(path), "%s/keep.a", dir);
+	snprintf(link_path, sizeof(link_path), "%s/link.a", dir);
+	if (link(path, link_path) == -1) {
+		perror(link_path);
+		return false;
+	}
+
+	// c moves 960 bytes toward the back onto e, which has to move 1024 bytes
+	// first, and g moves 1920 bytes toward the front
+	for (i = 0; i < 7; i++) {
+		if (sizes[i][1] > 0) {
+			check_fill(data[i], sizes[i][1], 'A' + i);
+			if (check_write(dir, names[i], data[i]) == false) {
+				return false;
+			}
+		}
+	}
+
+	if ((check_myar(dir, "/dev/null", "-r", "link.a", "b", "d", "f", NULL) ==
+			false) || (check_tool(dir, "list", "ar", "t", "keep.a", NULL) ==
+			false) || (check_text(dir, "list", "a\nb\nc\nd\ne\nf\ng\n") ==
+			false)) {
+		return false;
+	}
+
+	if ((stat(path, &st) == -1) || (st.st_nlink != 2)) {
+		fprintf(stderr, "replace-runs: %s lost its second link\n", path);
+		return false;
+	}
+
+	snprintf(path, sizeof(path), "%s/out", dir);
+	if (mkdir(path, 0777) == -1) {
+		perror(path);
+		return false;
+	}
+
+	if (check_tool(path, "/dev/null", "ar", "x", "../keep.a", NULL) == false) {
+		return false;
+	}
+
+	for (i = 0; i < 7; i++) {
+		if (check_text(path, names[i], data[i]) == false) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool check_script_flush(const char *dir) {
+	char script[OUT_MAX];
+	char name[16];
+	char data[32];
+	size_t i;
+
+	assert(dir != NULL);
+
+	strcpy(script, "ADDMOD");
+	for (i = 0; i < 200; i++) {
+		snprintf(name, sizeof(name), "f%03zu", i);
+		snprintf(data, sizeof(data), "%s\n", name);
+		if (check_write(dir, name, data) == false) {
+			return false;
+		}
+
+		strcat(script, " ");
+		strcat(script, name);
+	}
+
+	strcat(script, "\nDELETE f005\nADDMOD f005\nEXTRACT f005\nEND\n");
+	if (check_write(dir, "script", script) == false) {
+		return false;
+	}
+
+	if ((check_myar(dir, "/dev/null", "-M", "got.a", "script", NULL) ==
+			false) || (check_text(dir, "f005", "f005\n") == false)) {
+		return false;
+	}
+
+	return check_tool(dir, "/dev/null", "sh", "-c", "ar q ref.a f[0-9]* && "
+			"ar d ref.a f005 && ar q ref.a f005", NULL) &&
+			check_tool(dir, "got", "ar", "t", "got.a", NULL) &&
+			check_tool(dir, "expect", "ar", "t", "ref.a", NULL) &&
+			check_same(dir, "got", "expect") &&
+			check_tool(dir, "got", "ar", "p", "got.a", NULL) &&
+			check_tool(dir, "expect", "ar", "p", "ref.a", NULL) &&
+			check_same(dir, "got", "expect");
+}
+
+bool check_dedup(const char *dir) {
+	char path[PATH_MAX];
+	struct stat st;
+	off_t size;
+
+	assert(dir != NULL);
+
+	if ((check_write(dir, "one", "one\n") == false) ||
+			(check_write(dir, "two", "two\n") == false) ||
+			(check_write(dir, "three", "three\n") == false) ||
+			(check_myar(dir, "/dev/null", "-q", "got.a", "one", "two", NULL) ==
+			false) || (check_tool(dir, "/dev/null", "ar", "q", "ref.a", "one",
+			"two", NULL) == false)) {
+		return false;
+	}
+
+	// Only the contents tell the new two from the stored one
+	if ((check_write(dir, "two", "TWO\n") == false) ||
+			(check_myar(dir, "/dev/null", "-k", "-j", "2", "-q", "got.a", "one",
+			"two", "three", NULL) == false) || (check_tool(dir, "/dev/null",
+			"ar", "q", "ref.a", "two", "three", NULL) == false)) {
+		return false;
+	}
+
+	if ((check_tool(dir, "got", "ar", "t", "got.a", NULL) == false) ||
+			(check_tool(dir, "expect", "ar", "t", "ref.a", NULL) == false) ||
+			(check_same(dir, "got", "expect") == false) ||
+			(check_tool(dir, "got", "ar", "p", "got.a", NULL) == false) ||
+			(check_tool(dir, "expect", "ar", "p", "ref.a", NULL) == false) ||
+			(check_same(dir, "got", "expect") == false)) {
+		return false;
+	}
+
+	snprintf(path, sizeof(path), "%s/got.a", dir);
+	if (stat(path, &st) == -1) {
+		perror(path);
+		return false;
+	}
+
+	size = st.st_size;
+	if (check_myar(dir, "/dev/null", "-k", "-q", "got.a", "one", "two",
+			"three", NULL) == false) {
+		return false;
+	}
+
+	if (stat(path, &st) == -1) {
+		perror(path);
+		return false;
+	}
+
+	if (st.st_size != size) {
+		fprintf(stderr, "dedup: appending stored files again grew %s from "
+				"%lld to %lld bytes\n", path, (long long)size,
+				(long long)st.st_size);
+		return false;
+	}
+
+	return true;
+}
+
+bool check_index_stale(const char *dir) {
+	const uint32_t order = 0x01020304;
+	uint32_t marker;
+	char path[PATH_MAX];
+	int fd;
+
+	assert(dir != NULL);
+
+	if ((check_write(dir, "one", "one\n") == false) ||
+			(check_write(dir, "two", "two\n") == false) ||
+			(check_write(dir, "three", "three\n") == false) ||
+			(check_myar(dir, "/dev/null", "-i", "-q", "x.a", "one", "two",
+			NULL) == false) || (check_index_agrees(dir, "x.a") == false)) {
+		return false;
+	}
+
+	// The index still lists one, which is gone
+	if ((check_tool(dir, "/dev/null", "ar", "d", "x.a", "one", NULL) ==
+			false) || (check_tool(dir, "/dev/null", "ar", "q", "x.a", "three",
+			NULL) == false) || (check_index_agrees(dir, "x.a") == false)) {
+		return false;
+	}
+
+	// Swap the marker's bytes, as if another machine had written the index
+	snprintf(path, sizeof(path), "%s/x.a.idx", dir);
+	marker = __builtin_bswap32(order);
+	fd = open(path, O_RDWR);
+	if ((fd == -1) || (pwrite(fd, &marker, sizeof(marker),
+			INDEX_BYTE_ORDER_AT) != sizeof(marker))) {
+		perror(path);
+		if (fd != -1) {
+			close(fd);
+		}
+
+		return false;
+	}
+
+	close(fd);
+
+	if (check_index_agrees(dir, "x.a") == false) {
+		return false;
+	}
+
+	fd = open(path, O_RDONLY);
+	if ((fd == -1) || (pread(fd, &marker, sizeof(marker),
+			INDEX_BYTE_ORDER_AT) != sizeof(marker))) {
+		perror(path);
+		if (fd != -1) {
+			close(fd);
+		}
+
+		return false;
+	}
+
+	close(fd);
+
+	if (marker != order) {
+		fprintf(stderr, "index-stale: %s wasn't rebuilt\n", path);
+		return false;
+	}
+
+	return true;
+}
+
+bool check_index_agrees(const char *dir, const char *archive) {
+	char got[PATH_MAX];
+	char expect[PATH_MAX];
+	char from[PATH_MAX];
+
+	assert(dir != NULL);
+	assert(archive != NULL);
+
+	snprintf(got, sizeof(got), "%s/got.d", dir);
+	snprintf(expect, sizeof(expect), "%s/expect.d", dir);
+	snprintf(from, sizeof(from), "../%s", archive);
+	nftw(got, check_unlink, 16, FTW_DEPTH | FTW_PHYS);
+	nftw(expect, check_unlink, 16, FTW_DEPTH | FTW_PHYS);
+	if ((mkdir(got, 0777) == -1) || (mkdir(expect, 0777) == -1)) {
+		perror(dir);
+		return false;
+	}
+
+	if ((check_myar(dir, "got", "-i", "-t", archive, NULL) == false) ||
+			(check_tool(dir, "expect", "ar", "t", archive, NULL) == false) ||
+			(check_same(dir, "got", "expect") == false)) {
+		return false;
+	}
+
+	// Every member the case uses, each found through the index
+	return check_myar(got, "/dev/null", "-i", "-x", from, "one", "two",
+			"three", NULL) && check_tool(expect, "/dev/null", "ar", "x", from,
+			NULL) && check_tool(dir, "/dev/null", "diff", "-r", "got.d",
+			"expect.d", NULL);
+}
+
+bool check_symtab_delete(const char *dir) {
+	char path[PATH_MAX];
+	char link_path[PATH_MAX];
+
+	assert(dir != NULL);
+
+	if ((check_object(dir, "hash.o") == false) ||
+			(check_object(dir, "pool.o") == false) ||
+			(check_object(dir, "stats.o") == false) ||
+			(check_write(dir, "notes", "not an object\n") == false)) {
+		return false;
+	}
+
+	if ((check_myar(dir, "/dev/null", "-q", "got.a", "hash.o", "notes",
+			"pool.o", "stats.o", NULL) == false) || (check_tool(dir,
+			"/dev/null", "ar", "rcs", "ref.a", "hash.o", "notes", "pool.o",
+			"stats.o", NULL) == false)) {
+		return false;
+	}
+
+	// A rewrite first, pool.o and stats.o move toward the front
+	if ((check_myar(dir, "/dev/null", "-d", "got.a", "notes", NULL) ==
+			false) || (check_tool(dir, "/dev/null", "ar", "d", "ref.a",
+			"notes", NULL) == false) || (check_index(dir, "got.a", "got") ==
+			false) || (check_index(dir, "ref.a", "expect") == false) ||
+			(check_same(dir, "got", "expect") == false)) {
+		return false;
+	}
+
+	snprintf(path, sizeof(path), "%s/got.a", dir);
+	snprintf(link_path, sizeof(link_path), "%s/link.a", dir);
+	if (link(path, link_path) == -1) {
+		perror(link_path);
+		return false;
+	}
+
+	// Then in place, only stats.o moves and pool.o's symbols go
+	if ((check_myar(dir, "/dev/null", "-d", "link.a", "pool.o", NULL) ==
+			false) || (check_tool(dir, "/dev/null", "ar", "d", "ref.a",
+			"pool.o", NULL) == false) || (check_index(dir, "got.a", "got") ==
+			false) || (check_index(dir, "ref.a", "expect") == false) ||
+			(check_same(dir, "got", "expect") == false)) {
+		return false;
+	}
+
+	return check_tool(dir, "got", "ar", "t", "got.a", NULL) &&
+			check_tool(dir, "expect", "ar", "t", "ref.a", NULL) &&
+			check_same(dir, "got", "expect") &&
+			check_tool(dir, "got", "ar", "p", "got.a", NULL) &&
+			check_tool(dir, "expect", "ar", "p", "ref.a", NULL) &&
+			check_tool(dir, "/dev/null", "cmp", "got", "expect", NULL);
+}
+
+bool check_myar(const char *dir, const char *out, ...) {
+	char *argv[MAX_ARGS + 2];
+	va_list ap;
+	size_t argc;
+
+	assert(dir != NULL);
+	assert(out != NULL);
+
+	argv[0] = (char *)myar;
+	argc = 1;
+	va_start(ap, out);
+	while ((argv[argc] = va_arg(ap, char *)) != NULL) {
+		argc++;
+		assert(argc <= MAX_ARGS);
+	}
+
+	va_end(ap);
+
+	return check_exec(dir, out, argv);
+}
+
+bool check_tool(const char *dir, const char *out, const char *prog, ...) {
+	char *argv[MAX_ARGS + 2];
+	va_list ap;
+	size_t argc;
+
+	assert(dir != NULL);
+	assert(out != NULL);
+	assert(prog != NULL);
+
+	argv[0] = (char *)prog;
+	argc = 1;
+	va_start(ap, prog);
+	while ((argv[argc] = va_arg(ap, char *)) != NULL) {
+		argc++;
+		assert(argc <= MAX_ARGS);
+	}
+
+	va_end(ap);
+
+	return check_exec(dir, out, argv);
+}
+
+bool check_exec(const char *dir, const char *out, char **argv) {
+	pid_t pid;
+	int status;
+	size_t i;
+
+	assert(dir != NULL);
+	assert(out != NULL);
+	assert(argv != NULL);
+
+	pid = fork();
+	if (pid == -1) {
+		perror("fork");
+		return false;
+	}
+
+	if (pid == 0) {
+		int fd;
+
+		if (chdir(dir) == -1) {
+			perror(dir);
+			_exit(127);
+		}
+
+		fd = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if ((fd == -1) || (dup2(fd, STDOUT_FILENO) == -1)) {
+			perror(out);
+			_exit(127);
+		}
+
+		close(fd);
+		execvp(argv[0], argv);
+		perror(argv[0]);
+		_exit(127);
+	}
+
+	if (waitpid(pid, &status, 0) == -1) {
+		perror("waitpid");
+		return false;
+	}
+
+	if ((WIFEXITED(status) == false) || (WEXITSTATUS(status) != 0)) {
+		fprintf(stderr, "%s: %s", dir, (argv[0] == myar) ? "myar" : argv[0]);
+		for (i = 1; argv[i] != NULL; i++) {
+			fprintf(stderr, " %s", argv[i]);
+		}
+
+		fprintf(stderr, " failed\n");
+		return false;
+	}
+
+	return true;
+}
+
+bool check_index(const char *dir, const char *archive, const char *out) {
+	char cmd[PATH_MAX + 64];
+
+	assert(dir != NULL);
+	assert(archive != NULL);
+	assert(out != NULL);
+
+	snprintf(cmd, sizeof(cmd), "nm -s %s 2>/dev/null | sed -n '/^Archive index:/,/^$/p' "
+			"| sort", archive);
+
+	return check_tool(dir, out, "sh", "-c", cmd, NULL);
+}
+
+bool check_object(const char *dir, const char *name) {
+	char from[PATH_MAX];
+	char to[PATH_MAX];
+	uint8_t buf[OUT_MAX];
+	ssize_t n;
+	bool ok;
+	int in_fd;
+	int out_fd;
+
+	assert(dir != NULL);
+	assert(name != NULL);
+
+	snprintf(from, sizeof(from), "%s/%s", objdir, name);
+	snprintf(to, sizeof(to), "%s/%s", dir, name);
+	in_fd = open(from, O_RDONLY);
+	if (in_fd == -1) {
+		perror(from);
+		return false;
+	}
+
+	out_fd = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (out_fd == -1) {
+		perror(to);
+		close(in_fd);
+		return false;
+	}
+
+	ok = true;
+	while (ok && ((n = read(in_fd, buf, sizeof(buf))) > 0)) {
+		ok = (write(out_fd, buf, n) == n);
+	}
+
+	if ((ok == false) || (n == -1)) {
+		perror(to);
+		ok = false;
+	}
+
+	close(in_fd);
+
+	return (close(out_fd) == 0) && ok;
+}
+
+void check_fill(char *buf, size_t size, char c) {
+	assert(buf != NULL);
+	assert(size >= 2);
+
+	memset(buf, c, size - 2);
+	buf[size - 2] = '\n';
+	buf[size - 1] = '\0';
+}
+
+bool check_write(const char *dir, const char *name, const char *data) {
+	char path[PATH_MAX];
+	size_t len;
+	int fd;
+
+	assert(dir != NULL);
+	assert(name != NULL);
+	assert(data != NULL);
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	len = strlen(data);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if ((fd == -1) || (write(fd, data, len) != (ssize_t)len)) {
+		perror(path);
+		if (fd != -1) {
+			close(fd);
+		}
+
+		return false;
+	}
+
+	return close(fd) == 0;
+}
+
+bool check_read(const char *dir, const char *name, char *buf) {
+	char path[PATH_MAX];
+	ssize_t n;
+	int fd;
+
+	assert(dir != NULL);
+	assert(name != NULL);
+	assert(buf != NULL);
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		perror(path);
+		return false;
+	}
+
+	n = read(fd, buf, OUT_MAX - 1);
+	close(fd);
+	if (n == -1) {
+		perror(path);
+		return false;
+	}
+
+	buf[n] = '\0';
+
+	return true;
+}
+
+bool check_text(const char *dir, const char *name, const char *expect) {
+	char buf[OUT_MAX];
+
+	assert(dir != NULL);
+	assert(name != NULL);
+	assert(expect != NULL);
+
+	if (check_read(dir, name, buf) == false) {
+		return false;
+	}
+
+	if (strcmp(buf, expect) != 0) {
+		fprintf(stderr, "%s/%s holds:\n%s\ninstead of:\n%s\n", dir, name, buf,
+				expect);
+		return false;
+	}
+
+	return true;
+}
+
+bool check_same(const char *dir, const char *name, const char *expect) {
+	char buf[OUT_MAX];
+
+	assert(dir != NULL);
+	assert(name != NULL);
+	assert(expect != NULL);
+
+	return check_read(dir, expect, buf) && check_text(dir, name, buf);
+}
+
+int check_unlink(const char *path, const struct stat *st, int type,
+		struct FTW *ftw) {
+	(void)st;
+	(void)ftw;
+
+	if (type == FTW_DP) {
+		rmdir(path);
+	} else {
+		unlink(path);
+	}
+
+	return 0;
+}
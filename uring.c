@@ -0,0 +1,571 @@
+/**
+ * @file uring.c
+ * @author Dan Albert
+ * @date Created 10/16/2026
+ * @date Last updated 10/16/2026
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Implements an optional io_uring backend for batched file transfers.
+ * 
+ */
+#define _GNU_SOURCE 1
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "stats.h"
+#include "uring.h"
+
+/// Size of the buffer each transfer in flight copies through
+#define URING_BUF_SIZE (128 * 1024)
+
+/// Most requests one transfer has in flight: open, read, write and close
+#define URING_OPS_PER_SLOT 4
+
+/// Number of low bits of a request's user data that hold its kind
+#define URING_OP_BITS 2
+
+/// Request opening a file
+#define URING_OP_OPEN 0
+
+/// Request reading a piece
+#define URING_OP_READ 1
+
+/// Request writing a piece
+#define URING_OP_WRITE 2
+
+/// Request closing a file
+#define URING_OP_CLOSE 3
+
+/**
+ * @brief State of one transfer in flight.
+ */
+struct uring_slot {
+	struct uring_file *file;	///< Transfer using the slot, NULL when free
+	off_t done;					///< Data bytes copied so far
+	size_t chunk;				///< Data bytes in the piece in flight
+	size_t lead;				///< Prefix bytes in the piece in flight
+	unsigned int outstanding;	///< Requests not yet completed
+	bool open;					///< Whether the slot's direct descriptor is open
+	bool failed;				///< Whether any request has failed
+};
+
+struct uring {
+	int fd;						///< File descriptor of the ring
+	unsigned int depth;			///< Number of transfer slots
+	unsigned int queued;		///< Requests queued but not yet submitted
+	unsigned int *sq_tail;		///< Submission queue tail
+	unsigned int *sq_mask;		///< Submission queue index mask
+	unsigned int *sq_array;		///< Submission queue index array
+	struct io_uring_sqe *sqes;	///< Submission queue entries
+	unsigned int *cq_head;		///< Completion queue head
+	unsigned int *cq_tail;		///< Completion queue tail
+	unsigned int *cq_mask;		///< Completion queue index mask
+	struct io_uring_cqe *cqes;	///< Completion queue entries
+	void *rings;				///< Mapping of the queue rings
+	size_t rings_size;			///< Size of the queue ring mapping
+	size_t sqes_size;			///< Size of the submission entry mapping
+	uint8_t *bufs;				///< One buffer of URING_BUF_SIZE per slot
+	struct uring_slot *slots;	///< Transfer slots
+	struct uring_file *files;	///< Transfers of the current batch
+	size_t count;				///< Number of transfers in the batch
+	size_t next;				///< Next transfer to start
+	size_t active;				///< Number of transfers in flight
+};
+
+/**
+ * @brief Queues a blank request.
+ *
+ * Preconditions: ring is a handle returned by uring_open, fewer than the
+ * ring's capacity of requests are in flight
+ *
+ * Postconditions: A zeroed request has been added to the submission queue
+ *
+ * @param ring Handle of the ring
+ * @return Pointer to the request to fill in
+ */
+struct io_uring_sqe *uring_get_sqe(struct uring *ring);
+
+/**
+ * @brief Submits queued requests and waits for at least one to complete.
+ *
+ * Preconditions: ring is a handle returned by uring_open
+ *
+ * Postconditions: Queued requests have been submitted
+ *
+ * @param ring Handle of the ring
+ * @return true on success, false otherwise
+ */
+bool uring_submit_wait(struct uring *ring);
+
+/**
+ * @brief Starts a transfer in a free slot.
+ *
+ * Preconditions: ring is a handle returned by uring_open, slot is free, file
+ * is not NULL
+ *
+ * Postconditions: The transfer's first piece has been queued
+ *
+ * @param ring Handle of the ring
+ * @param slot Index of the slot
+ * @param file Transfer to start
+ */
+void uring_start(struct uring *ring, size_t slot, struct uring_file *file);
+
+/**
+ * @brief Queues the next piece of a transfer as a chain of linked requests.
+ *
+ * Preconditions: ring is a handle returned by uring_open, slot holds a
+ * transfer with no requests in flight
+ *
+ * Postconditions: An open if first is set, a read and write of the next piece,
+ * and a close if it is the last piece have been queued
+ *
+ * @param ring Handle of the ring
+ * @param slot Index of the slot
+ * @param first Whether this is the transfer's first piece
+ */
+void uring_queue_piece(struct uring *ring, size_t slot, bool first);
+
+/**
+ * @brief Handles the completion of a request.
+ *
+ * Preconditions: ring is a handle returned by uring_open, user_data is that of
+ * a request in flight
+ *
+ * Postconditions: The slot's state has been updated, and if it has no more
+ * requests in flight, its transfer has been moved along
+ *
+ * @param ring Handle of the ring
+ * @param user_data User data of the completed request
+ * @param res Result of the completed request
+ */
+void uring_complete(struct uring *ring, uint64_t user_data, int32_t res);
+
+/**
+ * @brief Releases a slot and starts the next transfer in it.
+ *
+ * Preconditions: ring is a handle returned by uring_open, slot holds a
+ * transfer with no requests in flight and its descriptor closed
+ *
+ * Postconditions: The transfer's ok flag is set, the slot holds the next
+ * transfer or is free
+ *
+ * @param ring Handle of the ring
+ * @param slot Index of the slot
+ * @param ok Whether the transfer succeeded
+ */
+void uring_finish(struct uring *ring, size_t slot, bool ok);
+
+struct uring *uring_open(unsigned int depth) {
+	struct io_uring_params params;
+	struct io_uring_rsrc_register reg;
+	struct uring *ring;
+	uint8_t *rings;
+	size_t sq_size;
+	size_t cq_size;
+
+	assert(depth > 0);
+
+	ring = (struct uring *)calloc(1, sizeof(struct uring));
+	if (ring == NULL) {
+		return NULL;
+	}
+
+	memset(&params, 0, sizeof(params));
+	ring->fd = syscall(__NR_io_uring_setup, depth * URING_OPS_PER_SLOT, &params);
+	if (ring->fd < 0) {
+		free(ring);
+		return NULL;
+	}
+
+	// Older kernels need more bookkeeping than is worth carrying
+	if (((params.features & IORING_FEAT_SINGLE_MMAP) == 0) ||
+			((params.features & IORING_FEAT_NODROP) == 0)) {
+		close(ring->fd);
+		free(ring);
+		return NULL;
+	}
+
+	// Map the submission and completion rings, which share one mapping
+	sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->rings_size = (sq_size > cq_size) ? sq_size : cq_size;
+	ring->rings = mmap(NULL, ring->rings_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->rings == MAP_FAILED) {
+		close(ring->fd);
+		free(ring);
+		return NULL;
+	}
+
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqes_size,
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+			IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		munmap(ring->rings, ring->rings_size);
+		close(ring->fd);
+		free(ring);
+		return NULL;
+	}
+
+	rings = (uint8_t *)ring->rings;
+	ring->sq_tail = (unsigned int *)(rings + params.sq_off.tail);
+	ring->sq_mask = (unsigned int *)(rings + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned int *)(rings + params.sq_off.array);
+	ring->cq_head = (unsigned int *)(rings + params.cq_off.head);
+	ring->cq_tail = (unsigned int *)(rings + params.cq_off.tail);
+	ring->cq_mask = (unsigned int *)(rings + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(rings + params.cq_off.cqes);
+	ring->depth = depth;
+
+	// Reserve one direct descriptor per slot so files can be opened, used
+	// and closed by a single chain of requests
+	memset(&reg, 0, sizeof(reg));
+	reg.nr = depth;
+	reg.flags = IORING_RSRC_REGISTER_SPARSE;
+
+	ring->bufs = (uint8_t *)malloc(depth * URING_BUF_SIZE);
+	ring->slots = (struct uring_slot *)calloc(depth, sizeof(struct uring_slot));
+	if ((ring->bufs == NULL) || (ring->slots == NULL) ||
+			(syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_FILES2,
+				&reg, sizeof(reg)) < 0)) {
+		uring_close(ring);
+		return NULL;
+	}
+
+	return ring;
+}
+
+void uring_close(struct uring *ring) {
+	assert(ring != NULL);
+
+	munmap(ring->sqes, ring->sqes_size);
+	munmap(ring->rings, ring->rings_size);
+	close(ring->fd);
+	free(ring->bufs);
+	free(ring->slots);
+	free(ring);
+}
+
+bool uring_transfer(struct uring *ring, struct uring_file *files, size_t count) {
+	size_t slot;
+	size_t i;
+	bool ok;
+
+	assert(ring != NULL);
+	assert(files != NULL);
+
+	ring->files = files;
+	ring->count = count;
+	ring->next = 0;
+	ring->active = 0;
+
+	// Fill every slot
+	for (slot = 0; (slot < ring->depth) && (ring->next < count); slot++) {
+		uring_start(ring, slot, &files[ring->next++]);
+	}
+
+	// Keep the slots busy until everything is done
+	while (ring->active > 0) {
+		unsigned int head;
+
+		if (uring_submit_wait(ring) == false) {
+			// Requests may still be in flight, the ring can't be trusted
+			for (i = 0; i < count; i++) {
+				files[i].ok = false;
+			}
+
+			return false;
+		}
+
+		head = *ring->cq_head;
+		while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+			struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+			uint64_t user_data = cqe->user_data;
+			int32_t res = cqe->res;
+
+			head++;
+			__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+			uring_complete(ring, user_data, res);
+		}
+	}
+
+	ok = true;
+	for (i = 0; i < count; i++) {
+		if (files[i].ok == false) {
+			ok = false;
+		}
+	}
+
+	return ok;
+}
+
+struct io_uring_sqe *uring_get_sqe(struct uring *ring) {
+	struct io_uring_sqe *sqe;
+	unsigned int tail;
+	unsigned int index;
+
+	assert(ring != NULL);
+
+	tail = *ring->sq_tail;
+	index = tail & *ring->sq_mask;
+
+	sqe = &ring->sqes[index];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	ring->sq_array[index] = index;
+
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring->queued++;
+
+	return sqe;
+}
+
+bool uring_submit_wait(struct uring *ring) {
+	int ret;
+
+	assert(ring != NULL);
+
+	do {
+		ret = syscall(__NR_io_uring_enter, ring->fd, ring->queued, 1,
+				IORING_ENTER_GETEVENTS, NULL, 0);
+		STATS_IO(STATS_URING, 0, 0);
+	} while ((ret < 0) && (errno == EINTR));
+
+	if (ret < 0) {
+		perror("io_uring_enter");
+		return false;
+	}
+
+	ring->queued -= ret;
+
+	return true;
+}
+
+void uring_start(struct uring *ring, size_t slot, struct uring_file *file) {
+	struct uring_slot *s;
+
+	assert(ring != NULL);
+	assert(slot < ring->depth);
+	assert(file != NULL);
+	assert(file->to_file == false || file->prefix_len == 0);
+	assert(file->prefix_len < URING_BUF_SIZE);
+
+	s = &ring->slots[slot];
+	s->file = file;
+	s->done = 0;
+	s->outstanding = 0;
+	s->open = false;
+	s->failed = false;
+	ring->active++;
+
+	uring_queue_piece(ring, slot, true);
+}
+
+void uring_queue_piece(struct uring *ring, size_t slot, bool first) {
+	struct io_uring_sqe *chain[URING_OPS_PER_SLOT];
+	struct uring_slot *s;
+	struct uring_file *file;
+	uint8_t *buf;
+	off_t remaining;
+	bool last;
+	int n;
+	int i;
+
+	assert(ring != NULL);
+	assert(slot < ring->depth);
+
+	s = &ring->slots[slot];
+	file = s->file;
+	buf = ring->bufs + slot * URING_BUF_SIZE;
+
+	// The prefix rides along with the first piece of data
+	s->lead = first ? file->prefix_len : 0;
+	remaining = file->size - s->done;
+	s->chunk = (remaining < (off_t)(URING_BUF_SIZE - s->lead)) ?
+			(size_t)remaining : URING_BUF_SIZE - s->lead;
+	last = (s->done + (off_t)s->chunk == file->size);
+
+	n = 0;
+	if (first) {
+		chain[n] = uring_get_sqe(ring);
+		chain[n]->opcode = IORING_OP_OPENAT;
+		chain[n]->fd = AT_FDCWD;
+		chain[n]->addr = (uintptr_t)file->path;
+		chain[n]->len = file->mode;
+		chain[n]->open_flags = file->flags;
+		chain[n]->file_index = slot + 1;
+		chain[n]->user_data = (slot << URING_OP_BITS) | URING_OP_OPEN;
+		n++;
+	}
+
+	if (s->lead > 0) {
+		memcpy(buf, file->prefix, s->lead);
+	}
+
+	if (s->chunk > 0) {
+		chain[n] = uring_get_sqe(ring);
+		chain[n]->opcode = IORING_OP_READ;
+		if (file->to_file) {
+			chain[n]->fd = file->fd;
+			chain[n]->off = file->offset + s->done;
+		} else {
+			chain[n]->fd = slot;
+			chain[n]->flags = IOSQE_FIXED_FILE;
+			chain[n]->off = s->done;
+		}
+		chain[n]->addr = (uintptr_t)(buf + s->lead);
+		chain[n]->len = s->chunk;
+		chain[n]->user_data = (slot << URING_OP_BITS) | URING_OP_READ;
+		n++;
+	}
+
+	if (s->lead + s->chunk > 0) {
+		chain[n] = uring_get_sqe(ring);
+		chain[n]->opcode = IORING_OP_WRITE;
+		if (file->to_file) {
+			chain[n]->fd = slot;
+			chain[n]->flags = IOSQE_FIXED_FILE;
+			chain[n]->off = s->done;
+		} else {
+			chain[n]->fd = file->fd;
+			chain[n]->off = file->offset + file->prefix_len - s->lead + s->done;
+		}
+		chain[n]->addr = (uintptr_t)buf;
+		chain[n]->len = s->lead + s->chunk;
+		chain[n]->user_data = (slot << URING_OP_BITS) | URING_OP_WRITE;
+		n++;
+	}
+
+	if (last) {
+		chain[n] = uring_get_sqe(ring);
+		chain[n]->opcode = IORING_OP_CLOSE;
+		chain[n]->file_index = slot + 1;
+		chain[n]->user_data = (slot << URING_OP_BITS) | URING_OP_CLOSE;
+		n++;
+	}
+
+	// Each request waits for the one before it
+	for (i = 0; i < n - 1; i++) {
+		chain[i]->flags |= IOSQE_IO_LINK;
+	}
+
+	s->outstanding += n;
+}
+
+void uring_complete(struct uring *ring, uint64_t user_data, int32_t res) {
+	struct uring_slot *s;
+	size_t slot;
+
+	assert(ring != NULL);
+
+	slot = user_data >> URING_OP_BITS;
+	assert(slot < ring->depth);
+
+	s = &ring->slots[slot];
+	assert(s->outstanding > 0);
+	s->outstanding--;
+
+	switch (user_data & ((1 << URING_OP_BITS) - 1)) {
+	case URING_OP_OPEN:
+		if (res < 0) {
+			errno = -res;
+			perror(s->file->path);
+			s->failed = true;
+		} else {
+			s->open = true;
+		}
+		break;
+	case URING_OP_READ:
+		// Counted as bytes, the ring makes no system call of its own
+		STATS_BYTES((res > 0) ? res : 0, 0);
+		if (res != (int32_t)s->chunk) {
+			s->failed = true;
+		}
+		break;
+	case URING_OP_WRITE:
+		STATS_BYTES(0, (res > 0) ? res : 0);
+		if (res != (int32_t)(s->lead + s->chunk)) {
+			s->failed = true;
+		}
+		break;
+	case URING_OP_CLOSE:
+		if (res != -ECANCELED) {
+			s->open = false;
+		}
+
+		if (res < 0) {
+			s->failed = true;
+		}
+		break;
+	}
+
+	if (s->outstanding > 0) {
+		return;
+	}
+
+	// The chain is done, move the transfer along
+	if (s->failed) {
+		if (s->open) {
+			// The close was cancelled along with the rest of the chain
+			struct io_uring_sqe *sqe = uring_get_sqe(ring);
+
+			sqe->opcode = IORING_OP_CLOSE;
+			sqe->file_index = slot + 1;
+			sqe->user_data = (slot << URING_OP_BITS) | URING_OP_CLOSE;
+			s->outstanding++;
+			s->open = false;
+		} else {
+			uring_finish(ring, slot, false);
+		}
+	} else {
+		s->done += s->chunk;
+		if (s->done == s->file->size) {
+			uring_finish(ring, slot, true);
+		} else {
+			uring_queue_piece(ring, slot, false);
+		}
+	}
+}
+
+void uring_finish(struct uring *ring, size_t slot, bool ok) {
+	assert(ring != NULL);
+	assert(slot < ring->depth);
+
+	ring->slots[slot].file->ok = ok;
+	ring->slots[slot].file = NULL;
+	ring->active--;
+
+	if (ring->next < ring->count) {
+		uring_start(ring, slot, &ring->files[ring->next++]);
+	}
+}
@@ -0,0 +1,107 @@
+/**
+ * @file uring.h
+ * @author Dan Albert
+ * @date Created 10/16/2026
+ * @date Last updated 10/16/2026
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * @section DESCRIPTION
+ * 
+ * Defines an optional io_uring backend for batched file transfers.
+ * 
+ */
+#ifndef URING_H
+#define URING_H
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief Handle to an io_uring instance and its transfer buffers.
+ */
+struct uring;
+
+/**
+ * @brief A file to be copied to or from an archive by uring_transfer.
+ *
+ * The file at path is opened, copied and closed entirely inside the ring, so
+ * a small file costs no system calls of its own.
+ */
+struct uring_file {
+	const char *path;		///< Path of the file to open
+	int flags;				///< Flags to open the file with
+	mode_t mode;			///< Mode for a newly created file
+	bool to_file;			///< true to copy from fd into the file, false to
+							///< copy from the file into fd
+	int fd;					///< File descriptor of the archive
+	off_t offset;			///< Offset in fd of the prefix, or of the data
+							///< if there is no prefix
+	off_t size;				///< Number of data bytes to copy
+	const void *prefix;		///< Bytes written to fd ahead of the data
+	size_t prefix_len;		///< Number of prefix bytes
+	bool ok;				///< Set to whether the transfer succeeded
+};
+
+/**
+ * @brief Sets up an io_uring instance.
+ * 
+ * Preconditions: depth is greater than zero
+ * 
+ * Postconditions: If the kernel supports io_uring, a ring able to keep depth
+ * transfers in flight has been created
+ *
+ * @param depth Number of transfers to keep in flight
+ * @return Handle to the ring, NULL if io_uring is unavailable
+ */
+struct uring *uring_open(unsigned int depth);
+
+/**
+ * @brief Tears down an io_uring instance.
+ * 
+ * Preconditions: ring is a handle returned by uring_open
+ * 
+ * Postconditions: The ring has been closed and freed
+ *
+ * @param ring Handle of the ring
+ */
+void uring_close(struct uring *ring);
+
+/**
+ * @brief Copies a set of files to or from an archive.
+ *
+ * Each file is opened, copied in buffer sized pieces and closed by chains of
+ * linked requests. Up to the ring's depth of files are in flight at once, each
+ * with one piece outstanding, whatever their size.
+ * 
+ * Preconditions: ring is a handle returned by uring_open, files is an array of
+ * count transfers
+ * 
+ * Postconditions: Each transfer's ok flag reflects whether it succeeded
+ *
+ * @param ring Handle of the ring
+ * @param files Transfers to perform
+ * @param count Number of transfers
+ * @return true if every transfer succeeded, false otherwise
+ */
+bool uring_transfer(struct uring *ring, struct uring_file *files, size_t count);
+
+#endif // URING_H
+